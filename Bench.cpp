@@ -0,0 +1,306 @@
+// microbenchmarks of the hot paths of a node, results are written as json.
+// build like run, from every source file except the other mains:
+//   g++ -std=c++17 -O2 Bench.cpp $(ls *.cpp | grep -v -e Run.cpp -e Bench.cpp
+//       -e Simulator.cpp) -lcrypto -pthread -o bench
+// usage: ./bench [filter], only benchmarks whose name contains filter are run
+#include <sys/utsname.h>
+
+#include <nlohmann/json.hpp>
+
+#include "Node.hpp"
+
+#define BENCH_MIN_TIME_MS 300   // shortest measured run of one repetition
+#define BENCH_REPETITIONS 5     // repetitions per benchmark, the median is reported
+#define BENCH_LOG_PATH "/tmp/gnutella-bench.log"
+
+typedef std::chrono::steady_clock Clock;
+
+// a benchmark runs op iterations times, bytes is the payload of one iteration
+struct Bench_Case_t {
+  std::string name;                           //
+  uint64_t bytes;                             // bytes processed per iteration, 0 if none
+  std::function<void(uint64_t iterations)> op;  //
+};
+typedef struct Bench_Case_t Bench_Case;
+
+/**
+ * @brief times iterations runs of a case
+ * returns the elapsed nanoseconds
+*/
+static double timeRun(const Bench_Case & bench, uint64_t iterations) {
+  Clock::time_point start = Clock::now();
+  bench.op(iterations);
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+/**
+ * @brief measures a case
+ * grows the iteration count until a run takes BENCH_MIN_TIME_MS, then takes the
+ * median of BENCH_REPETITIONS runs of that length
+*/
+static nlohmann::json runCase(const Bench_Case & bench) {
+  uint64_t iterations = 1;
+  double elapsed = timeRun(bench, iterations);
+  while (elapsed < BENCH_MIN_TIME_MS * 1e6) {
+    double factor = elapsed > 0 ? BENCH_MIN_TIME_MS * 1e6 * 1.2 / elapsed : 10;
+    iterations = std::max(iterations + 1, (uint64_t)(iterations * std::min(factor, 10.0)));
+    elapsed = timeRun(bench, iterations);
+  }
+  std::vector<double> perOp;
+  for (int i = 0; i < BENCH_REPETITIONS; i++) {
+    perOp.push_back(timeRun(bench, iterations) / iterations);
+  }
+  std::sort(perOp.begin(), perOp.end());
+  double median = perOp[perOp.size() / 2];
+  nlohmann::json result;
+  result["name"] = bench.name;
+  result["iterations"] = iterations;
+  result["repetitions"] = BENCH_REPETITIONS;
+  result["ns_per_op"] = median;
+  result["ns_per_op_min"] = perOp.front();
+  result["ns_per_op_max"] = perOp.back();
+  result["ops_per_second"] = 1e9 / median;
+  if (bench.bytes > 0) {
+    result["bytes_per_op"] = bench.bytes;
+    result["bytes_per_second"] = bench.bytes * 1e9 / median;
+  }
+  return result;
+}
+
+/**
+ * @brief writes size random bytes to path
+ * returns 0 if successful, -1 otherwise
+*/
+static int writeRandomFile(const std::string & path, size_t size) {
+  std::vector<unsigned char> block(1 << 20);
+  RAND_bytes(block.data(), block.size());
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  size_t written = 0;
+  while (written < size) {
+    size_t length = std::min(block.size(), size - written);
+    if (write(fd, block.data(), length) != (ssize_t)length) {
+      close(fd);
+      return -1;
+    }
+    written += length;
+  }
+  close(fd);
+  return 0;
+}
+
+/**
+ * @brief returns a query identifier with a random hash
+*/
+static Query_Identifier randomQueryId(unsigned int timestamp) {
+  Query_Identifier id;
+  memset(&id, 0, sizeof(id));
+  strcpy(id.source.hostName, "vcm-35050.vm.duke.edu");
+  id.source.port = 19170;
+  id.timestamp = timestamp;
+  RAND_bytes(id.hash, sizeof(id.hash));
+  return id;
+}
+
+int main(int argc, char * argv[]) {
+  std::string filter = argc > 1 ? argv[1] : "";
+  char directoryTemplate[] = "/tmp/gnutella-bench-XXXXXX";
+  if (mkdtemp(directoryTemplate) == NULL) {
+    std::cerr << "Error creating benchmark directory\n";
+    return 1;
+  }
+  std::string directory = directoryTemplate;
+  Logger logger(BENCH_LOG_PATH);
+  logger.setLevel(LOG_LEVEL_ERROR);
+  logger.init();
+  File_Util_Handler fileUtilHandler(&logger, directory);
+  Socket_Util_Handler socketUtilHandler(&logger);
+  std::vector<Bench_Case> cases;
+  volatile size_t sink = 0;  // keeps results of the measured calls alive
+
+  // hashing across file sizes, the files stay in the page cache
+  const size_t fileSizes[] = {4 << 10, 256 << 10, 4 << 20, 64 << 20};
+  for (size_t size : fileSizes) {
+    std::string path = directory + "/file-" + std::to_string(size);
+    if (writeRandomFile(path, size) < 0) {
+      std::cerr << "Error writing " << path << "\n";
+      return 1;
+    }
+    cases.push_back({"hash_file/" + std::to_string(size), size, [&, path](uint64_t n) {
+                       for (uint64_t i = 0; i < n; i++) {
+                         sink += fileUtilHandler.hashFile(path).size();
+                       }
+                     }});
+  }
+  const size_t arraySizes[] = {64, 1 << 10, 64 << 10};
+  for (size_t size : arraySizes) {
+    std::shared_ptr<std::vector<char> > data = std::make_shared<std::vector<char> >(size, 'x');
+    cases.push_back({"hash_char_array/" + std::to_string(size), size, [&, data](uint64_t n) {
+                       for (uint64_t i = 0; i < n; i++) {
+                         sink += fileUtilHandler.hashCharArray(data->data(), data->size())
+                                     .size();
+                       }
+                     }});
+  }
+
+  // framing round trips over a socketpair, one message in flight
+  int pair[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+    std::cerr << "Error creating socketpair\n";
+    return 1;
+  }
+  const size_t messageSizes[] = {64, 1 << 10, 16 << 10};
+  for (size_t size : messageSizes) {
+    std::shared_ptr<std::vector<char> > out = std::make_shared<std::vector<char> >(size, 'm');
+    std::shared_ptr<std::vector<char> > in =
+        std::make_shared<std::vector<char> >(MAX_MESSAGE_LENGTH);
+    cases.push_back({"frame_round_trip/" + std::to_string(size), size, [&, out, in](uint64_t n) {
+                       int length;
+                       int type;
+                       for (uint64_t i = 0; i < n; i++) {
+                         socketUtilHandler.sendMessage(pair[0], out->data(), out->size(), T_QUERY);
+                         socketUtilHandler.recvMessage(
+                             pair[1], in->data(), in->size(), &length, &type);
+                         sink += length;
+                       }
+                     }});
+    // the event loop path, one recv can carry many frames
+    std::shared_ptr<Frame_Buffer> frames = std::make_shared<Frame_Buffer>();
+    cases.push_back({"frame_buffer_round_trip/" + std::to_string(size),
+                     size,
+                     [&, out, frames](uint64_t n) {
+                       int length;
+                       int type;
+                       const char * message;
+                       for (uint64_t i = 0; i < n; i++) {
+                         socketUtilHandler.sendMessage(pair[0], out->data(), out->size(), T_QUERY);
+                         while (frames->nextMessage(&type, &message, &length) != 1) {
+                           frames->readFrom(pair[1]);
+                         }
+                         sink += length;
+                       }
+                     }});
+  }
+  std::shared_ptr<Query> query = std::make_shared<Query>();
+  memset(query.get(), 0, sizeof(Query));
+  query->id = randomQueryId(time(NULL));
+  query->prev = query->id.source;
+  query->ttl = 7;
+  cases.push_back({"wire_codec_query", 0, [&, query](uint64_t n) {
+                     char buffer[WIRE_MAX_MESSAGE_LENGTH];
+                     Query decoded;
+                     for (uint64_t i = 0; i < n; i++) {
+                       int length = Wire_Codec::encode(*query, buffer, sizeof(buffer));
+                       sink += Wire_Codec::decode(buffer, length, decoded);
+                     }
+                   }});
+
+  // aes-256-gcm of one transfer record, in place
+  std::shared_ptr<std::vector<char> > record =
+      std::make_shared<std::vector<char> >(TRANSFER_RECORD_SIZE, 'r');
+  unsigned char transferKey[TRANSFER_KEY_SIZE];
+  RAND_bytes(transferKey, sizeof(transferKey));
+  std::shared_ptr<Transfer_Cipher> sealer = std::make_shared<Transfer_Cipher>(transferKey, true);
+  std::shared_ptr<Transfer_Cipher> opener = std::make_shared<Transfer_Cipher>(transferKey, false);
+  File_Meta meta;
+  memset(&meta, 0, sizeof(meta));
+  sealer->seal(meta);
+  opener->open(meta);
+  cases.push_back({"transfer_seal_record", TRANSFER_RECORD_SIZE, [&, record, sealer](uint64_t n) {
+                     unsigned char tag[TRANSFER_TAG_SIZE];
+                     for (uint64_t i = 0; i < n; i++) {
+                       sink += sealer->sealRecord(i, 0, record->data(), record->size(), tag);
+                     }
+                   }});
+  cases.push_back({"transfer_seal_open_record",
+                   TRANSFER_RECORD_SIZE,
+                   [&, record, sealer, opener](uint64_t n) {
+                     unsigned char tag[TRANSFER_TAG_SIZE];
+                     for (uint64_t i = 0; i < n; i++) {
+                       sealer->sealRecord(i, 0, record->data(), record->size(), tag);
+                       sink += opener->openRecord(i, 0, record->data(), record->size(), tag);
+                     }
+                   }});
+
+  // query keys and dedup lookups, half of the lookups are for unseen queries
+  std::vector<Peer_Identifier> noPeers;
+  Node node(&logger, directory, 5, 3, 0, 0, 0, 7, 3600, 3600, 1, 1, noPeers);
+  cases.push_back({"query_identifier_string", 0, [&, query](uint64_t n) {
+                     for (uint64_t i = 0; i < n; i++) {
+                       sink += node.getQueryIdentifierString(query->id).size();
+                     }
+                   }});
+  cases.push_back({"query_cache_make_key", 0, [&, query](uint64_t n) {
+                     for (uint64_t i = 0; i < n; i++) {
+                       sink += Query_Cache::makeKey(query->id).source;
+                     }
+                   }});
+  const size_t tableSizes[] = {1000, 100000, 1000000};
+  for (size_t size : tableSizes) {
+    std::shared_ptr<std::vector<Query_Identifier> > ids =
+        std::make_shared<std::vector<Query_Identifier> >();
+    for (size_t i = 0; i < 2 * size; i++) {
+      ids->push_back(randomQueryId(time(NULL)));
+    }
+    std::shared_ptr<Query_Cache> cache = std::make_shared<Query_Cache>(3600, 3600);
+    std::shared_ptr<std::map<std::string, Peer_Info> > byString =
+        std::make_shared<std::map<std::string, Peer_Info> >();
+    Peer_Info from;
+    memset(&from, 0, sizeof(from));
+    Query_Status status;
+    status.success = false;
+    status.timestamp = time(NULL);
+    for (size_t i = 0; i < size; i++) {
+      cache->insert(Query_Cache::makeKey((*ids)[i]), from, status);
+      (*byString)[node.getQueryIdentifierString((*ids)[i])] = from;
+    }
+    cases.push_back({"query_cache_dedup/" + std::to_string(size), 0, [&, ids, cache](uint64_t n) {
+                       Peer_Info found;
+                       size_t next = 0;
+                       for (uint64_t i = 0; i < n; i++) {
+                         sink += cache->lookup(Query_Cache::makeKey((*ids)[next]), found);
+                         next = next + 1 == ids->size() ? 0 : next + 1;
+                       }
+                     }});
+    // the string keyed map queries used to live in, kept as a baseline
+    cases.push_back({"string_map_dedup/" + std::to_string(size),
+                     0,
+                     [&, ids, byString](uint64_t n) {
+                       size_t next = 0;
+                       for (uint64_t i = 0; i < n; i++) {
+                         sink += byString->count(node.getQueryIdentifierString((*ids)[next]));
+                         next = next + 1 == ids->size() ? 0 : next + 1;
+                       }
+                     }});
+  }
+
+  nlohmann::json report;
+  struct utsname host;
+  uname(&host);
+  report["context"]["date"] = (long long)time(NULL);
+  report["context"]["host"] = host.nodename;
+  report["context"]["kernel"] = std::string(host.sysname) + " " + host.release;
+  report["context"]["cpus"] = std::thread::hardware_concurrency();
+  report["context"]["min_time_ms"] = BENCH_MIN_TIME_MS;
+  report["benchmarks"] = nlohmann::json::array();
+  for (const Bench_Case & bench : cases) {
+    if (bench.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    std::cerr << "running " << bench.name << "\n";
+    report["benchmarks"].push_back(runCase(bench));
+  }
+  std::cout << report.dump(2) << std::endl;
+
+  close(pair[0]);
+  close(pair[1]);
+  for (size_t size : fileSizes) {
+    unlink((directory + "/file-" + std::to_string(size)).c_str());
+  }
+  std::string catalog = directory + ".catalog";
+  unlink(catalog.c_str());
+  rmdir(directory.c_str());
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include "ConnectionPool.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @brief returns the pool key of a peer
+*/
+static std::string poolKey(const std::string & host, unsigned short port) {
+  return host + ":" + std::to_string(port);
+}
+
+Connection_Pool::~Connection_Pool() {
+  for (std::map<std::string, Pool_Peer>::iterator it = peers.begin(); it != peers.end(); ++it) {
+    for (const Pooled_Connection & connection : it->second.idle) {
+      close(connection.fd);
+    }
+  }
+}
+
+/**
+ * @brief checks that the peer did not close an idle connection
+ * returns true if fd has no pending data and is not closed
+*/
+bool Connection_Pool::isReusable(int fd) {
+  char byte;
+  ssize_t peeked = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  // nothing to read is the only clean state, eof or stray bytes are not
+  return peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/**
+ * @brief closes idle connections past POOL_IDLE_TIMEOUT_MS, caller holds poolMutex
+*/
+void Connection_Pool::closeExpired() {
+  Clock::time_point oldest = Clock::now() - std::chrono::milliseconds(POOL_IDLE_TIMEOUT_MS);
+  std::map<std::string, Pool_Peer>::iterator it = peers.begin();
+  while (it != peers.end()) {
+    std::vector<Pooled_Connection> & idle = it->second.idle;
+    // released in order, so the expired ones are at the front
+    size_t expired = 0;
+    while (expired < idle.size() && idle[expired].idleSince < oldest) {
+      close(idle[expired].fd);
+      expired++;
+    }
+    idle.erase(idle.begin(), idle.begin() + expired);
+    it->second.open -= expired;
+    if (it->second.open == 0) {
+      it = peers.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+/**
+ * @brief returns a connection to host:port
+ * reuses the most recently released idle connection, opens a new one if the
+ * peer is under POOL_MAX_PER_PEER and waits for a release otherwise. receives
+ * on new connections fail after POOL_RECV_TIMEOUT_MS without data.
+ * returns the file descriptor if successful, -1 otherwise
+ * @param host the host name of the peer
+ * @param port the file port of the peer
+*/
+int Connection_Pool::acquire(const std::string & host, unsigned short port) {
+  std::string key = poolKey(host, port);
+  Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(POOL_ACQUIRE_TIMEOUT_MS);
+  {
+    std::unique_lock<std::mutex> lock(poolMutex);
+    closeExpired();
+    while (true) {
+      Pool_Peer & peer = peers[key];
+      while (!peer.idle.empty()) {
+        int fd = peer.idle.back().fd;
+        peer.idle.pop_back();
+        if (isReusable(fd)) {
+          Metrics_Registry::add(METRIC_CONNECTIONS_REUSED);
+          return fd;
+        }
+        close(fd);
+        peer.open--;
+      }
+      if (peer.open < POOL_MAX_PER_PEER) {
+        peer.open++;
+        break;
+      }
+      if (poolCond.wait_until(lock, deadline) == std::cv_status::timeout) {
+        logger->logError("Timed out waiting for a connection to " + key);
+        return -1;
+      }
+    }
+  }
+  // connect without the lock, the slot is already counted in open
+  int fd = socketUtilHandler->initClientSocket(host.c_str(), std::to_string(port).c_str());
+  if (fd < 0) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    peers[key].open--;
+    poolCond.notify_one();
+    return -1;
+  }
+  // a stalled source fails the receive instead of holding a download worker forever
+  struct timeval timeout;
+  timeout.tv_sec = POOL_RECV_TIMEOUT_MS / 1000;
+  timeout.tv_usec = (POOL_RECV_TIMEOUT_MS % 1000) * 1000;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  Metrics_Registry::add(METRIC_CONNECTIONS_OPENED);
+  return fd;
+}
+
+/**
+ * @brief hands a connection from acquire back to the pool
+ * @param host the host name it was acquired for
+ * @param port the file port it was acquired for
+ * @param fd the connection
+ * @param reusable true if every request on it was answered in full, false to close it
+*/
+void Connection_Pool::release(const std::string & host,
+                              unsigned short port,
+                              int fd,
+                              bool reusable) {
+  std::lock_guard<std::mutex> lock(poolMutex);
+  Pool_Peer & peer = peers[poolKey(host, port)];
+  if (reusable) {
+    Pooled_Connection connection;
+    connection.fd = fd;
+    connection.idleSince = Clock::now();
+    peer.idle.push_back(connection);
+  }
+  else {
+    close(fd);
+    peer.open--;
+  }
+  closeExpired();
+  poolCond.notify_one();
+}
+
+/**
+ * @brief returns the number of idle connections
+*/
+size_t Connection_Pool::idleCount() {
+  std::lock_guard<std::mutex> lock(poolMutex);
+  size_t count = 0;
+  for (std::map<std::string, Pool_Peer>::iterator it = peers.begin(); it != peers.end(); ++it) {
+    count += it->second.idle.size();
+  }
+  return count;
+}
@@ -0,0 +1,95 @@
+#ifndef CONNECTION_POOL_HPP
+#define CONNECTION_POOL_HPP
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "SocketUtilHandler.hpp"
+
+#define POOL_MAX_PER_PEER 4            // connections to one host:port, idle or in use
+#define POOL_IDLE_TIMEOUT_MS 30000     // idle connections older than this are closed
+#define POOL_ACQUIRE_TIMEOUT_MS 60000  // longest wait for a peer at POOL_MAX_PER_PEER
+#define POOL_RECV_TIMEOUT_MS 30000     // longest a source may go silent before a receive fails
+
+// a connection waiting in the pool
+struct Pooled_Connection_t {
+  int fd;                                            //
+  std::chrono::steady_clock::time_point idleSince;  // when it was released
+};
+typedef struct Pooled_Connection_t Pooled_Connection;
+
+// the connections to one host:port
+struct Pool_Peer_t {
+  std::vector<Pooled_Connection> idle;  // released connections, the newest last
+  int open;                             // idle and in use connections
+};
+typedef struct Pool_Peer_t Pool_Peer;
+
+// keep-alive client connections to the file ports of peers. a connection
+// released in a clean state is handed to the next request for the same
+// host:port, saving the lookup, the handshake and slow start. idle connections
+// are closed after POOL_IDLE_TIMEOUT_MS, checked whenever the pool is used
+class Connection_Pool {
+  Logger * logger;
+  Socket_Util_Handler * socketUtilHandler;
+  std::map<std::string, Pool_Peer> peers;  // host:port -> connections
+  std::mutex poolMutex;                    // mutex for peers map
+  std::condition_variable poolCond;        // signaled when a connection is released
+
+  /**
+ * @brief closes idle connections past POOL_IDLE_TIMEOUT_MS, caller holds poolMutex
+*/
+  void closeExpired();
+
+  /**
+ * @brief checks that the peer did not close an idle connection
+ * returns true if fd has no pending data and is not closed
+*/
+  static bool isReusable(int fd);
+
+ public:
+  Connection_Pool(Logger * logger, Socket_Util_Handler * socketUtilHandler) :
+      logger(logger),
+      socketUtilHandler(socketUtilHandler),
+      peers(),
+      poolMutex(),
+      poolCond() {}
+
+  ~Connection_Pool();
+
+  /**
+ * @brief returns a connection to host:port
+ * reuses the most recently released idle connection, opens a new one if the
+ * peer is under POOL_MAX_PER_PEER and waits for a release otherwise. receives
+ * on new connections fail after POOL_RECV_TIMEOUT_MS without data.
+ * returns the file descriptor if successful, -1 otherwise
+ * @param host the host name of the peer
+ * @param port the file port of the peer
+*/
+  int acquire(const std::string & host, unsigned short port);
+
+  /**
+ * @brief hands a connection from acquire back to the pool
+ * @param host the host name it was acquired for
+ * @param port the file port it was acquired for
+ * @param fd the connection
+ * @param reusable true if every request on it was answered in full, false to close it
+*/
+  void release(const std::string & host, unsigned short port, int fd, bool reusable);
+
+  /**
+ * @brief returns the number of idle connections
+*/
+  size_t idleCount();
+};
+
+#endif
@@ -0,0 +1,688 @@
+#include "DownloadManager.hpp"
+
+/**
+ * @brief writes all of data to fd at offset
+ * returns 0 if successful, -1 otherwise
+*/
+static int writeAt(int fd, const char * data, size_t length, off_t offset) {
+  while (length > 0) {
+    ssize_t written = pwrite(fd, data, length, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+/**
+ * @brief returns the path of the partial file of a hash
+*/
+std::string Download_Manager::partPath(const std::string & hash) {
+  return fileUtilHandler->getFileDirectory() + "/" + hash + PARTIAL_FILE_SUFFIX;
+}
+
+/**
+ * @brief opens or creates the partial file and its state
+ * an existing state for the same file and chunk size is resumed.
+ * caller holds downloadMutex. returns 0 if successful, -1 otherwise
+ * @param download the download to prepare
+ * @param meta the File_Meta announced by a source
+*/
+int Download_Manager::prepare(Download & download, const File_Meta & meta) {
+  std::string path = partPath(download.hash);
+  std::string statePath = fileUtilHandler->getFileDirectory() + "/" + download.hash +
+                          DOWNLOAD_STATE_SUFFIX;
+  size_t chunkCount = (meta.fileSize + DOWNLOAD_CHUNK_SIZE - 1) / DOWNLOAD_CHUNK_SIZE;
+  download.stateFd = open(statePath.c_str(), O_RDWR | O_CREAT, 0644);
+  download.fileFd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (download.stateFd < 0 || download.fileFd < 0) {
+    logger->logError("Error opening partial download " + path);
+    return -1;
+  }
+  download.chunks.assign(chunkCount, CHUNK_MISSING);
+  download.chunksDone = 0;
+
+  Download_State & state = download.state;
+  std::vector<unsigned char> bitmap(chunkCount);
+  if (pread(download.stateFd, &state, sizeof(state), 0) == sizeof(state) &&
+      memcmp(state.magic, DOWNLOAD_STATE_MAGIC, sizeof(state.magic)) == 0 &&
+      memcmp(state.hash, download.hashBytes, sizeof(state.hash)) == 0 &&
+      state.fileSize == meta.fileSize && state.chunkSize == DOWNLOAD_CHUNK_SIZE &&
+      state.chunkCount == chunkCount &&
+      pread(download.stateFd, bitmap.data(), chunkCount, sizeof(state)) ==
+          (ssize_t)chunkCount) {
+    for (size_t i = 0; i < chunkCount; i++) {
+      if (bitmap[i]) {
+        download.chunks[i] = CHUNK_DONE;
+        download.chunksDone++;
+      }
+    }
+    // chunks read back from the state were not checked against the current tree
+    download.chunksChecked = download.chunksDone == 0;
+    logger->logEvent("Resuming download of " + download.hash + " with " +
+                     std::to_string(download.chunksDone) + "/" +
+                     std::to_string(chunkCount) + " chunks");
+  }
+  else {
+    download.chunksChecked = true;
+    memset(&state, 0, sizeof(state));
+    memcpy(state.magic, DOWNLOAD_STATE_MAGIC, sizeof(state.magic));
+    memcpy(state.hash, download.hashBytes, sizeof(state.hash));
+    state.fileSize = meta.fileSize;
+    state.chunkSize = DOWNLOAD_CHUNK_SIZE;
+    state.chunkCount = chunkCount;
+    memcpy(state.name, meta.name, sizeof(state.name));
+    state.name[sizeof(state.name) - 1] = '\0';
+    std::fill(bitmap.begin(), bitmap.end(), 0);
+    if (ftruncate(download.stateFd, 0) < 0 ||
+        writeAt(download.stateFd, (const char *)&state, sizeof(state), 0) < 0 ||
+        writeAt(download.stateFd, (const char *)bitmap.data(), chunkCount, sizeof(state)) <
+            0) {
+      logger->logError("Error writing download state " + statePath);
+      return -1;
+    }
+  }
+  if (meta.fileSize > 0 && posix_fallocate(download.fileFd, 0, meta.fileSize) != 0 &&
+      ftruncate(download.fileFd, meta.fileSize) < 0) {
+    logger->logError("Error allocating " + std::to_string(meta.fileSize) + " bytes for " +
+                     path);
+    return -1;
+  }
+  download.prepared = true;
+  return 0;
+}
+
+/**
+ * @brief picks a missing chunk and marks it as being fetched
+ * returns the index of the chunk, -1 if no chunk is missing, the download has to be
+ * prepared again or the manager stops
+*/
+long Download_Manager::claimChunk(Download & download) {
+  std::lock_guard<std::mutex> lock(download.downloadMutex);
+  if (!download.prepared || stopping) {
+    return -1;
+  }
+  for (size_t i = 0; i < download.chunks.size(); i++) {
+    if (download.chunks[i] == CHUNK_MISSING) {
+      download.chunks[i] = CHUNK_FETCHING;
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief marks a chunk as fetched and persists it in the state file
+ * a chunk checked against a tree that was dropped meanwhile is marked missing again.
+ * returns true if this was the last missing chunk
+ * @param download the download the chunk is of
+ * @param chunk the index of the chunk
+ * @param tree the tree the chunk was checked against
+*/
+bool Download_Manager::completeChunk(Download & download, size_t chunk, const Hash_Tree * tree) {
+  std::lock_guard<std::mutex> lock(download.downloadMutex);
+  if (download.tree.get() != tree) {
+    download.chunks[chunk] = CHUNK_MISSING;
+    return false;
+  }
+  download.chunks[chunk] = CHUNK_DONE;
+  download.chunksDone++;
+  const char done = 1;
+  if (writeAt(download.stateFd, &done, 1, sizeof(Download_State) + chunk) < 0) {
+    logger->logError("Error persisting chunk " + std::to_string(chunk) + " of " +
+                     download.hash);
+  }
+  return download.chunksDone == download.chunks.size();
+}
+
+/**
+ * @brief marks a chunk that could not be fetched as missing again
+*/
+void Download_Manager::releaseChunk(Download & download, size_t chunk) {
+  std::lock_guard<std::mutex> lock(download.downloadMutex);
+  download.chunks[chunk] = CHUNK_MISSING;
+}
+
+/**
+ * @brief verifies the finished file and moves it into the share
+ * a file not matching its hash drops the tree and is fetched again.
+ * returns 0 if successful, -1 otherwise
+*/
+int Download_Manager::finish(std::shared_ptr<Download> download) {
+  std::string path = partPath(download->hash);
+  std::string statePath =
+      fileUtilHandler->getFileDirectory() + "/" + download->hash + DOWNLOAD_STATE_SUFFIX;
+  std::string name;
+  {
+    std::lock_guard<std::mutex> lock(download->downloadMutex);
+    if (download->finished) {
+      return 0;
+    }
+    download->finished = true;
+    name = fileUtilHandler->getFileName(download->state.name);
+  }
+  if (!fileUtilHandler->fileMatchHash(path, download->hash)) {
+    logger->logError("Download of " + download->hash +
+                     " does not match its hash, fetching it again");
+    std::lock_guard<std::mutex> lock(download->downloadMutex);
+    // every chunk matched the tree, so the tree itself is wrong
+    if (download->chunksChecked && download->tree != nullptr) {
+      download->droppedRoots.insert(std::string((const char *)download->tree->getRoot(), 32));
+    }
+    dropTree(*download);
+    // the size came from the first source, the next source prepares the download anew
+    if (ftruncate(download->stateFd, 0) < 0) {
+      logger->logError("Error resetting download state of " + download->hash);
+    }
+    close(download->fileFd);
+    close(download->stateFd);
+    download->fileFd = -1;
+    download->stateFd = -1;
+    download->prepared = false;
+    download->finished = false;
+    return -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(download->downloadMutex);
+    close(download->fileFd);
+    close(download->stateFd);
+    download->fileFd = -1;
+    download->stateFd = -1;
+  }
+  {
+    std::lock_guard<std::mutex> lock(downloadsMutex);
+    downloads.erase(download->hash);
+  }
+  unlink(statePath.c_str());
+  if (name == "" || name == "." || name == "..") {
+    name = download->hash;
+  }
+  std::string filePath = fileUtilHandler->getFileDirectory() + "/" + name;
+  if (access(filePath.c_str(), F_OK) == 0) {
+    filePath += "." + download->hash.substr(0, 8);
+  }
+  if (rename(path.c_str(), filePath.c_str()) < 0) {
+    logger->logError("Error moving download to " + filePath);
+    unlink(path.c_str());
+    return -1;
+  }
+  fileUtilHandler->indexFile(filePath);
+  logger->logEvent("Downloaded " + download->hash + " to " + filePath);
+  return 0;
+}
+
+/**
+ * @brief asks a source for the hash tree of the file, one leaf per chunk
+ * returns the tree if it fits the file, nullptr otherwise
+ * @param download the download the tree is for
+ * @param fd the connection to the source
+*/
+std::shared_ptr<Hash_Tree> Download_Manager::fetchTree(Download & download, int fd) {
+  Hash_Tree_Meta meta;
+  memset(&meta, 0, sizeof(meta));
+  memcpy(meta.hash, download.hashBytes, sizeof(meta.hash));
+  meta.leafSize = DOWNLOAD_CHUNK_SIZE;
+  int length;
+  int type;
+  if (socketUtilHandler->sendMessage(fd, (char *)&meta, sizeof(meta), T_HASH_TREE) < 0 ||
+      socketUtilHandler->recvMessage(fd, (char *)&meta, sizeof(meta), &length, &type) < 0 ||
+      type != T_HASH_TREE || length != sizeof(meta)) {
+    throw std::runtime_error("hash tree request failed");
+  }
+  if (!meta.available || meta.leafSize != DOWNLOAD_CHUNK_SIZE ||
+      meta.fileSize != download.state.fileSize ||
+      meta.leafCount != std::max((size_t)1, download.chunks.size())) {
+    return nullptr;
+  }
+  std::vector<unsigned char> leaves(32 * (size_t)meta.leafCount);
+  if (socketUtilHandler->recvAll(fd, (char *)leaves.data(), leaves.size()) < 0) {
+    throw std::runtime_error("hash tree request failed");
+  }
+  std::shared_ptr<Hash_Tree> tree = std::make_shared<Hash_Tree>();
+  if (!tree->setLeaves(meta.leafSize, meta.fileSize, leaves, meta.root)) {
+    return nullptr;
+  }
+  return tree;
+}
+
+/**
+ * @brief returns the tree of a download, fetched from the source if there is none
+ * throws if the source has no usable tree or one other sources disagree with,
+ * returns nullptr if the download has to be prepared again
+ * @param download the download the tree is for
+ * @param fd the connection to the source
+ * @param sourceKey host:port of the source
+*/
+std::shared_ptr<Hash_Tree> Download_Manager::treeFor(Download & download,
+                                                     int fd,
+                                                     const std::string & sourceKey) {
+  {
+    std::lock_guard<std::mutex> lock(download.downloadMutex);
+    if (!download.prepared) {
+      return nullptr;
+    }
+    if (download.tree != nullptr) {
+      return download.tree;
+    }
+  }
+  std::shared_ptr<Hash_Tree> tree = fetchTree(download, fd);
+  if (tree == nullptr) {
+    throw std::runtime_error("source has no usable hash tree");
+  }
+  std::string root((const char *)tree->getRoot(), 32);
+  std::lock_guard<std::mutex> lock(download.downloadMutex);
+  if (!download.prepared) {
+    return nullptr;
+  }
+  if (download.badSources.count(sourceKey) > 0) {
+    throw std::runtime_error("source sent corrupt chunks");
+  }
+  if (download.droppedRoots.count(root) > 0) {
+    throw std::runtime_error("source has a hash tree that was found wrong");
+  }
+  if (download.tree != nullptr && memcmp(download.tree->getRoot(), root.data(), 32) != 0 &&
+      !rejectTree(download, sourceKey)) {
+    throw std::runtime_error("source has a different hash tree");
+  }
+  if (download.tree == nullptr) {
+    download.tree = tree;
+    download.treeSource = sourceKey;
+  }
+  return download.tree;
+}
+
+/**
+ * @brief records that a source serves another tree than the one of a download
+ * once DOWNLOAD_TREE_MAX_REJECTS sources did the tree is dropped.
+ * caller holds downloadMutex. returns true if the tree was dropped
+*/
+bool Download_Manager::rejectTree(Download & download, const std::string & sourceKey) {
+  download.treeRejects.insert(sourceKey);
+  if (download.treeRejects.size() < DOWNLOAD_TREE_MAX_REJECTS) {
+    return false;
+  }
+  logger->logEvent("Dropping the hash tree of " + download.hash + ", " +
+                   std::to_string(download.treeRejects.size()) + " sources disagree with it");
+  dropTree(download);
+  return true;
+}
+
+/**
+ * @brief forgets the tree of a download and the chunks checked against it
+ * caller holds downloadMutex
+*/
+void Download_Manager::dropTree(Download & download) {
+  download.tree = nullptr;
+  download.treeSource = "";
+  download.treeRejects.clear();
+  for (size_t i = 0; i < download.chunks.size(); i++) {
+    if (download.chunks[i] == CHUNK_DONE) {
+      download.chunks[i] = CHUNK_MISSING;
+    }
+  }
+  download.chunksDone = 0;
+  download.chunksChecked = true;
+  std::vector<char> bitmap(download.chunks.size(), 0);
+  if (writeAt(download.stateFd, bitmap.data(), bitmap.size(), sizeof(Download_State)) < 0) {
+    logger->logError("Error resetting download state of " + download.hash);
+  }
+}
+
+/**
+ * @brief asks a source to encrypt the transfers on a connection
+ * returns the cipher to open them with, throws if the source does not encrypt
+ * @param fd the connection to the source
+ * @param source the source, its id names the session
+ * @param session will be set to the session the cipher is keyed from
+*/
+std::unique_ptr<Transfer_Cipher> Download_Manager::secureConnection(
+    int fd, const Peer_Identifier & source, Session & session) {
+  Secure_Check check;
+  memset(&check, 0, sizeof(check));
+  check.type = T_FILE_RANGE;
+  check.secure = true;
+  int length;
+  int type;
+  if (socketUtilHandler->sendMessage(fd, (char *)&check, sizeof(check), T_SECURE_CHECK) < 0 ||
+      socketUtilHandler->recvMessage(fd, (char *)&check, sizeof(check), &length, &type) < 0 ||
+      type != T_SECURE_CHECK || length != sizeof(check)) {
+    throw std::runtime_error("secure check failed");
+  }
+  if (!check.secure) {
+    throw std::runtime_error("source does not encrypt transfers");
+  }
+  if (sessions->connect(*socketUtilHandler, fd, Session_Cache::peerKey(source.id), session) <
+      0) {
+    throw std::runtime_error("no session agreed");
+  }
+  return std::unique_ptr<Transfer_Cipher>(new Transfer_Cipher(session.key, false));
+}
+
+/**
+ * @brief fetches chunks from one source until none are missing or the source fails
+ * every chunk is checked against the hash tree before it is written, a source
+ * sending a chunk that does not match its own tree is dropped for good and only
+ * that chunk is fetched again, along with the tree if that source served it.
+ * when several sources serve another tree the tree is fetched again instead
+*/
+void Download_Manager::sourceWorker(std::shared_ptr<Download> download,
+                                    Peer_Identifier source) {
+  std::string sourceKey = std::string(source.hostName) + ":" + std::to_string(source.port);
+  int fd = connections.acquire(source.hostName, source.port);
+  size_t fetched = 0;
+  bool done = false;
+  if (fd >= 0) {
+    bool reusable = false;
+    try {
+      std::vector<char> buffer(DOWNLOAD_CHUNK_SIZE);
+      File_Range range;
+      File_Meta meta;
+      int length;
+      int type;
+      memset(&range, 0, sizeof(range));
+      memcpy(range.hash, download->hashBytes, sizeof(range.hash));
+      std::unique_ptr<Transfer_Cipher> cipher;
+      Session session;
+      if (sessions->isEnabled()) {
+        cipher = secureConnection(fd, source, session);
+      }
+      bool prepared;
+      {
+        std::lock_guard<std::mutex> lock(download->downloadMutex);
+        prepared = download->prepared;
+      }
+      if (!prepared) {
+        // ask for the meta only to learn the size of the file
+        if (socketUtilHandler->sendMessage(fd, (char *)&range, sizeof(range), T_FILE_RANGE) <
+                0 ||
+            socketUtilHandler->recvMessage(fd, (char *)&meta, sizeof(meta), &length, &type) <
+                0 ||
+            type != T_FILE_META || length != sizeof(meta)) {
+          throw std::runtime_error("source does not have the file");
+        }
+        if (cipher != nullptr && !cipher->open(meta)) {
+          throw std::runtime_error("meta of source failed authentication");
+        }
+        if (!meta.available) {
+          throw std::runtime_error("source does not have the file");
+        }
+        std::lock_guard<std::mutex> lock(download->downloadMutex);
+        if (!download->prepared && prepare(*download, meta) < 0) {
+          throw std::runtime_error("could not prepare storage");
+        }
+      }
+      std::shared_ptr<Hash_Tree> tree;
+      long chunk;
+      while ((tree = treeFor(*download, fd, sourceKey)) != nullptr &&
+             (chunk = claimChunk(*download)) >= 0) {
+        uint64_t start = Metrics_Registry::nowMicros();
+        range.offset = (uint64_t)chunk * DOWNLOAD_CHUNK_SIZE;
+        range.length = std::min((uint64_t)DOWNLOAD_CHUNK_SIZE,
+                                download->state.fileSize - range.offset);
+        if (socketUtilHandler->sendMessage(fd, (char *)&range, sizeof(range), T_FILE_RANGE) <
+                0 ||
+            socketUtilHandler->recvMessage(fd, (char *)&meta, sizeof(meta), &length, &type) <
+                0 ||
+            type != T_FILE_META || length != sizeof(meta) ||
+            (cipher != nullptr && !cipher->open(meta)) || !meta.available ||
+            meta.fileSize != download->state.fileSize ||
+            (cipher != nullptr
+                 ? cipher->recvRange(
+                       *socketUtilHandler, fd, buffer.data(), range.offset, range.length)
+                 : socketUtilHandler->recvAll(fd, buffer.data(), range.length)) < 0) {
+          releaseChunk(*download, chunk);
+          throw std::runtime_error("chunk " + std::to_string(chunk) + " failed");
+        }
+        if (!tree->verifyLeaf(chunk, buffer.data(), range.length)) {
+          Metrics_Registry::add(METRIC_CHUNKS_CORRUPT);
+          releaseChunk(*download, chunk);
+          // a source serving another tree votes against the tree, one sending
+          // data that does not match its own tree is only dropped itself
+          std::shared_ptr<Hash_Tree> own = fetchTree(*download, fd);
+          bool disagrees = own != nullptr && memcmp(own->getRoot(), tree->getRoot(), 32) != 0;
+          bool current;
+          bool dropped = false;
+          {
+            std::lock_guard<std::mutex> lock(download->downloadMutex);
+            current = download->tree == tree;
+            if (disagrees) {
+              dropped = current && rejectTree(*download, sourceKey);
+            }
+            else {
+              download->badSources.insert(sourceKey);
+              // the tree came from a source whose data does not match it
+              if (current && download->treeSource == sourceKey) {
+                logger->logEvent("Dropping the hash tree of " + download->hash + ", " +
+                                 sourceKey + " sent chunks not matching it");
+                dropTree(*download);
+              }
+            }
+          }
+          // a chunk failing a tree that was replaced meanwhile is checked again
+          if (!disagrees || (current && !dropped)) {
+            throw std::runtime_error(disagrees ? "source has a different hash tree"
+                                               : "chunk " + std::to_string(chunk) +
+                                                     " is corrupt");
+          }
+          continue;
+        }
+        // the chunk has to be on disk before the state file says it is
+        if (writeAt(download->fileFd, buffer.data(), range.length, range.offset) < 0 ||
+            fdatasync(download->fileFd) < 0) {
+          releaseChunk(*download, chunk);
+          throw std::runtime_error("chunk " + std::to_string(chunk) + " failed");
+        }
+        fetched++;
+        Metrics_Registry::add(METRIC_BYTES_DOWNLOADED, range.length);
+        Metrics_Registry::observe(HISTOGRAM_CHUNK, Metrics_Registry::nowMicros() - start);
+        if (completeChunk(*download, chunk, tree.get())) {
+          done = true;
+          break;
+        }
+        if (cipher != nullptr &&
+            !sessions->addBytes(Session_Cache::peerKey(source.id), session, cipher->takeBytes())) {
+          // the session protected enough bytes, go on under a new key
+          cipher = secureConnection(fd, source, session);
+        }
+      }
+      if (!done) {
+        std::lock_guard<std::mutex> lock(download->downloadMutex);
+        done = download->prepared && download->chunksDone == download->chunks.size();
+      }
+      // every answer was read in full, the next download can use the connection
+      reusable = true;
+    }
+    catch (std::exception & e) {
+      logger->logError("Source " + sourceKey + " of " + download->hash + " failed: " +
+                       std::string(e.what()));
+    }
+    connections.release(source.hostName, source.port, fd, reusable);
+  }
+  logger->logEvent("Fetched " + std::to_string(fetched) + " chunks of " + download->hash +
+                   " from " + sourceKey);
+  if (done) {
+    finish(download);
+  }
+  leaveDownload(download, sourceKey);
+  endWorker();
+}
+
+/**
+ * @brief counts a source worker as ended, the last one wakes stop
+*/
+void Download_Manager::endWorker() {
+  std::lock_guard<std::mutex> lock(workersMutex);
+  workerCount--;
+  workersCond.notify_all();
+}
+
+/**
+ * @brief removes a source that stopped fetching from a download
+ * a download left without sources before it finished closes its files until a
+ * source is added again, getUnfinishedDownloads lists it meanwhile
+*/
+void Download_Manager::leaveDownload(std::shared_ptr<Download> download,
+                                     const std::string & sourceKey) {
+  std::lock_guard<std::mutex> lock(download->downloadMutex);
+  download->sources.erase(sourceKey);
+  if (download->finished || !download->sources.empty()) {
+    return;
+  }
+  // the next source prepares the download again from the state file
+  if (download->fileFd >= 0) {
+    close(download->fileFd);
+  }
+  if (download->stateFd >= 0) {
+    close(download->stateFd);
+  }
+  download->fileFd = -1;
+  download->stateFd = -1;
+  download->prepared = false;
+  logger->logEvent("No source left for " + download->hash + ", looking for sources again");
+}
+
+/**
+ * @brief adds the holder in a query hit as a source of the file
+ * starts the download if it is not running yet. a source already fetching the
+ * file, one that sent corrupt chunks of it, or one over DOWNLOAD_MAX_SOURCES, is ignored.
+ * returns 0 if the source was added, 1 if ignored, -1 otherwise failed
+ * @param queryHit the query hit naming the holder and the file
+*/
+int Download_Manager::addSource(Query_Hit queryHit) {
+  try {
+    std::string hash =
+        File_Util_Handler::digestToHex(queryHit.id.hash, sizeof(queryHit.id.hash));
+    std::string sourceKey = std::string(queryHit.destination.hostName) + ":" +
+                            std::to_string(queryHit.destination.port);
+    {
+      // counted before it is added, so stop cannot miss the worker
+      std::lock_guard<std::mutex> lock(workersMutex);
+      if (stopping) {
+        return 1;
+      }
+      workerCount++;
+    }
+    std::shared_ptr<Download> download;
+    {
+      std::lock_guard<std::mutex> downloadsLock(downloadsMutex);
+      std::map<std::string, std::shared_ptr<Download> >::iterator it = downloads.find(hash);
+      if (it == downloads.end()) {
+        download = std::make_shared<Download>();
+        download->hash = hash;
+        memcpy(download->hashBytes, queryHit.id.hash, sizeof(download->hashBytes));
+        download->prepared = false;
+        download->finished = false;
+        download->fileFd = -1;
+        download->stateFd = -1;
+        download->chunksDone = 0;
+        download->chunksChecked = true;
+        downloads[hash] = download;
+      }
+      else {
+        download = it->second;
+      }
+      std::lock_guard<std::mutex> lock(download->downloadMutex);
+      if (download->finished || download->sources.count(sourceKey) > 0 ||
+          download->badSources.count(sourceKey) > 0 ||
+          download->sources.size() >= DOWNLOAD_MAX_SOURCES) {
+        endWorker();
+        return 1;
+      }
+      download->sources.insert(sourceKey);
+    }
+    logger->logEvent("Fetching " + hash + " from " + sourceKey);
+    try {
+      // stop waits for the worker, so it may use this until it ends
+      std::thread(&Download_Manager::sourceWorker, this, download, queryHit.destination)
+          .detach();
+    }
+    catch (std::exception & e) {
+      leaveDownload(download, sourceKey);
+      endWorker();
+      throw;
+    }
+    return 0;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error adding download source: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * @brief returns the hashes of partial downloads in fileDirectory no source fetches
+ * left by the last shutdown or by sources that all failed, used to look for
+ * sources again
+*/
+std::vector<std::string> Download_Manager::getUnfinishedDownloads() {
+  std::vector<std::string> hashes;
+  std::string directory = fileUtilHandler->getFileDirectory();
+  DIR * dir = opendir(directory.c_str());
+  if (dir == NULL) {
+    return hashes;
+  }
+  size_t suffixLength = strlen(DOWNLOAD_STATE_SUFFIX);
+  struct dirent * ent;
+  while ((ent = readdir(dir)) != NULL) {
+    std::string name = ent->d_name;
+    if (name.length() == 64 + suffixLength &&
+        name.compare(64, suffixLength, DOWNLOAD_STATE_SUFFIX) == 0 &&
+        fileUtilHandler->isValidHash(name.substr(0, 64))) {
+      hashes.push_back(name.substr(0, 64));
+    }
+  }
+  closedir(dir);
+  std::lock_guard<std::mutex> downloadsLock(downloadsMutex);
+  hashes.erase(std::remove_if(hashes.begin(),
+                              hashes.end(),
+                              [this](const std::string & hash) {
+                                std::map<std::string, std::shared_ptr<Download> >::iterator
+                                    it = downloads.find(hash);
+                                if (it == downloads.end()) {
+                                  return false;
+                                }
+                                std::lock_guard<std::mutex> lock(it->second->downloadMutex);
+                                return !it->second->sources.empty();
+                              }),
+               hashes.end());
+  return hashes;
+}
+
+/**
+ * @brief returns the number of downloads a source is fetching
+*/
+size_t Download_Manager::activeDownloads() {
+  std::lock_guard<std::mutex> downloadsLock(downloadsMutex);
+  size_t active = 0;
+  for (std::pair<const std::string, std::shared_ptr<Download> > & download : downloads) {
+    std::lock_guard<std::mutex> lock(download.second->downloadMutex);
+    if (!download.second->sources.empty()) {
+      active++;
+    }
+  }
+  return active;
+}
+
+/**
+ * @brief returns the number of idle connections to sources
+*/
+size_t Download_Manager::idleConnections() {
+  return connections.idleCount();
+}
+
+/**
+ * @brief stops adding sources and waits for the source workers to end
+ * a worker ends after the chunk in flight, at most POOL_RECV_TIMEOUT_MS for a
+ * stalled source. partial downloads stay to be resumed
+*/
+void Download_Manager::stop() {
+  std::unique_lock<std::mutex> lock(workersMutex);
+  stopping = true;
+  workersCond.wait(lock, [this] { return workerCount == 0; });
+}
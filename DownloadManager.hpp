@@ -0,0 +1,246 @@
+#ifndef DOWNLOAD_MANAGER_HPP
+#define DOWNLOAD_MANAGER_HPP
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ConnectionPool.hpp"
+#include "FileUtilHandler.hpp"
+#include "HashTree.hpp"
+#include "Metrics.hpp"
+#include "Protocol.hpp"
+#include "SessionCache.hpp"
+#include "SocketUtilHandler.hpp"
+#include "TransferCipher.hpp"
+
+#define DOWNLOAD_CHUNK_SIZE (1 << 20)  // bytes fetched per range request
+#define DOWNLOAD_MAX_SOURCES 8         // peers fetching one file at the same time
+#define DOWNLOAD_TREE_MAX_REJECTS 2    // sources disagreeing with a hash tree before it is dropped
+#define DOWNLOAD_RESUME_MS 30000       // wait between queries for downloads without a source
+#define DOWNLOAD_STATE_MAGIC "GNUTDLS"  // first bytes of a download state file
+#define DOWNLOAD_STATE_SUFFIX ".state" PARTIAL_FILE_SUFFIX
+
+#define CHUNK_MISSING 0
+#define CHUNK_FETCHING 1
+#define CHUNK_DONE 2
+
+// header of the state file persisted next to a partial download,
+// followed by one byte per chunk, 1 if the chunk is on disk
+struct Download_State_t {
+  char magic[8];           // DOWNLOAD_STATE_MAGIC
+  unsigned char hash[32];  // hash of the file
+  uint64_t fileSize;       // size of the file
+  uint32_t chunkSize;      // DOWNLOAD_CHUNK_SIZE when the download started
+  uint32_t chunkCount;     // number of chunks
+  char name[256];          // name announced by the first source
+};
+typedef struct Download_State_t Download_State;
+
+// a file being fetched from one or more sources
+struct Download_t {
+  std::string hash;                     // hash of the file in hex
+  unsigned char hashBytes[32];          // hash of the file
+  std::mutex downloadMutex;             // mutex for everything below
+  bool prepared;                        // storage is allocated
+  bool finished;                        //
+  Download_State state;                 //
+  int fileFd;                           // the preallocated .part file
+  int stateFd;                          // the state file
+  std::vector<unsigned char> chunks;    // CHUNK_MISSING, CHUNK_FETCHING or CHUNK_DONE
+  size_t chunksDone;                    //
+  bool chunksChecked;                   // every done chunk was checked against tree
+  std::set<std::string> sources;        // host:port of the sources with a worker
+  std::shared_ptr<Hash_Tree> tree;      // leaf hashes chunks are checked against
+  std::string treeSource;               // host:port of the source tree came from
+  std::set<std::string> treeRejects;    // host:port of the sources that served another tree
+  std::set<std::string> badSources;     // host:port of the sources that sent corrupt chunks
+  std::set<std::string> droppedRoots;   // roots of trees the whole file hash proved wrong
+};
+typedef struct Download_t Download;
+
+class Download_Manager {
+  Logger * logger;
+  File_Util_Handler * fileUtilHandler;
+  Socket_Util_Handler * socketUtilHandler;
+  Session_Cache * sessions;            // keys of encrypted transfers by peer id
+  Connection_Pool connections;         // keep-alive connections to sources
+  std::map<std::string,                //
+           std::shared_ptr<Download> > //
+      downloads;                       // hash -> download not finished yet
+  std::mutex downloadsMutex;           // mutex for downloads map
+  std::atomic<bool> stopping;          // stop was called, no source is added any more
+  size_t workerCount;                  // source workers running
+  std::mutex workersMutex;             // mutex for workerCount
+  std::condition_variable workersCond; // notified when a source worker ends
+
+  /**
+ * @brief returns the path of the partial file of a hash
+*/
+  std::string partPath(const std::string & hash);
+
+  /**
+ * @brief opens or creates the partial file and its state
+ * an existing state for the same file and chunk size is resumed.
+ * caller holds downloadMutex. returns 0 if successful, -1 otherwise
+ * @param download the download to prepare
+ * @param meta the File_Meta announced by a source
+*/
+  int prepare(Download & download, const File_Meta & meta);
+
+  /**
+ * @brief picks a missing chunk and marks it as being fetched
+ * returns the index of the chunk, -1 if no chunk is missing, the download has to be
+ * prepared again or the manager stops
+*/
+  long claimChunk(Download & download);
+
+  /**
+ * @brief marks a chunk as fetched and persists it in the state file
+ * a chunk checked against a tree that was dropped meanwhile is marked missing again.
+ * returns true if this was the last missing chunk
+ * @param download the download the chunk is of
+ * @param chunk the index of the chunk
+ * @param tree the tree the chunk was checked against
+*/
+  bool completeChunk(Download & download, size_t chunk, const Hash_Tree * tree);
+
+  /**
+ * @brief marks a chunk that could not be fetched as missing again
+*/
+  void releaseChunk(Download & download, size_t chunk);
+
+  /**
+ * @brief verifies the finished file and moves it into the share
+ * a file not matching its hash drops the tree and is fetched again.
+ * returns 0 if successful, -1 otherwise
+*/
+  int finish(std::shared_ptr<Download> download);
+
+  /**
+ * @brief asks a source for the hash tree of the file, one leaf per chunk
+ * returns the tree if it fits the file, nullptr otherwise
+ * @param download the download the tree is for
+ * @param fd the connection to the source
+*/
+  std::shared_ptr<Hash_Tree> fetchTree(Download & download, int fd);
+
+  /**
+ * @brief returns the tree of a download, fetched from the source if there is none
+ * throws if the source has no usable tree or one other sources disagree with,
+ * returns nullptr if the download has to be prepared again
+ * @param download the download the tree is for
+ * @param fd the connection to the source
+ * @param sourceKey host:port of the source
+*/
+  std::shared_ptr<Hash_Tree> treeFor(Download & download, int fd, const std::string & sourceKey);
+
+  /**
+ * @brief records that a source serves another tree than the one of a download
+ * once DOWNLOAD_TREE_MAX_REJECTS sources did the tree is dropped.
+ * caller holds downloadMutex. returns true if the tree was dropped
+*/
+  bool rejectTree(Download & download, const std::string & sourceKey);
+
+  /**
+ * @brief forgets the tree of a download and the chunks checked against it
+ * caller holds downloadMutex
+*/
+  void dropTree(Download & download);
+
+  /**
+ * @brief asks a source to encrypt the transfers on a connection
+ * returns the cipher to open them with, throws if the source does not encrypt
+ * @param fd the connection to the source
+ * @param source the source, its id names the session
+ * @param session will be set to the session the cipher is keyed from
+*/
+  std::unique_ptr<Transfer_Cipher> secureConnection(int fd,
+                                                    const Peer_Identifier & source,
+                                                    Session & session);
+
+  /**
+ * @brief removes a source that stopped fetching from a download
+ * a download left without sources before it finished closes its files until a
+ * source is added again, getUnfinishedDownloads lists it meanwhile
+*/
+  void leaveDownload(std::shared_ptr<Download> download, const std::string & sourceKey);
+
+  /**
+ * @brief counts a source worker as ended, the last one wakes stop
+*/
+  void endWorker();
+
+  /**
+ * @brief fetches chunks from one source until none are missing or the source fails
+ * every chunk is checked against the hash tree before it is written, a source
+ * sending a chunk that does not match its own tree is dropped for good and only
+ * that chunk is fetched again, along with the tree if that source served it.
+ * when several sources serve another tree the tree is fetched again instead
+*/
+  void sourceWorker(std::shared_ptr<Download> download, Peer_Identifier source);
+
+ public:
+  Download_Manager(Logger * logger,
+                   File_Util_Handler * fileUtilHandler,
+                   Socket_Util_Handler * socketUtilHandler,
+                   Session_Cache * sessions) :
+      logger(logger),
+      fileUtilHandler(fileUtilHandler),
+      socketUtilHandler(socketUtilHandler),
+      sessions(sessions),
+      connections(logger, socketUtilHandler),
+      downloads(),
+      downloadsMutex(),
+      stopping(false),
+      workerCount(0),
+      workersMutex(),
+      workersCond() {}
+
+  ~Download_Manager() { stop(); }
+
+  /**
+ * @brief adds the holder in a query hit as a source of the file
+ * starts the download if it is not running yet. a source already fetching the
+ * file, one that sent corrupt chunks of it, or one over DOWNLOAD_MAX_SOURCES, is ignored.
+ * returns 0 if the source was added, 1 if ignored, -1 otherwise failed
+ * @param queryHit the query hit naming the holder and the file
+*/
+  int addSource(Query_Hit queryHit);
+
+  /**
+ * @brief returns the hashes of partial downloads in fileDirectory no source fetches
+ * left by the last shutdown or by sources that all failed, used to look for
+ * sources again
+*/
+  std::vector<std::string> getUnfinishedDownloads();
+
+  /**
+ * @brief returns the number of downloads a source is fetching
+*/
+  size_t activeDownloads();
+
+  /**
+ * @brief returns the number of idle connections to sources
+*/
+  size_t idleConnections();
+
+  /**
+ * @brief stops adding sources and waits for the source workers to end
+ * a worker ends after the chunk in flight, at most POOL_RECV_TIMEOUT_MS for a
+ * stalled source. partial downloads stay to be resumed
+*/
+  void stop();
+};
+
+#endif
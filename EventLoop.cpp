@@ -0,0 +1,582 @@
+#include "EventLoop.hpp"
+
+/**
+ * @brief sets O_NONBLOCK on fd
+ * returns 0 if successful, -1 otherwise
+*/
+static int setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+Event_Loop::~Event_Loop() {
+  std::lock_guard<std::mutex> lock(connectionsMutex);
+  for (std::unordered_map<Connection_Id, std::shared_ptr<Connection> >::iterator it =
+           connections.begin();
+       it != connections.end();
+       ++it) {
+    close(it->second->fd);
+  }
+  for (std::unordered_map<Connection_Id, int>::iterator it = listeners.begin();
+       it != listeners.end();
+       ++it) {
+    close(it->second);
+  }
+  if (epollFd >= 0) {
+    close(epollFd);
+  }
+  if (wakeFd >= 0) {
+    close(wakeFd);
+  }
+}
+
+/**
+ * @brief creates the epoll instance
+ * returns 0 if successful, -1 otherwise
+*/
+int Event_Loop::init() {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    logger->logError("Error creating epoll instance");
+    return -1;
+  }
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd < 0) {
+    logger->logError("Error creating eventfd");
+    return -1;
+  }
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u64 = EVENT_LOOP_WAKE_ID;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) < 0) {
+    logger->logError("Error adding eventfd to epoll");
+    return -1;
+  }
+  // set here rather than in run, so a stop before run is not lost
+  running = true;
+  return 0;
+}
+
+/**
+ * @brief sets the function called with every received message
+*/
+void Event_Loop::setMessageCallback(Message_Callback callback) {
+  onMessage = callback;
+}
+
+/**
+ * @brief sets the function called after a connection was closed
+*/
+void Event_Loop::setCloseCallback(Close_Callback callback) {
+  onClose = callback;
+}
+
+/**
+ * @brief sets the function returning the MESSAGE_CLASS_ of a message type
+ * without one every message is MESSAGE_CLASS_CONTROL, sent in order and never shed
+*/
+void Event_Loop::setClassCallback(Class_Callback callback) {
+  classOf = callback;
+}
+
+/**
+ * @brief returns a connection, nullptr if it is not served by the loop
+*/
+std::shared_ptr<Connection> Event_Loop::getConnection(Connection_Id id) {
+  std::lock_guard<std::mutex> lock(connectionsMutex);
+  std::unordered_map<Connection_Id, std::shared_ptr<Connection> >::iterator it =
+      connections.find(id);
+  if (it == connections.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+/**
+ * @brief serves a listening socket, accepted connections are added automatically
+ * returns 0 if successful, -1 otherwise
+*/
+int Event_Loop::addListener(int fd) {
+  if (setNonBlocking(fd) < 0) {
+    logger->logError("Error making listening socket non-blocking");
+    return -1;
+  }
+  Connection_Id id = nextId++;
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    listeners[id] = fd;
+  }
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLET;
+  event.data.u64 = id;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    logger->logError("Error adding listening socket to epoll");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief serves a connected socket, the socket is made non-blocking
+ * returns the id of the connection if successful, -1 otherwise
+*/
+Connection_Id Event_Loop::addConnection(int fd) {
+  if (setNonBlocking(fd) < 0) {
+    logger->logError("Error making fd " + std::to_string(fd) + " non-blocking");
+    return -1;
+  }
+  std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+  connection->id = nextId++;
+  connection->fd = fd;
+  connection->partialClass = -1;
+  connection->outboundOffset = 0;
+  connection->outboundBytes = 0;
+  connection->flushPending = false;
+  connection->blocked = false;
+  connection->closed = false;
+  connection->bytesIn = 0;
+  connection->bytesOut = 0;
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    connections[connection->id] = connection;
+  }
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.u64 = connection->id;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    logger->logError("Error adding fd " + std::to_string(fd) + " to epoll");
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    connections.erase(connection->id);
+    return -1;
+  }
+  return connection->id;
+}
+
+/**
+ * @brief accepts all pending connections on a listening socket
+*/
+void Event_Loop::acceptAll(int listenFd) {
+  while (true) {
+    struct sockaddr_storage socket_addr;
+    socklen_t socket_addr_len = sizeof(socket_addr);
+    int client_fd = accept(listenFd, (struct sockaddr *)&socket_addr, &socket_addr_len);
+    if (client_fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        logger->logError("Error accepting connection");
+      }
+      return;
+    }
+    Connection_Id id = addConnection(client_fd);
+    if (id < 0) {
+      close(client_fd);
+      continue;
+    }
+    LOG_DEBUG(logger, "Accepted connection %lld on fd %d", (long long)id, client_fd);
+  }
+}
+
+/**
+ * @brief reads and dispatches up to EVENT_LOOP_MAX_READ_FRAMES messages, so one
+ * busy peer cannot hold the loop. the sockets are edge triggered, a connection
+ * stopped at the limit goes into unreadIds and gets another turn after the next wait
+ * returns 1 if messages may be left, 0 if the socket would block,
+ * -1 if the connection has to be closed
+*/
+int Event_Loop::readSome(Connection & connection) {
+  int frames = 0;
+  while (true) {
+    // frames left over from the last turn are taken before reading more
+    int type;
+    int length;
+    const char * message;
+    int status;
+    while ((status = connection.inbound.nextMessage(&type, &message, &length)) == 1) {
+      Metrics_Registry::messageIn(type);
+      if (onMessage) {
+        onMessage(connection.id, type, message, length);
+      }
+      if (++frames >= EVENT_LOOP_MAX_READ_FRAMES) {
+        return 1;
+      }
+    }
+    if (status < 0) {
+      logger->logError("Corrupt stream on fd " + std::to_string(connection.fd));
+      return -1;
+    }
+    ssize_t bytes_received = connection.inbound.readFrom(connection.fd);
+    if (bytes_received == 0) {
+      return -1;
+    }
+    if (bytes_received < 0) {
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    connection.bytesIn.store(connection.bytesIn.load(std::memory_order_relaxed) + bytes_received,
+                             std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief writes as much of outbound as the socket accepts, caller holds outboundMutex
+ * a partly written frame is finished first, then frames go out by class, lower
+ * classes first. queued frames are coalesced, up to EVENT_LOOP_MAX_IOV of them per
+ * sendmsg.
+ * returns 0 if the connection is still usable, -1 otherwise
+*/
+int Event_Loop::flush(Connection & connection) {
+  if (connection.closed) {
+    return 0;
+  }
+  while (connection.outboundBytes > 0) {
+    struct iovec iov[EVENT_LOOP_MAX_IOV];
+    int classes[EVENT_LOOP_MAX_IOV];  // class of the frame in each iov
+    size_t taken[MESSAGE_CLASSES] = {0};
+    size_t count = 0;
+    if (connection.partialClass >= 0) {
+      const std::string & bytes = connection.outbound[connection.partialClass].front().bytes;
+      iov[0].iov_base = (void *)(bytes.data() + connection.outboundOffset);
+      iov[0].iov_len = bytes.size() - connection.outboundOffset;
+      classes[0] = connection.partialClass;
+      taken[connection.partialClass] = 1;
+      count = 1;
+    }
+    for (int messageClass = 0; messageClass < MESSAGE_CLASSES; messageClass++) {
+      std::deque<Outbound_Frame> & frames = connection.outbound[messageClass];
+      while (taken[messageClass] < frames.size() && count < EVENT_LOOP_MAX_IOV) {
+        const std::string & bytes = frames[taken[messageClass]].bytes;
+        iov[count].iov_base = (void *)bytes.data();
+        iov[count].iov_len = bytes.size();
+        classes[count] = messageClass;
+        taken[messageClass]++;
+        count++;
+      }
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t bytes_sent = sendmsg(connection.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (bytes_sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        connection.blocked = true;
+        return 0;
+      }
+      return -1;
+    }
+    connection.bytesOut.fetch_add(bytes_sent, std::memory_order_relaxed);
+    connection.outboundBytes -= bytes_sent;
+    // retire the frames written in full, the last one may be partly written
+    size_t remaining = bytes_sent;
+    for (size_t i = 0; i < count && remaining > 0; i++) {
+      std::deque<Outbound_Frame> & frames = connection.outbound[classes[i]];
+      size_t left = iov[i].iov_len;
+      if (remaining < left) {
+        connection.partialClass = classes[i];
+        connection.outboundOffset = frames.front().bytes.size() - left + remaining;
+        break;
+      }
+      remaining -= left;
+      Metrics_Registry::messageOut(frames.front().type);
+      frames.pop_front();
+      connection.partialClass = -1;
+      connection.outboundOffset = 0;
+    }
+  }
+  connection.blocked = false;
+  return 0;
+}
+
+/**
+ * @brief drops the oldest MESSAGE_CLASS_FLOOD frames until length more bytes fit
+ * in the queue, caller holds outboundMutex. a partly written frame is never dropped
+ * returns true if length bytes fit
+*/
+bool Event_Loop::shed(Connection & connection, size_t length) {
+  std::deque<Outbound_Frame> & floods = connection.outbound[MESSAGE_CLASS_FLOOD];
+  std::deque<Outbound_Frame>::iterator it = floods.begin();
+  if (it != floods.end() && connection.partialClass == MESSAGE_CLASS_FLOOD) {
+    ++it;
+  }
+  while (connection.outboundBytes + length > EVENT_LOOP_MAX_QUEUED_BYTES && it != floods.end()) {
+    connection.outboundBytes -= it->bytes.size();
+    it = floods.erase(it);
+    Metrics_Registry::add(METRIC_MESSAGES_SHED);
+  }
+  return connection.outboundBytes + length <= EVENT_LOOP_MAX_QUEUED_BYTES;
+}
+
+/**
+ * @brief queues a message to a connection without blocking
+ * the loop thread writes it together with the other frames queued meanwhile,
+ * queued frames of lower classes go first. once EVENT_LOOP_MAX_QUEUED_BYTES are
+ * queued the oldest MESSAGE_CLASS_FLOOD frames make room, a flood message that
+ * still does not fit is dropped. a peer with EVENT_LOOP_MAX_BACKLOG_BYTES queued
+ * is disconnected.
+ * returns the length of the message if queued, 0 if dropped, -1 otherwise
+ * @param id the connection to send the message to
+ * @param message the message to send
+ * @param length the length of the message
+ * @param type the type of the message
+*/
+int Event_Loop::sendMessage(Connection_Id id, const char * message, int length, int type) {
+  std::shared_ptr<Connection> connection = getConnection(id);
+  if (connection == nullptr) {
+    logger->logError("Error sending message to unknown connection " + std::to_string(id));
+    return -1;
+  }
+  int messageClass = classOf ? classOf(type) : MESSAGE_CLASS_CONTROL;
+  if (messageClass < 0 || messageClass >= MESSAGE_CLASSES) {
+    messageClass = MESSAGE_CLASS_CONTROL;
+  }
+  Outbound_Frame frame;
+  frame.type = type;
+  Message_Header header;
+  header.type = htonl(type);
+  header.length = htonl(length);
+  frame.bytes.reserve(sizeof(header) + length);
+  frame.bytes.append((const char *)&header, sizeof(header));
+  frame.bytes.append(message, length);
+  bool schedule = false;
+  {
+    std::lock_guard<std::mutex> lock(connection->outboundMutex);
+    if (connection->closed) {
+      return -1;
+    }
+    if (!shed(*connection, frame.bytes.size())) {
+      if (messageClass == MESSAGE_CLASS_FLOOD) {
+        Metrics_Registry::add(METRIC_MESSAGES_SHED);
+        return 0;
+      }
+      if (connection->outboundBytes + frame.bytes.size() > EVENT_LOOP_MAX_BACKLOG_BYTES) {
+        // the loop thread sees the hangup and closes the connection, closing here
+        // would run the close callback under whatever locks the caller holds
+        logger->logError("Peer on connection " + std::to_string(id) +
+                         " is not reading, disconnecting");
+        shutdown(connection->fd, SHUT_RDWR);
+        return -1;
+      }
+    }
+    connection->outboundBytes += frame.bytes.size();
+    connection->outbound[messageClass].push_back(std::move(frame));
+    // a blocked socket is flushed on EPOLLOUT, a pending one is flushed already
+    if (!connection->flushPending && !connection->blocked) {
+      connection->flushPending = true;
+      schedule = true;
+    }
+  }
+  if (schedule) {
+    bool wake;
+    {
+      std::lock_guard<std::mutex> lock(pendingMutex);
+      wake = pendingFlushes.empty();
+      pendingFlushes.push_back(connection);
+    }
+    uint64_t one = 1;
+    if (wake && write(wakeFd, &one, sizeof(one)) < 0) {
+      logger->logError("Error waking event loop");
+    }
+  }
+  return length;
+}
+
+/**
+ * @brief flushes the connections that had frames queued since the last call
+*/
+void Event_Loop::flushPending() {
+  std::vector<std::shared_ptr<Connection> > pending;
+  {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    pending.swap(pendingFlushes);
+  }
+  for (const std::shared_ptr<Connection> & connection : pending) {
+    bool closing;
+    {
+      std::lock_guard<std::mutex> lock(connection->outboundMutex);
+      connection->flushPending = false;
+      closing = flush(*connection) < 0;
+    }
+    if (closing) {
+      closeConnection(connection->id);
+    }
+  }
+}
+
+/**
+ * @brief stops serving a connection and closes its socket
+ * the close callback runs before the socket is closed. off the loop thread the
+ * socket is only shut down, the loop closes it when it sees the hangup so the fd
+ * number is not reused while the loop still reads it
+*/
+void Event_Loop::closeConnection(Connection_Id id) {
+  if (running && std::this_thread::get_id() != loopThread.load()) {
+    std::shared_ptr<Connection> connection = getConnection(id);
+    if (connection != nullptr) {
+      std::lock_guard<std::mutex> lock(connection->outboundMutex);
+      if (!connection->closed) {
+        shutdown(connection->fd, SHUT_RDWR);
+      }
+    }
+    return;
+  }
+  std::shared_ptr<Connection> connection;
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    std::unordered_map<Connection_Id, std::shared_ptr<Connection> >::iterator it =
+        connections.find(id);
+    if (it == connections.end()) {
+      return;
+    }
+    connection = it->second;
+    connections.erase(it);
+  }
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+  {
+    // a flush still holding the connection must not write to a reused fd
+    std::lock_guard<std::mutex> lock(connection->outboundMutex);
+    connection->closed = true;
+  }
+  // the state kept for the connection goes before the fd can be handed out again
+  if (onClose) {
+    onClose(id);
+  }
+  close(connection->fd);
+  LOG_DEBUG(logger, "Closed connection %lld on fd %d", (long long)id, connection->fd);
+}
+
+/**
+ * @brief returns the bytes received and sent on every served connection
+ * returns connection -> (bytes in, bytes out)
+*/
+std::unordered_map<Connection_Id, std::pair<uint64_t, uint64_t> >
+Event_Loop::getConnectionBytes() {
+  std::unordered_map<Connection_Id, std::pair<uint64_t, uint64_t> > result;
+  std::lock_guard<std::mutex> lock(connectionsMutex);
+  for (const std::pair<const Connection_Id, std::shared_ptr<Connection> > & it : connections) {
+    result[it.first] = std::make_pair(it.second->bytesIn.load(std::memory_order_relaxed),
+                                      it.second->bytesOut.load(std::memory_order_relaxed));
+  }
+  return result;
+}
+
+/**
+ * @brief returns the frames queued on every served connection by MESSAGE_CLASS_
+*/
+std::vector<size_t> Event_Loop::getQueuedFrames() {
+  std::vector<std::shared_ptr<Connection> > served;
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (const std::pair<const Connection_Id, std::shared_ptr<Connection> > & it :
+         connections) {
+      served.push_back(it.second);
+    }
+  }
+  std::vector<size_t> frames(MESSAGE_CLASSES, 0);
+  for (const std::shared_ptr<Connection> & connection : served) {
+    std::lock_guard<std::mutex> lock(connection->outboundMutex);
+    for (int messageClass = 0; messageClass < MESSAGE_CLASSES; messageClass++) {
+      frames[messageClass] += connection->outbound[messageClass].size();
+    }
+  }
+  return frames;
+}
+
+/**
+ * @brief runs the loop on the calling thread until stop is called
+ * returns at once if stop came before run. returns 0 if stopped, -1 on error
+*/
+int Event_Loop::run() {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  loopThread = std::this_thread::get_id();
+  while (running) {
+    // connections left readable only poll for new events before their next turn
+    int ready = epoll_wait(epollFd, events, EVENT_LOOP_MAX_EVENTS, unreadIds.empty() ? -1 : 0);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      logger->logError("Error waiting on epoll");
+      return -1;
+    }
+    std::unordered_set<Connection_Id> unread;
+    unread.swap(unreadIds);
+    for (int i = 0; i < ready; i++) {
+      Connection_Id id = events[i].data.u64;
+      if (id == EVENT_LOOP_WAKE_ID) {
+        uint64_t count;
+        if (read(wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+          logger->logError("Error reading eventfd");
+        }
+        flushPending();
+        continue;
+      }
+      int listenFd = -1;
+      {
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        std::unordered_map<Connection_Id, int>::iterator it = listeners.find(id);
+        if (it != listeners.end()) {
+          listenFd = it->second;
+        }
+      }
+      if (listenFd >= 0) {
+        acceptAll(listenFd);
+        continue;
+      }
+      std::shared_ptr<Connection> connection = getConnection(id);
+      if (connection == nullptr) {
+        continue;
+      }
+      bool closing = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+      if (!closing && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+        unread.erase(id);
+        int status = readSome(*connection);
+        if (status > 0) {
+          unreadIds.insert(id);
+        }
+        closing = status < 0;
+      }
+      if (!closing && (events[i].events & EPOLLOUT)) {
+        std::lock_guard<std::mutex> lock(connection->outboundMutex);
+        closing = flush(*connection) < 0;
+      }
+      if (closing) {
+        closeConnection(id);
+      }
+    }
+    for (Connection_Id id : unread) {
+      std::shared_ptr<Connection> connection = getConnection(id);
+      if (connection == nullptr) {
+        continue;
+      }
+      int status = readSome(*connection);
+      if (status > 0) {
+        unreadIds.insert(id);
+      }
+      else if (status < 0) {
+        closeConnection(id);
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief makes run return
+*/
+void Event_Loop::stop() {
+  running = false;
+  uint64_t one = 1;
+  if (write(wakeFd, &one, sizeof(one)) < 0) {
+    logger->logError("Error waking event loop");
+  }
+}
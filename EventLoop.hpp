@@ -0,0 +1,231 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "FrameBuffer.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Protocol.hpp"
+
+#define EVENT_LOOP_MAX_EVENTS 256               // events taken from epoll per wait
+#define EVENT_LOOP_MAX_IOV 64                   // queued frames handed to one sendmsg
+#define EVENT_LOOP_MAX_READ_FRAMES 64           // frames taken from one connection per turn
+#define EVENT_LOOP_MAX_QUEUED_BYTES (1 << 20)   // queued bytes before flood frames are shed
+#define EVENT_LOOP_MAX_BACKLOG_BYTES (1 << 22)  // queued bytes before the peer counts as stuck
+#define EVENT_LOOP_WAKE_ID 0                    // epoll data of the eventfd
+#define EVENT_LOOP_FIRST_ID 1                   // id of the first socket served
+
+// a framed message waiting to be written
+struct Outbound_Frame_t {
+  std::string bytes;  // header and payload
+  int type;           //
+};
+typedef struct Outbound_Frame_t Outbound_Frame;
+
+// state of one connection served by the event loop
+struct Connection_t {
+  Connection_Id id;                                      // never reused, unlike fd
+  int fd;                                                //
+  Frame_Buffer inbound;                                  // received bytes, loop thread only
+  std::deque<Outbound_Frame> outbound[MESSAGE_CLASSES];  // class -> unwritten frames, oldest first
+  int partialClass;                                      // class of the partly written frame or -1
+  size_t outboundOffset;                                 // bytes of that frame already written
+  size_t outboundBytes;                                  // bytes of outbound not written yet
+  bool flushPending;                                     // waiting in the pending flushes
+  bool blocked;                                          // socket full, EPOLLOUT resumes the flush
+  bool closed;                                           // fd closed or closing
+  std::mutex outboundMutex;                              // mutex for the outbound fields and closed
+  std::atomic<uint64_t> bytesIn;                         // bytes received
+  std::atomic<uint64_t> bytesOut;                        // bytes written to the socket
+};
+typedef struct Connection_t Connection;
+
+// called with every complete message, message is only valid during the call
+typedef std::function<void(Connection_Id connection, int type, const char * message, int length)>
+    Message_Callback;
+// called when a connection is closed, before its fd is
+typedef std::function<void(Connection_Id connection)> Close_Callback;
+// returns the MESSAGE_CLASS_ a message type is sent with
+typedef std::function<int(int type)> Class_Callback;
+
+class Event_Loop {
+  Logger * logger;
+  int epollFd;                                     // -1 if not initialized
+  int wakeFd;                                      // eventfd used to stop or wake the loop
+  std::unordered_map<Connection_Id,                //
+                     int>                          //
+      listeners;                                   // id -> listening socket
+  std::unordered_map<Connection_Id,                //
+                     std::shared_ptr<Connection> > //
+      connections;                                 // id -> connection
+  std::atomic<Connection_Id> nextId;               // id of the next socket served
+  std::mutex connectionsMutex;                     // mutex for listeners and connections
+  Message_Callback onMessage;                      //
+  Close_Callback onClose;                          //
+  Class_Callback classOf;                          //
+  std::vector<std::shared_ptr<Connection> >        //
+      pendingFlushes;                              // connections with newly queued frames
+  std::mutex pendingMutex;                         // mutex for pendingFlushes
+  std::unordered_set<Connection_Id> unreadIds;     // connections left readable, loop thread only
+  std::atomic<bool> running;                       // set by init, cleared by stop
+  std::atomic<std::thread::id> loopThread;         // thread in run
+
+  /**
+ * @brief returns a connection, nullptr if it is not served by the loop
+*/
+  std::shared_ptr<Connection> getConnection(Connection_Id id);
+
+  /**
+ * @brief accepts all pending connections on a listening socket
+*/
+  void acceptAll(int listenFd);
+
+  /**
+ * @brief reads and dispatches up to EVENT_LOOP_MAX_READ_FRAMES messages, so one
+ * busy peer cannot hold the loop. the sockets are edge triggered, a connection
+ * stopped at the limit goes into unreadIds and gets another turn after the next wait
+ * returns 1 if messages may be left, 0 if the socket would block,
+ * -1 if the connection has to be closed
+*/
+  int readSome(Connection & connection);
+
+  /**
+ * @brief writes as much of outbound as the socket accepts, caller holds outboundMutex
+ * a partly written frame is finished first, then frames go out by class, lower
+ * classes first. queued frames are coalesced, up to EVENT_LOOP_MAX_IOV of them per
+ * sendmsg.
+ * returns 0 if the connection is still usable, -1 otherwise
+*/
+  int flush(Connection & connection);
+
+  /**
+ * @brief drops the oldest MESSAGE_CLASS_FLOOD frames until length more bytes fit
+ * in the queue, caller holds outboundMutex. a partly written frame is never dropped
+ * returns true if length bytes fit
+*/
+  bool shed(Connection & connection, size_t length);
+
+  /**
+ * @brief flushes the connections that had frames queued since the last call
+*/
+  void flushPending();
+
+ public:
+  Event_Loop(Logger * logger) :
+      logger(logger),
+      epollFd(-1),
+      wakeFd(-1),
+      listeners(),
+      connections(),
+      nextId(EVENT_LOOP_FIRST_ID),
+      connectionsMutex(),
+      onMessage(),
+      onClose(),
+      classOf(),
+      pendingFlushes(),
+      pendingMutex(),
+      unreadIds(),
+      running(false),
+      loopThread() {}
+
+  ~Event_Loop();
+
+  /**
+ * @brief creates the epoll instance
+ * returns 0 if successful, -1 otherwise
+*/
+  int init();
+
+  /**
+ * @brief sets the function called with every received message
+*/
+  void setMessageCallback(Message_Callback callback);
+
+  /**
+ * @brief sets the function called after a connection was closed
+*/
+  void setCloseCallback(Close_Callback callback);
+
+  /**
+ * @brief sets the function returning the MESSAGE_CLASS_ of a message type
+ * without one every message is MESSAGE_CLASS_CONTROL, sent in order and never shed
+*/
+  void setClassCallback(Class_Callback callback);
+
+  /**
+ * @brief serves a listening socket, accepted connections are added automatically
+ * returns 0 if successful, -1 otherwise
+*/
+  int addListener(int fd);
+
+  /**
+ * @brief serves a connected socket, the socket is made non-blocking
+ * returns the id of the connection if successful, -1 otherwise
+*/
+  Connection_Id addConnection(int fd);
+
+  /**
+ * @brief queues a message to a connection without blocking
+ * the loop thread writes it together with the other frames queued meanwhile,
+ * queued frames of lower classes go first. once EVENT_LOOP_MAX_QUEUED_BYTES are
+ * queued the oldest MESSAGE_CLASS_FLOOD frames make room, a flood message that
+ * still does not fit is dropped. a peer with EVENT_LOOP_MAX_BACKLOG_BYTES queued
+ * is disconnected.
+ * returns the length of the message if queued, 0 if dropped, -1 otherwise
+ * @param connection the connection to send the message to
+ * @param message the message to send
+ * @param length the length of the message
+ * @param type the type of the message
+*/
+  int sendMessage(Connection_Id connection, const char * message, int length, int type);
+
+  /**
+ * @brief stops serving a connection and closes its socket
+ * the close callback runs before the socket is closed. off the loop thread the
+ * socket is only shut down, the loop closes it when it sees the hangup so the fd
+ * number is not reused while the loop still reads it
+*/
+  void closeConnection(Connection_Id connection);
+
+  /**
+ * @brief returns the bytes received and sent on every served connection
+ * returns connection -> (bytes in, bytes out)
+*/
+  std::unordered_map<Connection_Id, std::pair<uint64_t, uint64_t> > getConnectionBytes();
+
+  /**
+ * @brief returns the frames queued on every served connection by MESSAGE_CLASS_
+*/
+  std::vector<size_t> getQueuedFrames();
+
+  /**
+ * @brief runs the loop on the calling thread until stop is called
+ * returns at once if stop came before run. returns 0 if stopped, -1 on error
+*/
+  int run();
+
+  /**
+ * @brief makes run return
+*/
+  void stop();
+};
+
+#endif
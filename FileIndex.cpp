@@ -0,0 +1,158 @@
+#include "FileIndex.hpp"
+
+/**
+ * @brief returns the file name of a path, the part after the last slash
+*/
+std::string File_Index::nameOf(const std::string & path) {
+  size_t lastSlash = path.find_last_of('/');
+  if (lastSlash == std::string::npos) {
+    return path;
+  }
+  return path.substr(lastSlash + 1);
+}
+
+/**
+ * @brief removes a path from the maps, caller must hold indexMutex exclusively
+ * returns true if the path was indexed, false otherwise
+*/
+bool File_Index::erasePath(const std::string & path) {
+  std::unordered_map<std::string, File_Entry>::iterator it = files.find(path);
+  if (it == files.end()) {
+    return false;
+  }
+  auto range = paths.equal_range(it->second.hash);
+  for (auto p = range.first; p != range.second; ++p) {
+    if (p->second == path) {
+      paths.erase(p);
+      break;
+    }
+  }
+  auto named = fileNames.equal_range(nameOf(path));
+  for (auto p = named.first; p != named.second; ++p) {
+    if (p->second == path) {
+      fileNames.erase(p);
+      break;
+    }
+  }
+  names.remove(path);
+  files.erase(it);
+  version++;
+  return true;
+}
+
+/**
+ * @brief adds or replaces the entry of a file
+ * an existing entry with the same path is replaced
+ * @param entry the entry to add
+*/
+void File_Index::insert(const File_Entry & entry) {
+  std::unique_lock<std::shared_mutex> lock(indexMutex);
+  erasePath(entry.path);
+  files[entry.path] = entry;
+  paths.emplace(entry.hash, entry.path);
+  fileNames.emplace(nameOf(entry.path), entry.path);
+  names.insert(entry.path, entry.hash);
+  version++;
+}
+
+/**
+ * @brief removes the entry of a file
+ * returns true if the path was indexed, false otherwise
+ * @param path the absolute path of the file
+*/
+bool File_Index::remove(const std::string & path) {
+  std::unique_lock<std::shared_mutex> lock(indexMutex);
+  return erasePath(path);
+}
+
+/**
+ * @brief looks up a file by hash
+ * returns true and fills entry if a file with the hash is indexed, false otherwise
+ * @param hash the hash of the file in hex
+ * @param entry will be set to the entry of the file
+*/
+bool File_Index::lookup(const std::string & hash, File_Entry & entry) const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  std::unordered_multimap<std::string, std::string>::const_iterator it = paths.find(hash);
+  if (it == paths.end()) {
+    return false;
+  }
+  entry = files.at(it->second);
+  return true;
+}
+
+/**
+ * @brief looks up a file by path
+ * returns true and fills entry if the path is indexed, false otherwise
+ * @param path the absolute path of the file
+ * @param entry will be set to the entry of the file
+*/
+bool File_Index::lookupPath(const std::string & path, File_Entry & entry) const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  std::unordered_map<std::string, File_Entry>::const_iterator it = files.find(path);
+  if (it == files.end()) {
+    return false;
+  }
+  entry = it->second;
+  return true;
+}
+
+/**
+ * @brief checks if a file with a given hash is indexed
+*/
+bool File_Index::contains(const std::string & hash) const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  return paths.find(hash) != paths.end();
+}
+
+/**
+ * @brief checks if a file with exactly a given file name is indexed
+ * @param name the file name, without directories
+*/
+bool File_Index::containsName(const std::string & name) const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  return fileNames.find(name) != fileNames.end();
+}
+
+/**
+ * @brief finds the files whose names match a name search
+ * returns at most maxResults matches, best first
+ * @param query keywords or part of a file name
+ * @param maxResults the maximum number of matches returned
+*/
+std::vector<Name_Match> File_Index::search(const std::string & query,
+                                           size_t maxResults) const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  return names.search(query, maxResults);
+}
+
+/**
+ * @brief returns the number of indexed files
+*/
+size_t File_Index::size() const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  return files.size();
+}
+
+/**
+ * @brief returns a number that changes whenever an entry is added or removed
+*/
+uint64_t File_Index::getVersion() const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  return version;
+}
+
+/**
+ * @brief returns a copy of all entries in the index
+*/
+std::vector<File_Entry> File_Index::snapshot() const {
+  std::shared_lock<std::shared_mutex> lock(indexMutex);
+  std::vector<File_Entry> entries;
+  entries.reserve(files.size());
+  for (std::unordered_map<std::string, File_Entry>::const_iterator it = files.begin();
+       it != files.end();
+       ++it) {
+    entries.push_back(it->second);
+  }
+  return entries;
+}
@@ -0,0 +1,120 @@
+#ifndef FILE_INDEX_HPP
+#define FILE_INDEX_HPP
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "NameIndex.hpp"
+
+// metadata of a shared file kept in the index
+struct File_Entry_t {
+  std::string path;  // absolute path of the file
+  std::string hash;  // sha256 of the file in hex
+  size_t size;       // size of the file
+  time_t mtime;      // last modification time of the file
+  long mtimeNsec;    // nanoseconds part of mtime
+  ino_t inode;       // inode of the file
+};
+typedef struct File_Entry_t File_Entry;
+
+class File_Index {
+  std::unordered_map<std::string,           //
+                     File_Entry>            //
+      files;                                // file path -> file entry
+  std::unordered_multimap<std::string,      //
+                          std::string>      //
+      paths;                                // hash -> file path
+  std::unordered_multimap<std::string,      //
+                          std::string>      //
+      fileNames;                            // file name -> file path
+  Name_Index names;                         // words and grams of the file names
+  uint64_t version;                         // incremented by every change
+  mutable std::shared_mutex indexMutex;     // mutex for the maps, names and version
+
+  /**
+ * @brief returns the file name of a path, the part after the last slash
+*/
+  static std::string nameOf(const std::string & path);
+
+  /**
+ * @brief removes a path from the maps, caller must hold indexMutex exclusively
+ * returns true if the path was indexed, false otherwise
+*/
+  bool erasePath(const std::string & path);
+
+ public:
+  File_Index() : files(), paths(), fileNames(), names(), version(0), indexMutex() {}
+
+  /**
+ * @brief adds or replaces the entry of a file
+ * an existing entry with the same path is replaced
+ * @param entry the entry to add
+*/
+  void insert(const File_Entry & entry);
+
+  /**
+ * @brief removes the entry of a file
+ * returns true if the path was indexed, false otherwise
+ * @param path the absolute path of the file
+*/
+  bool remove(const std::string & path);
+
+  /**
+ * @brief looks up a file by hash
+ * returns true and fills entry if a file with the hash is indexed, false otherwise
+ * @param hash the hash of the file in hex
+ * @param entry will be set to the entry of the file
+*/
+  bool lookup(const std::string & hash, File_Entry & entry) const;
+
+  /**
+ * @brief looks up a file by path
+ * returns true and fills entry if the path is indexed, false otherwise
+ * @param path the absolute path of the file
+ * @param entry will be set to the entry of the file
+*/
+  bool lookupPath(const std::string & path, File_Entry & entry) const;
+
+  /**
+ * @brief checks if a file with a given hash is indexed
+*/
+  bool contains(const std::string & hash) const;
+
+  /**
+ * @brief checks if a file with exactly a given file name is indexed
+ * @param name the file name, without directories
+*/
+  bool containsName(const std::string & name) const;
+
+  /**
+ * @brief finds the files whose names match a name search
+ * returns at most maxResults matches, best first
+ * @param query keywords or part of a file name
+ * @param maxResults the maximum number of matches returned
+*/
+  std::vector<Name_Match> search(const std::string & query, size_t maxResults) const;
+
+  /**
+ * @brief returns the number of indexed files
+*/
+  size_t size() const;
+
+  /**
+ * @brief returns a number that changes whenever an entry is added or removed
+*/
+  uint64_t getVersion() const;
+
+  /**
+ * @brief returns a copy of all entries in the index
+*/
+  std::vector<File_Entry> snapshot() const;
+};
+
+#endif
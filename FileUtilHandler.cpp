@@ -88,35 +88,136 @@ bool File_Util_Handler::isValidHash(std::string hash) {
   }
 }
 
+// per thread digest context and read buffer reused by every hashFile call
+struct Hash_State_t {
+  EVP_MD_CTX * mdctx;
+  unsigned char * buffer;
+
+  Hash_State_t() : mdctx(EVP_MD_CTX_new()), buffer(NULL) {
+    void * aligned;
+    if (posix_memalign(&aligned, 4096, HASH_BLOCK_SIZE) == 0) {
+      buffer = (unsigned char *)aligned;
+    }
+  }
+  ~Hash_State_t() {
+    EVP_MD_CTX_free(mdctx);
+    free(buffer);
+  }
+};
+typedef struct Hash_State_t Hash_State;
+
+static thread_local Hash_State hashState;
+
+/**
+ * @brief converts a binary digest to a lowercase hex string
+ * @param digest the digest to convert
+ * @param digest_len the length of the digest
+*/
+std::string File_Util_Handler::digestToHex(const unsigned char * digest,
+                                           unsigned int digest_len) {
+  static const char hexDigits[] = "0123456789abcdef";
+  std::string hex(digest_len * 2, '0');
+  for (unsigned int i = 0; i < digest_len; i++) {
+    hex[2 * i] = hexDigits[digest[i] >> 4];
+    hex[2 * i + 1] = hexDigits[digest[i] & 0x0f];
+  }
+  return hex;
+}
+
+/**
+ * @brief converts a hex string to a binary digest
+ * returns true if successful, false if hex has an odd length or non hex digits
+ * @param hex the hex string to convert
+ * @param digest will be set to the digest, must hold hex.length() / 2 bytes
+*/
+bool File_Util_Handler::hexToDigest(const std::string & hex, unsigned char * digest) {
+  if (hex.length() % 2 != 0) {
+    return false;
+  }
+  for (size_t i = 0; i < hex.length(); i += 2) {
+    int value = 0;
+    for (size_t j = i; j < i + 2; j++) {
+      char c = hex[j];
+      value <<= 4;
+      if (c >= '0' && c <= '9') {
+        value |= c - '0';
+      }
+      else if (c >= 'a' && c <= 'f') {
+        value |= c - 'a' + 10;
+      }
+      else if (c >= 'A' && c <= 'F') {
+        value |= c - 'A' + 10;
+      }
+      else {
+        return false;
+      }
+    }
+    digest[i / 2] = value;
+  }
+  return true;
+}
+
 /**
  * @brief hashes a file with given absolute file path.
+ * reads the file in HASH_BLOCK_SIZE blocks so memory use does not grow with file size.
  * returns the hash of the file at filePath
  * @param filePath the absolute path to the file
 */
 std::string File_Util_Handler::hashFile(std::string filePath) {
+  int fd = -1;
   try {
-    std::ifstream file(filePath, std::ios::binary);
-    if (!file.is_open()) {
+    if (hashState.mdctx == NULL || hashState.buffer == NULL) {
+      logError("Error allocating hash state");
+      return "";
+    }
+    uint64_t start = Metrics_Registry::nowMicros();
+    uint64_t total = 0;
+    fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
       logError("Error opening file");
       return "";
     }
-    std::ostringstream ss;
-    ss << file.rdbuf();
-    file.close();
-    const std::string & s = ss.str();
-    unsigned char * digest;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (1 != EVP_DigestInit_ex(hashState.mdctx, EVP_sha256(), NULL)) {
+      close(fd);
+      logError("Error initializing digest of file " + filePath);
+      return "";
+    }
+    ssize_t bytes_read;
+    while ((bytes_read = read(fd, hashState.buffer, HASH_BLOCK_SIZE)) != 0) {
+      if (bytes_read < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        close(fd);
+        logError("Error reading file " + filePath);
+        return "";
+      }
+      if (1 != EVP_DigestUpdate(hashState.mdctx, hashState.buffer, bytes_read)) {
+        close(fd);
+        logError("Error updating digest of file " + filePath);
+        return "";
+      }
+      total += bytes_read;
+    }
+    close(fd);
+    unsigned char digest[EVP_MAX_MD_SIZE];
     unsigned int digest_len;
-    digest_message((unsigned char *)s.c_str(), s.length(), &digest, &digest_len);
-    std::ostringstream hashs;
-    hashs << std::hex << std::setfill('0');
-    for (int i = 0; i < digest_len; i++) {
-      hashs << std::setw(2) << (int)digest[i];
+    if (1 != EVP_DigestFinal_ex(hashState.mdctx, digest, &digest_len)) {
+      logError("Error finalizing digest of file " + filePath);
+      return "";
     }
-    OPENSSL_free(digest);
-    logEvent("Hashed file " + filePath + " to " + hashs.str());
-    return hashs.str();
+    std::string hash = digestToHex(digest, digest_len);
+    Metrics_Registry::add(METRIC_FILES_HASHED);
+    Metrics_Registry::add(METRIC_BYTES_HASHED, total);
+    Metrics_Registry::observe(HISTOGRAM_HASH_FILE, Metrics_Registry::nowMicros() - start);
+    LOG_DEBUG(logger, "Hashed file %s to %s", filePath.c_str(), hash.c_str());
+    return hash;
   }
   catch (std::exception & e) {
+    if (fd >= 0) {
+      close(fd);
+    }
     logError("Error hashing file " + filePath);
     return "";
   }
@@ -130,17 +231,16 @@ std::string File_Util_Handler::hashFile(std::string filePath) {
 */
 std::string File_Util_Handler::hashCharArray(char * data, size_t size) {
   try {
-    const unsigned char * message = (unsigned char *)data;
-    unsigned char * digest;
+    unsigned char digest[EVP_MAX_MD_SIZE];
     unsigned int digest_len;
-    digest_message(message, size, &digest, &digest_len);
-    std::ostringstream hashs;
-    hashs << std::hex << std::setfill('0');
-    for (int i = 0; i < digest_len; i++) {
-      hashs << std::setw(2) << (int)digest[i];
+    if (hashState.mdctx == NULL ||
+        1 != EVP_DigestInit_ex(hashState.mdctx, EVP_sha256(), NULL) ||
+        1 != EVP_DigestUpdate(hashState.mdctx, data, size) ||
+        1 != EVP_DigestFinal_ex(hashState.mdctx, digest, &digest_len)) {
+      logError("Error hashing char array");
+      return "";
     }
-    OPENSSL_free(digest);
-    return hashs.str();
+    return digestToHex(digest, digest_len);
   }
   catch (std::exception & e) {
     logError("Error hashing char array");
@@ -207,7 +307,7 @@ std::vector<std::string> File_Util_Handler::getAllFiles(std::string path,
     struct dirent * ent;
     if ((dir = opendir(path.c_str())) != NULL) {
       while ((ent = readdir(dir)) != NULL) {
-        if (ent->d_type == DT_REG) {
+        if (ent->d_type == DT_REG && !isPartialFile(ent->d_name)) {
           files.push_back(path + "/" + ent->d_name);
         }
         if (recursive && ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 &&
@@ -230,6 +330,17 @@ std::vector<std::string> File_Util_Handler::getAllFiles(std::string path,
   }
 }
 
+/**
+ * @brief checks if a path belongs to a download in progress
+*/
+bool File_Util_Handler::isPartialFile(std::string filePath) {
+  size_t suffixLength = strlen(PARTIAL_FILE_SUFFIX);
+  return filePath.length() >= suffixLength &&
+         filePath.compare(filePath.length() - suffixLength,
+                          suffixLength,
+                          PARTIAL_FILE_SUFFIX) == 0;
+}
+
 /**
  * @brief returns the file name from an absolute path
 */
@@ -252,19 +363,7 @@ std::string File_Util_Handler::getFileName(std::string filePath) {
  * @brief checks if a file with a given hash exists in a directory
 */
 bool File_Util_Handler::fileWithHashExists(std::string path, std::string hash) {
-  try {
-    std::vector<std::string> files = getAllFiles(path, true);
-    for (std::string file : files) {
-      if (fileMatchHash(file, hash)) {
-        return true;
-      }
-    }
-    return false;
-  }
-  catch (std::exception & e) {
-    logError("Error checking if file with hash " + hash + " exists in directory " + path);
-    return false;
-  }
+  return getFilePathFromHash(path, hash) != "";
 }
 
 /**
@@ -272,6 +371,11 @@ bool File_Util_Handler::fileWithHashExists(std::string path, std::string hash) {
 */
 bool File_Util_Handler::fileWithNameExists(std::string path, std::string name) {
   try {
+    // files still waiting to be hashed are not indexed yet, scan while indexing runs
+    if (fileIndex != NULL && path == fileDirectory && indexListed &&
+        indexDone >= indexQueued) {
+      return fileIndex->containsName(name);
+    }
     std::vector<std::string> files = getAllFiles(path, true);
     for (std::string file : files) {
       if (getFileName(file).compare(name) == 0) {
@@ -294,6 +398,20 @@ bool File_Util_Handler::fileWithNameExists(std::string path, std::string name) {
 */
 std::string File_Util_Handler::getFilePathFromHash(std::string path, std::string hash) {
   try {
+    if (fileIndex != NULL && path == fileDirectory) {
+      std::transform(hash.begin(), hash.end(), hash.begin(), ::tolower);
+      File_Entry entry;
+      while (fileIndex->lookup(hash, entry)) {
+        if (entryIsCurrent(entry)) {
+          return entry.path;
+        }
+        // the file changed or disappeared since it was indexed, it is rehashed in
+        // the background rather than holding up the query
+        unindexFile(entry.path);
+        queueIndexFile(entry.path);
+      }
+      return "";
+    }
     std::vector<std::string> files = getAllFiles(path, true);
     for (std::string file : files) {
       if (fileMatchHash(file, hash)) {
@@ -315,6 +433,12 @@ std::string File_Util_Handler::getFilePathFromHash(std::string path, std::string
 */
 std::string File_Util_Handler::getFileHashFromPath(std::string path) {
   try {
+    if (fileIndex != NULL) {
+      File_Entry entry;
+      if (fileIndex->lookupPath(path, entry) && entryIsCurrent(entry)) {
+        return entry.hash;
+      }
+    }
     std::vector<std::string> files = getAllFiles(path, true);
     for (std::string file : files) {
       if (file.compare(path) == 0) {
@@ -327,4 +451,253 @@ std::string File_Util_Handler::getFileHashFromPath(std::string path) {
     logError("Error getting file hash from path " + path);
     return "";
   }
+}
+
+/**
+ * @brief gets the size, modification time and inode of a file
+ * returns true if the file is a regular file, false otherwise
+ * @param filePath the absolute path to the file
+ * @param entry will have its path, size, mtime and inode set
+*/
+bool File_Util_Handler::statFile(std::string filePath, File_Entry & entry) {
+  struct stat st;
+  if (stat(filePath.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  entry.path = filePath;
+  entry.size = st.st_size;
+  entry.mtime = st.st_mtim.tv_sec;
+  entry.mtimeNsec = st.st_mtim.tv_nsec;
+  entry.inode = st.st_ino;
+  return true;
+}
+
+/**
+ * @brief checks if a stored entry still describes the file on disk
+ * returns true if the file exists with the same size, mtime and inode
+ * @param entry the stored entry of the file
+*/
+bool File_Util_Handler::entryIsCurrent(const File_Entry & entry) {
+  File_Entry current;
+  return statFile(entry.path, current) && current.size == entry.size &&
+         current.mtime == entry.mtime && current.mtimeNsec == entry.mtimeNsec &&
+         current.inode == entry.inode;
+}
+
+/**
+ * @brief hashes a file and adds it to the index
+ * returns 0 if successful, -1 otherwise
+ * @param filePath the absolute path to the file
+*/
+int File_Util_Handler::indexFile(std::string filePath) {
+  try {
+    if (fileIndex == NULL) {
+      return -1;
+    }
+    File_Entry entry;
+    if (!statFile(filePath, entry)) {
+      logError("Error indexing file " + filePath);
+      return -1;
+    }
+    entry.hash = hashFile(filePath);
+    if (entry.hash == "") {
+      return -1;
+    }
+    fileIndex->insert(entry);
+    return 0;
+  }
+  catch (std::exception & e) {
+    logError("Error indexing file " + filePath);
+    return -1;
+  }
+}
+
+/**
+ * @brief removes a file from the index
+ * returns 0 if the file was indexed, -1 otherwise
+ * @param filePath the absolute path to the file
+*/
+int File_Util_Handler::unindexFile(std::string filePath) {
+  if (fileIndex == NULL || !fileIndex->remove(filePath)) {
+    return -1;
+  }
+  logEvent("Removed file " + filePath + " from index");
+  return 0;
+}
+
+/**
+ * @brief removes every file below a directory from the index
+ * returns the number of files removed
+ * @param path the path to the directory
+*/
+int File_Util_Handler::unindexDirectory(std::string path) {
+  if (fileIndex == NULL) {
+    return 0;
+  }
+  std::string prefix = path + "/";
+  int removed = 0;
+  for (File_Entry & entry : fileIndex->snapshot()) {
+    if (entry.path.compare(0, prefix.length(), prefix) == 0 &&
+        unindexFile(entry.path) == 0) {
+      removed++;
+    }
+  }
+  return removed;
+}
+
+/**
+ * @brief checks if a file is indexed and unchanged since it was hashed
+ * @param filePath the absolute path to the file
+*/
+bool File_Util_Handler::isIndexed(std::string filePath) {
+  File_Entry entry;
+  return fileIndex != NULL && fileIndex->lookupPath(filePath, entry) &&
+         entryIsCurrent(entry);
+}
+
+/**
+ * @brief brings the index in line with fileDirectory
+ * hashes new or modified files and drops files that no longer exist.
+ * unchanged files are only stat'ed, files unchanged since the catalog was saved take
+ * their hash from the catalog. the catalog is saved once all hashing is done.
+ * if pool is given the files are hashed on it and
+ * the call returns once they are queued, lookups see each file as soon as it is hashed.
+ * returns the number of files that are (or will be) hashed, -1 if failed
+ * @param pool the workers to hash on, NULL to hash on the calling thread
+*/
+int File_Util_Handler::refreshIndex(Thread_Pool * pool) {
+  try {
+    if (fileIndex == NULL) {
+      return -1;
+    }
+    std::vector<std::string> files = getAllFiles(fileDirectory, true);
+    std::unordered_set<std::string> present(files.begin(), files.end());
+    size_t removed = 0;
+    for (File_Entry & entry : fileIndex->snapshot()) {
+      if (present.find(entry.path) == present.end()) {
+        unindexFile(entry.path);
+        removed++;
+      }
+    }
+    int catalogSize = catalog.load();
+    size_t restored = 0;
+    std::vector<std::string> changed;
+    for (std::string file : files) {
+      File_Entry entry;
+      if (fileIndex->lookupPath(file, entry) && entryIsCurrent(entry)) {
+        continue;
+      }
+      if (catalog.lookup(file, entry) && entryIsCurrent(entry)) {
+        fileIndex->insert(entry);
+        restored++;
+        continue;
+      }
+      changed.push_back(file);
+    }
+    catalog.unload();
+    indexQueued += changed.size();
+    indexListed = true;
+    logEvent("Hashing " + std::to_string(changed.size()) + " of " +
+             std::to_string(files.size()) + " files in " + fileDirectory + ", " +
+             std::to_string(restored) + " restored from catalog");
+    if (changed.empty()) {
+      if (removed > 0 || catalogSize != (int)fileIndex->size()) {
+        saveCatalog();
+      }
+      return 0;
+    }
+    for (std::string file : changed) {
+      std::function<void()> task = [this, file] {
+        indexFile(file);
+        size_t done = ++indexDone;
+        size_t queued = indexQueued;
+        if (done % INDEX_PROGRESS_INTERVAL == 0 || done == queued) {
+          logEvent("Hashed " + std::to_string(done) + "/" + std::to_string(queued) +
+                   " files, " + std::to_string(fileIndex->size()) + " indexed");
+        }
+        if (done == queued) {
+          saveCatalog();
+        }
+      };
+      if (pool == NULL || !pool->submit(task)) {
+        task();
+      }
+    }
+    return changed.size();
+  }
+  catch (std::exception & e) {
+    logError("Error refreshing index of directory " + fileDirectory);
+    return -1;
+  }
+}
+
+/**
+ * @brief queues a file that changed since it was indexed to be hashed again on the
+ * index pool, the file is left to the watcher if there is no pool
+ * @param filePath the absolute path to the file
+*/
+void File_Util_Handler::queueIndexFile(const std::string & filePath) {
+  File_Entry current;
+  if (indexPool == NULL || !statFile(filePath, current)) {
+    return;
+  }
+  indexPool->submit([this, filePath] { indexFile(filePath); });
+}
+
+/**
+ * @brief gets the progress of the files queued by refreshIndex
+ * @param done will be set to the number of files hashed so far
+ * @param queued will be set to the number of files queued
+*/
+void File_Util_Handler::getIndexProgress(size_t & done, size_t & queued) {
+  done = indexDone;
+  queued = indexQueued;
+}
+
+/**
+ * @brief returns the workers stale files are rehashed on, NULL if there are none
+*/
+Thread_Pool * File_Util_Handler::getIndexPool() {
+  return indexPool;
+}
+
+/**
+ * @brief returns the directory of shared files
+*/
+std::string File_Util_Handler::getFileDirectory() {
+  return fileDirectory;
+}
+
+/**
+ * @brief returns the directory hash trees of shared files are saved in, a sibling
+ * of the share named after it with a .trees suffix
+*/
+std::string File_Util_Handler::getTreeDirectory() {
+  std::string directory = fileDirectory;
+  while (directory.length() > 1 && directory.back() == '/') {
+    directory.pop_back();
+  }
+  return directory + ".trees";
+}
+
+/**
+ * @brief writes the current index to the hash catalog
+ * returns 0 if successful, -1 otherwise
+*/
+int File_Util_Handler::saveCatalog() {
+  if (fileIndex == NULL) {
+    return -1;
+  }
+  return catalog.save(fileIndex->snapshot());
+}
+
+/**
+ * @brief returns the catalog path for a share directory, a sibling file named
+ * after the directory with a .catalog suffix
+*/
+std::string File_Util_Handler::catalogPathFor(std::string fileDirectory) {
+  while (fileDirectory.length() > 1 && fileDirectory.back() == '/') {
+    fileDirectory.pop_back();
+  }
+  return fileDirectory + ".catalog";
 }
\ No newline at end of file
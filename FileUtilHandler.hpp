@@ -1,4 +1,12 @@
+#ifndef FILE_UTIL_HANDLER_HPP
+#define FILE_UTIL_HANDLER_HPP
+
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <openssl/conf.h>
 #include <openssl/crypto.h>
 #include <openssl/dh.h>
@@ -8,20 +16,62 @@
 #include <openssl/sha.h>
 #include <openssl/x509.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <iomanip>
 #include <sstream>
+#include <unordered_set>
 #include <vector>
 
+#include "FileIndex.hpp"
+#include "HashCatalog.hpp"
 #include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Protocol.hpp"
+#include "ThreadPool.hpp"
+
+#define HASH_BLOCK_SIZE (1 << 20)     // bytes read per digest update when hashing files
+#define INDEX_PROGRESS_INTERVAL 1000  // files hashed between progress log lines
+#define PARTIAL_FILE_SUFFIX ".part"   // suffix of downloads in progress, never shared
 
 class File_Util_Handler {
   Logger * logger;
   std::string fileDirectory;
+  File_Index * fileIndex;           // index of fileDirectory, NULL if lookups should scan
+  std::atomic<size_t> indexQueued;  // files queued for hashing by refreshIndex
+  std::atomic<size_t> indexDone;    // queued files that finished hashing
+  std::atomic<bool> indexListed;    // refreshIndex queued every file at least once
+  Hash_Catalog catalog;             // on-disk hashes of fileDirectory
+  Thread_Pool * indexPool;          // workers rehashing stale files, NULL to leave them
+                                    // to the watcher
+
+  /**
+ * @brief returns the catalog path for a share directory, a sibling file named
+ * after the directory with a .catalog suffix
+*/
+  static std::string catalogPathFor(std::string fileDirectory);
+
+  /**
+ * @brief queues a file that changed since it was indexed to be hashed again on the
+ * index pool, the file is left to the watcher if there is no pool
+ * @param filePath the absolute path to the file
+*/
+  void queueIndexFile(const std::string & filePath);
 
  public:
-  File_Util_Handler(Logger * logger, std::string fileDirectory) :
-      logger(logger), fileDirectory(fileDirectory) {}
+  File_Util_Handler(Logger * logger,
+                    std::string fileDirectory,
+                    File_Index * fileIndex = NULL,
+                    Thread_Pool * indexPool = NULL) :
+      logger(logger),
+      fileDirectory(fileDirectory),
+      fileIndex(fileIndex),
+      indexQueued(0),
+      indexDone(0),
+      indexListed(false),
+      catalog(logger, catalogPathFor(fileDirectory)),
+      indexPool(indexPool) {}
 
   /**
  * @brief Log error
@@ -59,8 +109,24 @@ class File_Util_Handler {
 */
   bool isValidHash(std::string hash);
 
+  /**
+ * @brief converts a binary digest to a lowercase hex string
+ * @param digest the digest to convert
+ * @param digest_len the length of the digest
+*/
+  static std::string digestToHex(const unsigned char * digest, unsigned int digest_len);
+
+  /**
+ * @brief converts a hex string to a binary digest
+ * returns true if successful, false if hex has an odd length or non hex digits
+ * @param hex the hex string to convert
+ * @param digest will be set to the digest, must hold hex.length() / 2 bytes
+*/
+  static bool hexToDigest(const std::string & hex, unsigned char * digest);
+
   /**
  * @brief hashes a file with given absolute file path.
+ * reads the file in HASH_BLOCK_SIZE blocks so memory use does not grow with file size.
  * returns the hash of the file at filePath
  * @param filePath the absolute path to the file
 */
@@ -104,6 +170,11 @@ class File_Util_Handler {
 */
   std::vector<std::string> getAllFiles(std::string path, bool recursive);
 
+  /**
+ * @brief checks if a path belongs to a download in progress
+*/
+  bool isPartialFile(std::string filePath);
+
   /**
  * @brief returns the file name from an absolute path
 */
@@ -133,4 +204,88 @@ class File_Util_Handler {
  * @param path the absolute path to the file
 */
   std::string getFileHashFromPath(std::string path);
-};
\ No newline at end of file
+
+  /**
+ * @brief gets the size, modification time and inode of a file
+ * returns true if the file is a regular file, false otherwise
+ * @param filePath the absolute path to the file
+ * @param entry will have its path, size, mtime and inode set
+*/
+  bool statFile(std::string filePath, File_Entry & entry);
+
+  /**
+ * @brief checks if a stored entry still describes the file on disk
+ * returns true if the file exists with the same size, mtime and inode
+ * @param entry the stored entry of the file
+*/
+  bool entryIsCurrent(const File_Entry & entry);
+
+  /**
+ * @brief hashes a file and adds it to the index
+ * returns 0 if successful, -1 otherwise
+ * @param filePath the absolute path to the file
+*/
+  int indexFile(std::string filePath);
+
+  /**
+ * @brief removes a file from the index
+ * returns 0 if the file was indexed, -1 otherwise
+ * @param filePath the absolute path to the file
+*/
+  int unindexFile(std::string filePath);
+
+  /**
+ * @brief removes every file below a directory from the index
+ * returns the number of files removed
+ * @param path the path to the directory
+*/
+  int unindexDirectory(std::string path);
+
+  /**
+ * @brief checks if a file is indexed and unchanged since it was hashed
+ * @param filePath the absolute path to the file
+*/
+  bool isIndexed(std::string filePath);
+
+  /**
+ * @brief brings the index in line with fileDirectory
+ * hashes new or modified files and drops files that no longer exist.
+ * unchanged files are only stat'ed, files unchanged since the catalog was saved take
+ * their hash from the catalog. the catalog is saved once all hashing is done. if pool is given the files are hashed on it and
+ * the call returns once they are queued, lookups see each file as soon as it is hashed.
+ * returns the number of files that are (or will be) hashed, -1 if failed
+ * @param pool the workers to hash on, NULL to hash on the calling thread
+*/
+  int refreshIndex(Thread_Pool * pool = NULL);
+
+  /**
+ * @brief gets the progress of the files queued by refreshIndex
+ * @param done will be set to the number of files hashed so far
+ * @param queued will be set to the number of files queued
+*/
+  void getIndexProgress(size_t & done, size_t & queued);
+
+  /**
+ * @brief returns the workers stale files are rehashed on, NULL if there are none
+*/
+  Thread_Pool * getIndexPool();
+
+  /**
+ * @brief returns the directory of shared files
+*/
+  std::string getFileDirectory();
+
+  /**
+ * @brief returns the directory hash trees of shared files are saved in, a sibling
+ * of the share named after it with a .trees suffix
+*/
+  std::string getTreeDirectory();
+
+  /**
+ * @brief writes the current index to the hash catalog
+ * returns 0 if successful, -1 otherwise
+*/
+  int saveCatalog();
+};
+
+#endif
\ No newline at end of file
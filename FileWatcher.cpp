@@ -0,0 +1,189 @@
+#include "FileWatcher.hpp"
+
+/**
+ * @brief watches a directory and all directories below it
+ * returns the number of directories watched
+*/
+int File_Watcher::addWatchRecursive(std::string path) {
+  int wd = inotify_add_watch(inotifyFd,
+                             path.c_str(),
+                             IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                 IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR);
+  if (wd < 0) {
+    logger->logError("Error watching directory " + path);
+    return 0;
+  }
+  watches[wd] = path;
+  int count = 1;
+  DIR * dir = opendir(path.c_str());
+  if (dir == NULL) {
+    return count;
+  }
+  struct dirent * ent;
+  while ((ent = readdir(dir)) != NULL) {
+    if (ent->d_type == DT_DIR && strcmp(ent->d_name, ".") != 0 &&
+        strcmp(ent->d_name, "..") != 0) {
+      count += addWatchRecursive(path + "/" + ent->d_name);
+    }
+  }
+  closedir(dir);
+  return count;
+}
+
+/**
+ * @brief reads the queued inotify events and schedules the affected paths
+*/
+void File_Watcher::readEvents() {
+  alignas(struct inotify_event) char buffer[WATCH_EVENT_BUFFER];
+  ssize_t length;
+  while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+    Clock::time_point due = Clock::now() + std::chrono::milliseconds(WATCH_DEBOUNCE_MS);
+    for (char * ptr = buffer; ptr < buffer + length;) {
+      struct inotify_event * event = (struct inotify_event *)ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // events were lost, fall back to a full comparison of the tree
+        logger->logError("inotify queue overflowed, rescanning " + directory);
+        rescanPending = true;
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        watches.erase(event->wd);
+        continue;
+      }
+      std::unordered_map<int, std::string>::iterator it = watches.find(event->wd);
+      if (it == watches.end() || event->len == 0) {
+        continue;
+      }
+      std::string path = it->second + "/" + event->name;
+      if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          // files may have landed before the watch was added
+          addWatchRecursive(path);
+          for (std::string file : fileUtilHandler->getAllFiles(path, true)) {
+            pending[file] = due;
+          }
+        }
+        else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+          fileUtilHandler->unindexDirectory(path);
+          catalogDirty = true;
+        }
+        continue;
+      }
+      if (fileUtilHandler->isPartialFile(path)) {
+        continue;
+      }
+      // restarts the debounce time on every write to the path
+      pending[path] = due;
+    }
+  }
+}
+
+/**
+ * @brief rehashes or drops the paths whose debounce time has passed and rescans the
+ * tree after lost events once no refresh is still hashing
+*/
+void File_Watcher::processPending() {
+  if (rescanPending) {
+    size_t done, queued;
+    fileUtilHandler->getIndexProgress(done, queued);
+    // a refresh that is still hashing would have the same files queued twice
+    if (done >= queued) {
+      fileUtilHandler->refreshIndex(fileUtilHandler->getIndexPool());
+      rescanPending = false;
+    }
+  }
+  Clock::time_point now = Clock::now();
+  for (std::unordered_map<std::string, Clock::time_point>::iterator it = pending.begin();
+       it != pending.end();) {
+    if (it->second > now) {
+      ++it;
+      continue;
+    }
+    File_Entry entry;
+    if (!fileUtilHandler->statFile(it->first, entry)) {
+      if (fileUtilHandler->unindexFile(it->first) == 0) {
+        catalogDirty = true;
+      }
+    }
+    else if (!fileUtilHandler->isIndexed(it->first) &&
+             fileUtilHandler->indexFile(it->first) == 0) {
+      catalogDirty = true;
+    }
+    it = pending.erase(it);
+  }
+  if (pending.empty() && catalogDirty) {
+    fileUtilHandler->saveCatalog();
+    catalogDirty = false;
+  }
+}
+
+/**
+ * @brief loop of the watcher thread
+*/
+void File_Watcher::watchLoop() {
+  while (running) {
+    int timeout = WATCH_POLL_MS;
+    Clock::time_point now = Clock::now();
+    for (std::unordered_map<std::string, Clock::time_point>::iterator it = pending.begin();
+         it != pending.end();
+         ++it) {
+      int wait =
+          std::chrono::duration_cast<std::chrono::milliseconds>(it->second - now).count();
+      timeout = std::max(0, std::min(timeout, wait));
+    }
+    struct pollfd pfd;
+    pfd.fd = inotifyFd;
+    pfd.events = POLLIN;
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno != EINTR) {
+      logger->logError("Error polling inotify for " + directory);
+      break;
+    }
+    if (ready > 0) {
+      readEvents();
+    }
+    processPending();
+  }
+}
+
+/**
+ * @brief starts watching the directory tree on a background thread
+ * returns 0 if successful, -1 otherwise
+*/
+int File_Watcher::start() {
+  if (running) {
+    return 0;
+  }
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd < 0) {
+    logger->logError("Error initializing inotify");
+    return -1;
+  }
+  int count = addWatchRecursive(directory);
+  if (count == 0) {
+    close(inotifyFd);
+    inotifyFd = -1;
+    return -1;
+  }
+  logger->logEvent("Watching " + std::to_string(count) + " directories under " + directory);
+  running = true;
+  watchThread = std::thread(&File_Watcher::watchLoop, this);
+  return 0;
+}
+
+/**
+ * @brief stops the watcher thread
+*/
+void File_Watcher::stop() {
+  running = false;
+  if (watchThread.joinable()) {
+    watchThread.join();
+  }
+  if (inotifyFd >= 0) {
+    close(inotifyFd);
+    inotifyFd = -1;
+  }
+  watches.clear();
+}
@@ -0,0 +1,85 @@
+#ifndef FILE_WATCHER_HPP
+#define FILE_WATCHER_HPP
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "FileUtilHandler.hpp"
+
+#define WATCH_DEBOUNCE_MS 500   // quiet time before a changed file is rehashed
+#define WATCH_POLL_MS 1000      // longest wait before checking if the watcher stopped
+#define WATCH_EVENT_BUFFER 65536
+
+class File_Watcher {
+  typedef std::chrono::steady_clock Clock;
+
+  Logger * logger;
+  File_Util_Handler * fileUtilHandler;
+  std::string directory;                         // root of the watched tree
+  int inotifyFd;                                 // -1 if not started
+  std::unordered_map<int, std::string> watches;  // watch descriptor -> directory
+  std::unordered_map<std::string,                //
+                     Clock::time_point>          //
+      pending;                                   // changed path -> time to process it
+  bool catalogDirty;                             // index changed since the catalog was saved
+  bool rescanPending;                            // events were lost, the tree needs a rescan
+  std::atomic<bool> running;                     //
+  std::thread watchThread;                       //
+
+  /**
+ * @brief watches a directory and all directories below it
+ * returns the number of directories watched
+*/
+  int addWatchRecursive(std::string path);
+
+  /**
+ * @brief reads the queued inotify events and schedules the affected paths
+*/
+  void readEvents();
+
+  /**
+ * @brief rehashes or drops the paths whose debounce time has passed and rescans the
+ * tree after lost events once no refresh is still hashing
+*/
+  void processPending();
+
+  /**
+ * @brief loop of the watcher thread
+*/
+  void watchLoop();
+
+ public:
+  File_Watcher(Logger * logger, File_Util_Handler * fileUtilHandler, std::string directory) :
+      logger(logger),
+      fileUtilHandler(fileUtilHandler),
+      directory(directory),
+      inotifyFd(-1),
+      watches(),
+      pending(),
+      catalogDirty(false),
+      rescanPending(false),
+      running(false),
+      watchThread() {}
+
+  ~File_Watcher() { stop(); }
+
+  /**
+ * @brief starts watching the directory tree on a background thread
+ * returns 0 if successful, -1 otherwise
+*/
+  int start();
+
+  /**
+ * @brief stops the watcher thread
+*/
+  void stop();
+};
+
+#endif
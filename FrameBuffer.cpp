@@ -0,0 +1,64 @@
+#include "FrameBuffer.hpp"
+
+/**
+ * @brief reads whatever is available on fd into the buffer with a single recv
+ * returns the number of bytes read, 0 if the peer closed the connection,
+ * -1 on error with errno set (EAGAIN if a non-blocking fd has nothing to read)
+ * @param fd the file descriptor to read from
+*/
+ssize_t Frame_Buffer::readFrom(int fd) {
+  // move the unparsed tail to the front before reading more
+  if (start > 0) {
+    memmove(buffer.data(), buffer.data() + start, end - start);
+    end -= start;
+    start = 0;
+  }
+  if (buffer.size() - end < FRAME_READ_SIZE) {
+    buffer.resize(end + FRAME_READ_SIZE);
+  }
+  ssize_t bytes_received;
+  do {
+    bytes_received = recv(fd, buffer.data() + end, buffer.size() - end, 0);
+  } while (bytes_received < 0 && errno == EINTR);
+  if (bytes_received > 0) {
+    end += bytes_received;
+  }
+  return bytes_received;
+}
+
+/**
+ * @brief takes the next complete message out of the buffer
+ * message points into the buffer and stays valid until the next readFrom.
+ * returns 1 if a message was taken, 0 if more bytes are needed,
+ * -1 if the stream is corrupt
+ * @param type will be set to the type of the message
+ * @param message will be set to the payload of the message
+ * @param length will be set to the length of the payload
+*/
+int Frame_Buffer::nextMessage(int * type, const char ** message, int * length) {
+  if (end - start < sizeof(Message_Header)) {
+    return 0;
+  }
+  Message_Header header;
+  memcpy(&header, buffer.data() + start, sizeof(header));
+  header.type = ntohl(header.type);
+  header.length = ntohl(header.length);
+  if (header.length < 0 || header.length > MAX_MESSAGE_LENGTH) {
+    return -1;
+  }
+  if (end - start < sizeof(Message_Header) + header.length) {
+    return 0;
+  }
+  *type = header.type;
+  *length = header.length;
+  *message = buffer.data() + start + sizeof(Message_Header);
+  start += sizeof(Message_Header) + header.length;
+  return 1;
+}
+
+/**
+ * @brief returns the number of received bytes not yet taken as messages
+*/
+size_t Frame_Buffer::buffered() const {
+  return end - start;
+}
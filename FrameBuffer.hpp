@@ -0,0 +1,56 @@
+#ifndef FRAME_BUFFER_HPP
+#define FRAME_BUFFER_HPP
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <cstring>
+#include <vector>
+
+#define MAX_MESSAGE_LENGTH 65536  // longest payload accepted from a peer
+#define FRAME_READ_SIZE 65536     // bytes requested from the socket per read
+
+// header sent in front of every message, both fields in network byte order
+struct Message_Header_t {
+  int type;    // type of the message
+  int length;  // length of the payload following the header
+};
+typedef struct Message_Header_t Message_Header;
+
+// per connection receive buffer, one read can yield many messages
+class Frame_Buffer {
+  std::vector<char> buffer;  //
+  size_t start;              // offset of the first unparsed byte
+  size_t end;                // offset after the last received byte
+
+ public:
+  Frame_Buffer() : buffer(FRAME_READ_SIZE), start(0), end(0) {}
+
+  /**
+ * @brief reads whatever is available on fd into the buffer with a single recv
+ * returns the number of bytes read, 0 if the peer closed the connection,
+ * -1 on error with errno set (EAGAIN if a non-blocking fd has nothing to read)
+ * @param fd the file descriptor to read from
+*/
+  ssize_t readFrom(int fd);
+
+  /**
+ * @brief takes the next complete message out of the buffer
+ * message points into the buffer and stays valid until the next readFrom.
+ * returns 1 if a message was taken, 0 if more bytes are needed,
+ * -1 if the stream is corrupt
+ * @param type will be set to the type of the message
+ * @param message will be set to the payload of the message
+ * @param length will be set to the length of the payload
+*/
+  int nextMessage(int * type, const char ** message, int * length);
+
+  /**
+ * @brief returns the number of received bytes not yet taken as messages
+*/
+  size_t buffered() const;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "HashCatalog.hpp"
+
+#include "FileUtilHandler.hpp"
+
+/**
+ * @brief flushes a file or directory to disk
+ * returns 0 if successful, -1 otherwise
+*/
+static int syncPath(const std::string & path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  int status = fsync(fd);
+  close(fd);
+  return status;
+}
+
+/**
+ * @brief maps the catalog file and indexes its records by path
+ * returns the number of records, -1 if there is no usable catalog
+*/
+int Hash_Catalog::load() {
+  std::lock_guard<std::mutex> lock(catalogMutex);
+  if (mapping != NULL) {
+    return records.size();
+  }
+  int fd = open(catalogPath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    logger->logEvent("No hash catalog at " + catalogPath);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Catalog_Header)) {
+    close(fd);
+    logger->logError("Hash catalog " + catalogPath + " is truncated");
+    return -1;
+  }
+  void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    logger->logError("Error mapping hash catalog " + catalogPath);
+    return -1;
+  }
+  const Catalog_Header * header = (const Catalog_Header *)data;
+  size_t size = st.st_size;
+  if (memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != CATALOG_VERSION ||
+      header->stringsOffset !=
+          sizeof(Catalog_Header) + (uint64_t)header->count * sizeof(Catalog_Record) ||
+      header->stringsOffset > size) {
+    munmap(data, size);
+    logger->logError("Hash catalog " + catalogPath + " is invalid, ignoring it");
+    return -1;
+  }
+  const Catalog_Record * record =
+      (const Catalog_Record *)((const char *)data + sizeof(Catalog_Header));
+  const char * strings = (const char *)data + header->stringsOffset;
+  size_t stringsSize = size - header->stringsOffset;
+  records.reserve(header->count);
+  for (uint32_t i = 0; i < header->count; i++, record++) {
+    if (record->pathOffset > stringsSize || record->pathLength > stringsSize - record->pathOffset) {
+      continue;
+    }
+    records[std::string_view(strings + record->pathOffset, record->pathLength)] = record;
+  }
+  mapping = data;
+  mappingSize = size;
+  logger->logEvent("Loaded " + std::to_string(records.size()) + " entries from hash catalog " +
+                   catalogPath);
+  return records.size();
+}
+
+/**
+ * @brief unmaps the catalog file
+*/
+void Hash_Catalog::unload() {
+  std::lock_guard<std::mutex> lock(catalogMutex);
+  records.clear();
+  if (mapping != NULL) {
+    munmap(mapping, mappingSize);
+    mapping = NULL;
+    mappingSize = 0;
+  }
+}
+
+/**
+ * @brief looks up the record of a path in the loaded catalog
+ * returns true and fills entry if the path is in the catalog, false otherwise
+ * @param path the absolute path of the file
+ * @param entry will be set to the stored entry of the file
+*/
+bool Hash_Catalog::lookup(const std::string & path, File_Entry & entry) {
+  std::lock_guard<std::mutex> lock(catalogMutex);
+  std::unordered_map<std::string_view, const Catalog_Record *>::iterator it =
+      records.find(std::string_view(path));
+  if (it == records.end()) {
+    return false;
+  }
+  const Catalog_Record * record = it->second;
+  entry.path = path;
+  entry.hash = File_Util_Handler::digestToHex(record->hash, sizeof(record->hash));
+  entry.size = record->size;
+  entry.mtime = record->mtime;
+  entry.mtimeNsec = record->mtimeNsec;
+  entry.inode = record->inode;
+  return true;
+}
+
+/**
+ * @brief replaces the catalog file with the given entries
+ * the catalog is written to a temporary file, synced and renamed over the old one.
+ * returns 0 if successful, -1 otherwise
+ * @param entries the entries to store
+*/
+int Hash_Catalog::save(const std::vector<File_Entry> & entries) {
+  try {
+    std::vector<Catalog_Record> recordList;
+    std::string strings;
+    recordList.reserve(entries.size());
+    for (const File_Entry & entry : entries) {
+      Catalog_Record record;
+      memset(&record, 0, sizeof(record));
+      if (entry.hash.length() != 2 * sizeof(record.hash) ||
+          !File_Util_Handler::hexToDigest(entry.hash, record.hash)) {
+        continue;
+      }
+      record.size = entry.size;
+      record.mtime = entry.mtime;
+      record.mtimeNsec = entry.mtimeNsec;
+      record.inode = entry.inode;
+      record.pathOffset = strings.size();
+      record.pathLength = entry.path.size();
+      strings += entry.path;
+      recordList.push_back(record);
+    }
+    Catalog_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+    header.version = CATALOG_VERSION;
+    header.count = recordList.size();
+    header.stringsOffset = sizeof(Catalog_Header) + recordList.size() * sizeof(Catalog_Record);
+
+    std::lock_guard<std::mutex> lock(catalogMutex);
+    std::string tmpPath = catalogPath + ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      logger->logError("Error opening hash catalog " + tmpPath);
+      return -1;
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)recordList.data(), recordList.size() * sizeof(Catalog_Record));
+    file.write(strings.data(), strings.size());
+    file.close();
+    // the records reach the disk before the rename, the rename before save returns
+    if (file.fail() || syncPath(tmpPath) < 0 ||
+        rename(tmpPath.c_str(), catalogPath.c_str()) < 0) {
+      unlink(tmpPath.c_str());
+      logger->logError("Error writing hash catalog " + catalogPath);
+      return -1;
+    }
+    size_t lastSlash = catalogPath.find_last_of('/');
+    std::string directory = lastSlash == std::string::npos
+                                ? "."
+                                : catalogPath.substr(0, std::max(lastSlash, (size_t)1));
+    if (syncPath(directory) < 0) {
+      logger->logError("Error syncing the directory of hash catalog " + catalogPath);
+    }
+    logger->logEvent("Saved " + std::to_string(recordList.size()) +
+                     " entries to hash catalog " + catalogPath);
+    return 0;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error saving hash catalog " + catalogPath + ": " +
+                     std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * @brief returns the path of the catalog file
+*/
+std::string Hash_Catalog::getPath() {
+  return catalogPath;
+}
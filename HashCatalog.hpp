@@ -0,0 +1,100 @@
+#ifndef HASH_CATALOG_HPP
+#define HASH_CATALOG_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "FileIndex.hpp"
+#include "Logger.hpp"
+
+#define CATALOG_MAGIC "GNUTCAT"  // first bytes of a catalog file
+#define CATALOG_VERSION 1        // bumped whenever the record layout changes
+
+// header at the start of a catalog file
+struct Catalog_Header_t {
+  char magic[8];           // CATALOG_MAGIC
+  uint32_t version;        // CATALOG_VERSION
+  uint32_t count;          // number of records following the header
+  uint64_t stringsOffset;  // offset of the path blob from the start of the file
+};
+typedef struct Catalog_Header_t Catalog_Header;
+
+// fixed size record of one hashed file, paths live in the blob after the records
+struct Catalog_Record_t {
+  uint64_t size;          // size of the file
+  int64_t mtime;          // modification time, seconds
+  int64_t mtimeNsec;      // modification time, nanoseconds
+  uint64_t inode;         // inode of the file
+  uint64_t pathOffset;    // offset of the path in the path blob
+  uint32_t pathLength;    // length of the path
+  uint32_t reserved;      //
+  unsigned char hash[32]; // sha256 of the file
+};
+typedef struct Catalog_Record_t Catalog_Record;
+
+class Hash_Catalog {
+  Logger * logger;
+  std::string catalogPath;                       // path of the catalog file
+  void * mapping;                                // the mapped catalog, NULL if not loaded
+  size_t mappingSize;                            // size of mapping
+  std::unordered_map<std::string_view,           //
+                     const Catalog_Record *>     //
+      records;                                   // path -> record inside mapping
+  std::mutex catalogMutex;                       // mutex for mapping and records
+
+ public:
+  Hash_Catalog(Logger * logger, std::string catalogPath) :
+      logger(logger),
+      catalogPath(catalogPath),
+      mapping(NULL),
+      mappingSize(0),
+      records(),
+      catalogMutex() {}
+
+  ~Hash_Catalog() { unload(); }
+
+  /**
+ * @brief maps the catalog file and indexes its records by path
+ * returns the number of records, -1 if there is no usable catalog
+*/
+  int load();
+
+  /**
+ * @brief unmaps the catalog file
+*/
+  void unload();
+
+  /**
+ * @brief looks up the record of a path in the loaded catalog
+ * returns true and fills entry if the path is in the catalog, false otherwise
+ * @param path the absolute path of the file
+ * @param entry will be set to the stored entry of the file
+*/
+  bool lookup(const std::string & path, File_Entry & entry);
+
+  /**
+ * @brief replaces the catalog file with the given entries
+ * the catalog is written to a temporary file, synced and renamed over the old one.
+ * returns 0 if successful, -1 otherwise
+ * @param entries the entries to store
+*/
+  int save(const std::vector<File_Entry> & entries);
+
+  /**
+ * @brief returns the path of the catalog file
+*/
+  std::string getPath();
+};
+
+#endif
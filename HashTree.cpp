@@ -0,0 +1,221 @@
+#include "HashTree.hpp"
+
+/**
+ * @brief returns the number of leaves of a file, an empty file has one empty leaf
+*/
+static size_t leavesFor(uint64_t fileSize, uint32_t leafSize) {
+  if (fileSize == 0) {
+    return 1;
+  }
+  return (fileSize + leafSize - 1) / leafSize;
+}
+
+/**
+ * @brief hashes the content of one leaf
+ * @param data the content of the leaf
+ * @param length the length of data
+ * @param digest will be set to the 32 byte leaf hash
+*/
+void Hash_Tree::hashLeaf(const char * data, size_t length, unsigned char * digest) {
+  const unsigned char prefix = 0x00;
+  EVP_MD_CTX * mdctx = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(mdctx, EVP_sha256(), NULL);
+  EVP_DigestUpdate(mdctx, &prefix, 1);
+  EVP_DigestUpdate(mdctx, data, length);
+  EVP_DigestFinal_ex(mdctx, digest, NULL);
+  EVP_MD_CTX_free(mdctx);
+}
+
+/**
+ * @brief computes root from leaves
+*/
+void Hash_Tree::computeRoot() {
+  std::vector<unsigned char> level = leaves;
+  unsigned char node[65];
+  node[0] = 0x01;
+  while (level.size() > 32) {
+    std::vector<unsigned char> next;
+    for (size_t i = 0; i < level.size(); i += 64) {
+      if (i + 32 == level.size()) {
+        next.insert(next.end(), level.begin() + i, level.end());
+        break;
+      }
+      memcpy(node + 1, level.data() + i, 64);
+      unsigned char digest[32];
+      EVP_Digest(node, sizeof(node), digest, NULL, EVP_sha256(), NULL);
+      next.insert(next.end(), digest, digest + 32);
+    }
+    level.swap(next);
+  }
+  memcpy(root, level.data(), sizeof(root));
+}
+
+/**
+ * @brief hashes the leaves of a file
+ * returns 0 if successful, -1 otherwise
+ * @param filePath the absolute path to the file
+ * @param leafSize bytes covered by each leaf
+*/
+int Hash_Tree::build(const std::string & filePath, uint32_t leafSize) {
+  int fd = open(filePath.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  std::vector<char> buffer(leafSize);
+  std::vector<unsigned char> hashes;
+  uint64_t size = 0;
+  while (true) {
+    size_t filled = 0;
+    while (filled < leafSize) {
+      ssize_t bytes_read = read(fd, buffer.data() + filled, leafSize - filled);
+      if (bytes_read < 0 && errno == EINTR) {
+        continue;
+      }
+      if (bytes_read < 0) {
+        close(fd);
+        return -1;
+      }
+      if (bytes_read == 0) {
+        break;
+      }
+      filled += bytes_read;
+    }
+    if (filled == 0 && size > 0) {
+      break;
+    }
+    unsigned char digest[32];
+    hashLeaf(buffer.data(), filled, digest);
+    hashes.insert(hashes.end(), digest, digest + 32);
+    size += filled;
+    if (filled < leafSize) {
+      break;
+    }
+  }
+  close(fd);
+  this->leafSize = leafSize;
+  fileSize = size;
+  leaves.swap(hashes);
+  computeRoot();
+  return 0;
+}
+
+/**
+ * @brief sets the leaves received from a peer
+ * returns true if the leaves fit the file size and hash to expectedRoot
+ * @param leafSize bytes covered by each leaf
+ * @param fileSize size of the file
+ * @param leaves 32 bytes per leaf
+ * @param expectedRoot the root announced with the leaves
+*/
+bool Hash_Tree::setLeaves(uint32_t leafSize,
+                          uint64_t fileSize,
+                          const std::vector<unsigned char> & leaves,
+                          const unsigned char * expectedRoot) {
+  if (leafSize == 0 || leaves.size() != 32 * leavesFor(fileSize, leafSize)) {
+    return false;
+  }
+  this->leafSize = leafSize;
+  this->fileSize = fileSize;
+  this->leaves = leaves;
+  computeRoot();
+  return memcmp(root, expectedRoot, sizeof(root)) == 0;
+}
+
+/**
+ * @brief writes the tree to a file, stamped with the entry it was built from
+ * the tree is written to a temporary file and renamed over the old one.
+ * returns 0 if successful, -1 otherwise
+ * @param treePath the path of the saved tree
+ * @param entry the entry of the file the tree is of
+*/
+int Hash_Tree::save(const std::string & treePath, const File_Entry & entry) const {
+  Hash_Tree_Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, HASH_TREE_MAGIC, sizeof(header.magic));
+  memcpy(header.root, root, sizeof(header.root));
+  header.fileSize = fileSize;
+  header.mtime = entry.mtime;
+  header.mtimeNsec = entry.mtimeNsec;
+  header.inode = entry.inode;
+  header.leafSize = leafSize;
+  header.leafCount = leafCount();
+  std::string tmpPath = treePath + ".tmp";
+  std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return -1;
+  }
+  file.write((const char *)&header, sizeof(header));
+  file.write((const char *)leaves.data(), leaves.size());
+  file.close();
+  if (file.fail() || rename(tmpPath.c_str(), treePath.c_str()) < 0) {
+    unlink(tmpPath.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief reads a tree saved by save
+ * returns 0 if the saved tree is of the file as the entry describes it now,
+ * with the given leaf size, -1 otherwise
+ * @param treePath the path of the saved tree
+ * @param entry the current entry of the file
+ * @param leafSize bytes covered by each leaf
+*/
+int Hash_Tree::load(const std::string & treePath, const File_Entry & entry, uint32_t leafSize) {
+  std::ifstream file(treePath, std::ios::binary);
+  Hash_Tree_Header header;
+  if (!file.read((char *)&header, sizeof(header)) ||
+      memcmp(header.magic, HASH_TREE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.leafSize != leafSize || header.fileSize != entry.size ||
+      header.mtime != entry.mtime || header.mtimeNsec != entry.mtimeNsec ||
+      header.inode != entry.inode || header.leafCount != leavesFor(header.fileSize, leafSize)) {
+    return -1;
+  }
+  std::vector<unsigned char> saved(32 * (size_t)header.leafCount);
+  if (!file.read((char *)saved.data(), saved.size()) ||
+      !setLeaves(header.leafSize, header.fileSize, saved, header.root)) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief checks data against the hash of a leaf
+ * returns true if data is the content of the leaf
+ * @param index the index of the leaf
+ * @param data the content received for the leaf
+ * @param length the length of data
+*/
+bool Hash_Tree::verifyLeaf(size_t index, const char * data, size_t length) const {
+  if (index >= leafCount()) {
+    return false;
+  }
+  unsigned char digest[32];
+  hashLeaf(data, length, digest);
+  return memcmp(digest, leaves.data() + 32 * index, 32) == 0;
+}
+
+/**
+ * @brief returns the number of leaves
+*/
+size_t Hash_Tree::leafCount() const {
+  return leaves.size() / 32;
+}
+
+uint32_t Hash_Tree::getLeafSize() const {
+  return leafSize;
+}
+
+uint64_t Hash_Tree::getFileSize() const {
+  return fileSize;
+}
+
+const std::vector<unsigned char> & Hash_Tree::getLeaves() const {
+  return leaves;
+}
+
+const unsigned char * Hash_Tree::getRoot() const {
+  return root;
+}
@@ -0,0 +1,119 @@
+#ifndef HASH_TREE_HPP
+#define HASH_TREE_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "FileIndex.hpp"
+
+#define HASH_TREE_MIN_LEAF_SIZE (1 << 16)  // smallest leaf size served to peers
+#define HASH_TREE_MAX_LEAF_SIZE (1 << 24)  // largest leaf size served to peers
+#define HASH_TREE_MAGIC "GNUTTRE"          // first bytes of a saved tree
+
+// header of a saved tree, followed by the leaves
+struct Hash_Tree_Header_t {
+  char magic[8];           // HASH_TREE_MAGIC
+  unsigned char root[32];  // root of the leaves
+  uint64_t fileSize;       // size of the file
+  int64_t mtime;           // modification time of the file, seconds
+  int64_t mtimeNsec;       // modification time of the file, nanoseconds
+  uint64_t inode;          // inode of the file
+  uint32_t leafSize;       // bytes covered by each leaf
+  uint32_t leafCount;      // number of leaves following the header
+};
+typedef struct Hash_Tree_Header_t Hash_Tree_Header;
+
+// THEX style merkle tree over fixed size leaves of a file.
+// leaves are sha256(0x00 || data), inner nodes sha256(0x01 || left || right),
+// a node without a sibling is promoted to the next level unchanged
+class Hash_Tree {
+  uint32_t leafSize;                  // bytes covered by each leaf
+  uint64_t fileSize;                  // size of the file
+  std::vector<unsigned char> leaves;  // 32 bytes per leaf
+  unsigned char root[32];             //
+
+  /**
+ * @brief computes root from leaves
+*/
+  void computeRoot();
+
+ public:
+  Hash_Tree() : leafSize(0), fileSize(0), leaves() { memset(root, 0, sizeof(root)); }
+
+  /**
+ * @brief hashes the leaves of a file
+ * returns 0 if successful, -1 otherwise
+ * @param filePath the absolute path to the file
+ * @param leafSize bytes covered by each leaf
+*/
+  int build(const std::string & filePath, uint32_t leafSize);
+
+  /**
+ * @brief sets the leaves received from a peer
+ * returns true if the leaves fit the file size and hash to expectedRoot
+ * @param leafSize bytes covered by each leaf
+ * @param fileSize size of the file
+ * @param leaves 32 bytes per leaf
+ * @param expectedRoot the root announced with the leaves
+*/
+  bool setLeaves(uint32_t leafSize,
+                 uint64_t fileSize,
+                 const std::vector<unsigned char> & leaves,
+                 const unsigned char * expectedRoot);
+
+  /**
+ * @brief writes the tree to a file, stamped with the entry it was built from
+ * the tree is written to a temporary file and renamed over the old one.
+ * returns 0 if successful, -1 otherwise
+ * @param treePath the path of the saved tree
+ * @param entry the entry of the file the tree is of
+*/
+  int save(const std::string & treePath, const File_Entry & entry) const;
+
+  /**
+ * @brief reads a tree saved by save
+ * returns 0 if the saved tree is of the file as the entry describes it now,
+ * with the given leaf size, -1 otherwise
+ * @param treePath the path of the saved tree
+ * @param entry the current entry of the file
+ * @param leafSize bytes covered by each leaf
+*/
+  int load(const std::string & treePath, const File_Entry & entry, uint32_t leafSize);
+
+  /**
+ * @brief checks data against the hash of a leaf
+ * returns true if data is the content of the leaf
+ * @param index the index of the leaf
+ * @param data the content received for the leaf
+ * @param length the length of data
+*/
+  bool verifyLeaf(size_t index, const char * data, size_t length) const;
+
+  /**
+ * @brief hashes the content of one leaf
+ * @param data the content of the leaf
+ * @param length the length of data
+ * @param digest will be set to the 32 byte leaf hash
+*/
+  static void hashLeaf(const char * data, size_t length, unsigned char * digest);
+
+  /**
+ * @brief returns the number of leaves
+*/
+  size_t leafCount() const;
+
+  uint32_t getLeafSize() const;
+  uint64_t getFileSize() const;
+  const std::vector<unsigned char> & getLeaves() const;
+  const unsigned char * getRoot() const;
+};
+
+#endif
@@ -1,33 +1,250 @@
 #include "Logger.hpp"
 
+// record labels by level, EVENT and ERROR match the format of older logs
+static const char * const levelNames[] = {"DEBUG", "EVENT", "ERROR"};
+
+/**
+ * @brief opens the log file and starts the writer thread
+ * returns true if successful, false otherwise
+*/
 bool Logger::init() {
-  logFile.open(logFilePath, std::ios::out | std::ios::app);
-  if (!logFile.is_open()) {
+  if (running) {
+    return true;
+  }
+  logFd = open(logFilePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (logFd < 0) {
     return false;
   }
+  ring.reset(new Log_Record[ringSize]);
+  for (size_t i = 0; i < ringSize; i++) {
+    ring[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  enqueuePos = 0;
+  dequeuePos = 0;
+  dropped = 0;
+  running = true;
+  writerThread = std::thread(&Logger::writerLoop, this);
   return true;
 }
 
-bool Logger::log(std::string message, std::string type) {
-  try {
-    if (!logFile.is_open()) {
-      return false;
+
+/**
+ * @brief claims the slot of the next ring position
+ * returns the slot, nullptr if the ring is full
+ * @param pos will be set to the claimed position
+*/
+Log_Record * Logger::claim(size_t & pos) {
+  pos = enqueuePos.load(std::memory_order_relaxed);
+  while (true) {
+    Log_Record * record = &ring[pos & ringMask];
+    size_t sequence = record->sequence.load(std::memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+    if (diff == 0) {
+      // the slot is free for this position, claim it
+      if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        return record;
+      }
     }
-    int timestamp = time(NULL);
-    logFile << "[" << type << "] "
-            << "[" << timestamp << "] " << message << std::endl;
-    return true;
+    else if (diff < 0) {
+      // the writer has not read the record a lap ago yet
+      return nullptr;
+    }
+    else {
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * @brief hands a filled slot to the writer thread
+*/
+void Logger::publish(Log_Record * record, size_t pos) {
+  record->sequence.store(pos + 1, std::memory_order_release);
+  // wake the writer early once half the ring is used, exactly one producer sees this
+  if (pos - dequeuePos.load(std::memory_order_relaxed) == ringSize / 2) {
+    wakeCond.notify_one();
   }
-  catch (std::exception e) {
-    std::cerr << "Exception in logging: " << e.what() << std::endl;
+}
+
+/**
+ * @brief claims a slot, waiting for room or dropping as configured
+ * returns the slot, nullptr if the record is dropped
+*/
+Log_Record * Logger::acquire(size_t & pos) {
+  if (!running) {
+    return nullptr;
+  }
+  Log_Record * record;
+  while ((record = claim(pos)) == nullptr) {
+    if (!blockWhenFull) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    wakeCond.notify_one();
+    std::this_thread::sleep_for(std::chrono::microseconds(LOG_FULL_WAIT_US));
+    if (!running) {
+      return nullptr;
+    }
+  }
+  return record;
+}
+
+/**
+ * @brief parses a level name of the config file
+ * returns the LOG_LEVEL_* value, -1 if name is not debug, event, error or none
+*/
+int Logger::parseLevel(const std::string & name) {
+  if (name == "debug") {
+    return LOG_LEVEL_DEBUG;
+  }
+  else if (name == "event") {
+    return LOG_LEVEL_EVENT;
+  }
+  else if (name == "error") {
+    return LOG_LEVEL_ERROR;
+  }
+  else if (name == "none") {
+    return LOG_LEVEL_NONE;
+  }
+  return -1;
+}
+
+/**
+ * @brief queues a record for the writer thread
+ * returns true if queued, false if the level is disabled, the logger is not
+ * running or the record was dropped
+ * @param level the LOG_LEVEL_* of the record
+ * @param message the message, cut to LOG_RECORD_LENGTH bytes
+*/
+bool Logger::log(int level, const std::string & message) {
+  size_t pos;
+  Log_Record * record;
+  if (!enabled(level) || (record = acquire(pos)) == nullptr) {
     return false;
   }
+  record->timestamp = time(NULL);
+  record->level = level;
+  record->length = std::min(message.size(), (size_t)LOG_RECORD_LENGTH);
+  memcpy(record->message, message.data(), record->length);
+  publish(record, pos);
+  return true;
+}
+
+/**
+ * @brief formats a printf style message straight into the ring, nothing is allocated
+ * returns true if queued, false otherwise, callers use the LOG_* macros instead
+ * @param level the LOG_LEVEL_* of the record
+ * @param format the printf format of the message
+*/
+bool Logger::logf(int level, const char * format, ...) {
+  size_t pos;
+  Log_Record * record;
+  if (!enabled(level) || (record = acquire(pos)) == nullptr) {
+    return false;
+  }
+  record->timestamp = time(NULL);
+  record->level = level;
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(record->message, LOG_RECORD_LENGTH, format, args);
+  va_end(args);
+  // vsnprintf keeps room for its terminator, which the writer does not need
+  record->length = length < 0 ? 0 : std::min((size_t)length, (size_t)LOG_RECORD_LENGTH - 1);
+  publish(record, pos);
+  return true;
+}
+
+
+/**
+ * @brief moves the records in the ring into batch, writing whenever it grows large
+ * returns the number of records taken
+*/
+size_t Logger::drain(std::string & batch) {
+  size_t count = 0;
+  size_t pos = dequeuePos.load(std::memory_order_relaxed);
+  while (true) {
+    Log_Record & record = ring[pos & ringMask];
+    if (record.sequence.load(std::memory_order_acquire) != pos + 1) {
+      // empty, or the producer of this slot is still copying
+      break;
+    }
+    batch += "[";
+    batch += levelNames[record.level];
+    batch += "] [";
+    batch += std::to_string(record.timestamp);
+    batch += "] ";
+    batch.append(record.message, record.length);
+    batch += "\n";
+    record.sequence.store(pos + ringSize, std::memory_order_release);
+    pos++;
+    dequeuePos.store(pos, std::memory_order_relaxed);
+    count++;
+    if (batch.size() >= LOG_BATCH_BYTES) {
+      writeBatch(batch);
+    }
+  }
+  size_t lost = dropped.exchange(0, std::memory_order_relaxed);
+  if (lost > 0) {
+    batch += "[ERROR] [" + std::to_string(time(NULL)) + "] Log ring full, dropped " +
+             std::to_string(lost) + " records\n";
+  }
+  return count;
+}
+
+/**
+ * @brief writes the whole batch to the log file and clears it
+*/
+void Logger::writeBatch(std::string & batch) {
+  size_t offset = 0;
+  while (offset < batch.size()) {
+    ssize_t written = write(logFd, batch.data() + offset, batch.size() - offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Exception in logging: " << strerror(errno) << std::endl;
+      break;
+    }
+    offset += written;
+  }
+  batch.clear();
 }
 
-bool Logger::logEvent(std::string event) {
-  return log(event, "EVENT");
+/**
+ * @brief loop of the writer thread
+*/
+void Logger::writerLoop() {
+  std::string batch;
+  batch.reserve(LOG_BATCH_BYTES + LOG_RECORD_LENGTH + 64);
+  while (running) {
+    {
+      std::unique_lock<std::mutex> lock(wakeMutex);
+      wakeCond.wait_for(lock, std::chrono::milliseconds(flushIntervalMs));
+    }
+    drain(batch);
+    if (!batch.empty()) {
+      writeBatch(batch);
+    }
+  }
+  // records queued before stop
+  drain(batch);
+  if (!batch.empty()) {
+    writeBatch(batch);
+  }
 }
 
-bool Logger::logError(std::string error) {
-  return log(error, "ERROR");
+/**
+ * @brief writes the queued records and stops the writer thread
+*/
+void Logger::stop() {
+  if (running.exchange(false)) {
+    wakeCond.notify_one();
+  }
+  if (writerThread.joinable()) {
+    writerThread.join();
+  }
+  if (logFd >= 0) {
+    close(logFd);
+    logFd = -1;
+  }
 }
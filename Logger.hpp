@@ -1,22 +1,200 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+
+#define LOG_LEVEL_DEBUG 0  // per message tracing
+#define LOG_LEVEL_EVENT 1  // node events
+#define LOG_LEVEL_ERROR 2  // failures
+#define LOG_LEVEL_NONE 3   // nothing is logged
+
+// log calls below this level are compiled out, builds set it with -DLOG_COMPILE_LEVEL=1
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SIZE 8192          // records the ring holds, rounded up to a power of two
+#define LOG_RECORD_LENGTH 480       // longest message kept, longer messages are cut
+#define LOG_FLUSH_INTERVAL_MS 200   // longest time a record waits before it is written
+#define LOG_BATCH_BYTES 65536       // bytes gathered before a write
+#define LOG_FULL_WAIT_US 50         // sleep of a blocked producer between retries
+
+// logs a printf style message if level is enabled, the arguments are not
+// evaluated and nothing is formatted below the runtime threshold, and the call
+// is removed entirely below LOG_COMPILE_LEVEL
+#define LOG_AT(logger, level, ...)                                  \
+  do {                                                              \
+    if ((level) >= LOG_COMPILE_LEVEL && (logger)->enabled(level)) { \
+      (logger)->logf((level), __VA_ARGS__);                         \
+    }                                                               \
+  } while (0)
+#define LOG_DEBUG(logger, ...) LOG_AT(logger, LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_EVENT(logger, ...) LOG_AT(logger, LOG_LEVEL_EVENT, __VA_ARGS__)
+#define LOG_ERROR(logger, ...) LOG_AT(logger, LOG_LEVEL_ERROR, __VA_ARGS__)
 
+// a log record waiting in the ring
+struct Log_Record_t {
+  std::atomic<size_t> sequence;     // ring position the slot is ready for
+  time_t timestamp;                 // seconds since epoch when logged
+  int level;                        // LOG_LEVEL_* of the record
+  size_t length;                    // bytes used in message
+  char message[LOG_RECORD_LENGTH];  //
+};
+typedef struct Log_Record_t Log_Record;
+
+// asynchronous logger shared by all node threads.
+// producers claim a slot of a bounded ring with one compare and swap and never
+// take a lock or make a syscall, a writer thread drains the ring every flush
+// interval (or sooner when it fills up) and writes the records in large batches.
+// when the ring is full a record is dropped and counted, or the producer waits
+// for room if the logger was made blocking
 class Logger {
   std::string logFilePath;
-  std::fstream logFile;
+  int logFd;                            // -1 if not open
+  size_t ringSize;                      // a power of two
+  size_t ringMask;                      // ringSize - 1
+  std::unique_ptr<Log_Record[]> ring;   // allocated by init
+  std::atomic<size_t> enqueuePos;       // next position claimed by a producer
+  std::atomic<size_t> dequeuePos;       // next position read by the writer
+  int flushIntervalMs;                  // longest wait of the writer
+  bool blockWhenFull;                   // wait for room instead of dropping
+  std::atomic<size_t> dropped;          // records dropped since the last report
+  std::atomic<int> level;               // records below this level are ignored
+  std::atomic<bool> running;            //
+  std::mutex wakeMutex;                 // only used to sleep the writer
+  std::condition_variable wakeCond;     // signalled when the ring fills up or on stop
+  std::thread writerThread;             //
+
+  /**
+ * @brief claims the slot of the next ring position
+ * returns the slot, nullptr if the ring is full
+ * @param pos will be set to the claimed position
+*/
+  Log_Record * claim(size_t & pos);
+
+  /**
+ * @brief hands a filled slot to the writer thread
+*/
+  void publish(Log_Record * record, size_t pos);
+
+  /**
+ * @brief claims a slot, waiting for room or dropping as configured
+ * returns the slot, nullptr if the record is dropped
+*/
+  Log_Record * acquire(size_t & pos);
+
+  /**
+ * @brief moves the records in the ring into batch, writing whenever it grows large
+ * returns the number of records taken
+*/
+  size_t drain(std::string & batch);
+
+  /**
+ * @brief writes the whole batch to the log file and clears it
+*/
+  void writeBatch(std::string & batch);
+
+  /**
+ * @brief loop of the writer thread
+*/
+  void writerLoop();
 
  public:
-  Logger() : logFilePath("./log.txt"), logFile() {}
-  Logger(std::string logFilePath) : logFilePath(logFilePath), logFile() {}
+  Logger() : Logger("./log.txt") {}
+  Logger(std::string logFilePath) :
+      Logger(logFilePath, LOG_RING_SIZE, LOG_FLUSH_INTERVAL_MS, false) {}
+  Logger(std::string logFilePath, size_t ringSize, int flushIntervalMs, bool blockWhenFull) :
+      logFilePath(logFilePath),
+      logFd(-1),
+      ringSize(0),
+      ringMask(0),
+      ring(),
+      enqueuePos(0),
+      dequeuePos(0),
+      flushIntervalMs(flushIntervalMs > 0 ? flushIntervalMs : LOG_FLUSH_INTERVAL_MS),
+      blockWhenFull(blockWhenFull),
+      dropped(0),
+      level(LOG_LEVEL_EVENT),
+      running(false),
+      wakeMutex(),
+      wakeCond(),
+      writerThread() {
+    size_t size = 2;
+    while (size < ringSize) {
+      size <<= 1;
+    }
+    this->ringSize = size;
+    ringMask = size - 1;
+  }
+
+  /**
+ * @brief opens the log file and starts the writer thread
+ * returns true if successful, false otherwise
+*/
   bool init();
-  bool log(std::string message, std::string type);
-  bool logEvent(std::string event);
-  bool logError(std::string error);
 
-  ~Logger() {
-    if (logFile.is_open()) {
-      logFile.close();
-    }
+  /**
+ * @brief parses a level name of the config file
+ * returns the LOG_LEVEL_* value, -1 if name is not debug, event, error or none
+*/
+  static int parseLevel(const std::string & name);
+
+  /**
+ * @brief sets the runtime threshold, records below level are ignored
+*/
+  void setLevel(int level) { this->level.store(level, std::memory_order_relaxed); }
+
+  /**
+ * @brief checks if records of a level are logged, LOG_LEVEL_NONE and above never are
+*/
+  bool enabled(int level) const {
+    return level >= LOG_COMPILE_LEVEL && level < LOG_LEVEL_NONE &&
+           level >= this->level.load(std::memory_order_relaxed);
   }
-};
\ No newline at end of file
+
+  /**
+ * @brief queues a record for the writer thread
+ * returns true if queued, false if the level is disabled, the logger is not
+ * running or the record was dropped
+ * @param level the LOG_LEVEL_* of the record
+ * @param message the message, cut to LOG_RECORD_LENGTH bytes
+*/
+  bool log(int level, const std::string & message);
+  bool logDebug(const std::string & message) { return log(LOG_LEVEL_DEBUG, message); }
+  bool logEvent(const std::string & event) { return log(LOG_LEVEL_EVENT, event); }
+  bool logError(const std::string & error) { return log(LOG_LEVEL_ERROR, error); }
+
+  /**
+ * @brief formats a printf style message straight into the ring, nothing is allocated
+ * returns true if queued, false otherwise, callers use the LOG_* macros instead
+ * @param level the LOG_LEVEL_* of the record
+ * @param format the printf format of the message
+*/
+  bool logf(int level, const char * format, ...) __attribute__((format(printf, 3, 4)));
+
+  /**
+ * @brief writes the queued records and stops the writer thread
+*/
+  void stop();
+
+  ~Logger() { stop(); }
+};
+
+#endif
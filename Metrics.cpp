@@ -0,0 +1,270 @@
+#include "Metrics.hpp"
+
+std::mutex Metrics_Registry::shardsMutex;
+std::vector<Metrics_Shard *> Metrics_Registry::shards;
+Metrics_Shard * Metrics_Registry::retired = new Metrics_Shard();
+
+// retires the shard of a thread when the thread exits
+struct Metrics_Thread_t {
+  Metrics_Shard * shard;  // nullptr until the thread records something
+
+  ~Metrics_Thread_t() {
+    if (shard != nullptr) {
+      Metrics_Registry::retire(shard);
+    }
+  }
+};
+typedef struct Metrics_Thread_t Metrics_Thread;
+
+static thread_local Metrics_Thread metricsThread = {nullptr};
+
+// name and help text of a counter in the prometheus output
+struct Metric_Name_t {
+  const char * name;  //
+  const char * help;  //
+};
+typedef struct Metric_Name_t Metric_Name;
+
+static const Metric_Name counterNames[METRIC_COUNTERS] = {
+    {"gnutella_queries_sent_total", "Queries started by this node."},
+    {"gnutella_query_hits_total", "Query hits received for queries started by this node."},
+    {"gnutella_queries_received_total", "Queries received from peers."},
+    {"gnutella_query_cache_duplicates_total", "Received queries found in the query cache."},
+    {"gnutella_queries_answered_total", "Received queries for files shared by this node."},
+    {"gnutella_searches_received_total", "Name searches received from peers."},
+    {"gnutella_search_cache_duplicates_total", "Received searches found in the search cache."},
+    {"gnutella_files_hashed_total", "Shared files hashed."},
+    {"gnutella_hashed_bytes_total", "Bytes of shared files hashed."},
+    {"gnutella_uploaded_bytes_total", "File bytes served to peers."},
+    {"gnutella_downloaded_bytes_total", "Verified file bytes downloaded from peers."},
+    {"gnutella_corrupt_chunks_total", "Downloaded chunks that failed verification."},
+    {"gnutella_dropped_messages_total", "Malformed or unknown peer messages dropped."},
+    {"gnutella_sessions_agreed_total", "Transfer sessions agreed with a key exchange."},
+    {"gnutella_sessions_resumed_total", "Transfer sessions resumed without a key exchange."},
+    {"gnutella_file_connections_opened_total", "File connections opened to peers."},
+    {"gnutella_file_connections_reused_total", "Idle file connections reused from the pool."},
+    {"gnutella_messages_shed_total", "Outbound messages dropped from full peer queues."},
+    {"gnutella_pong_cache_refreshes_total", "Rebuilds of the cached pongs."},
+    {"gnutella_pongs_cached_total", "Pings answered with a cached pong."},
+    {"gnutella_messages_refused_total", "Inbound messages dropped from a full handling queue."},
+};
+
+static const Metric_Name histogramNames[METRIC_HISTOGRAMS] = {
+    {"gnutella_message_handling_seconds", "Time to handle one peer message."},
+    {"gnutella_file_hashing_seconds", "Time to hash one shared file."},
+    {"gnutella_upload_seconds", "Time to serve one requested file range."},
+    {"gnutella_chunk_download_seconds", "Time to download and verify one chunk."},
+};
+
+// message types in the prometheus output, other types are summed as "other"
+static const std::pair<int, const char *> messageTypes[] = {
+    {T_PING, "ping"},
+    {T_PONG, "pong"},
+    {T_QUERY, "query"},
+    {T_QUERY_HIT, "query_hit"},
+    {T_ROUTE_PATCH, "route_patch"},
+    {T_ROUTE_RESET, "route_reset"},
+    {T_FILE_RANGE, "file_range"},
+    {T_HASH_TREE, "hash_tree"},
+    {T_NAME_SEARCH, "name_search"},
+    {T_NAME_SEARCH_HIT, "name_search_hit"},
+};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+/**
+ * @brief returns the shard of the calling thread, created on first use
+*/
+Metrics_Shard & Metrics_Registry::local() {
+  if (metricsThread.shard == nullptr) {
+    Metrics_Shard * shard = new Metrics_Shard();
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    shards.push_back(shard);
+    metricsThread.shard = shard;
+  }
+  return *metricsThread.shard;
+}
+
+/**
+ * @brief adds every value of from into to
+*/
+void Metrics_Registry::merge(Metrics_Shard & to, const Metrics_Shard & from) {
+  for (int i = 0; i < METRIC_COUNTERS; i++) {
+    to.counters[i].fetch_add(from.counters[i].load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+  }
+  for (int i = 0; i < METRICS_MAX_TYPE; i++) {
+    to.messagesIn[i].fetch_add(from.messagesIn[i].load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+    to.messagesOut[i].fetch_add(from.messagesOut[i].load(std::memory_order_relaxed),
+                                std::memory_order_relaxed);
+  }
+  for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+      to.buckets[h][b].fetch_add(from.buckets[h][b].load(std::memory_order_relaxed),
+                                 std::memory_order_relaxed);
+    }
+    to.sums[h].fetch_add(from.sums[h].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief adds the shard of an exiting thread to retired and frees it
+*/
+void Metrics_Registry::retire(Metrics_Shard * shard) {
+  {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    merge(*retired, *shard);
+    for (size_t i = 0; i < shards.size(); i++) {
+      if (shards[i] == shard) {
+        shards[i] = shards.back();
+        shards.pop_back();
+        break;
+      }
+    }
+  }
+  delete shard;
+}
+
+/**
+ * @brief returns the histogram bucket of a value
+*/
+int Metrics_Registry::bucketOf(uint64_t value) {
+  if (value < (1ULL << METRICS_SUB_BITS)) {
+    return value;
+  }
+  int exponent = 63 - __builtin_clzll(value);
+  int shift = exponent - METRICS_SUB_BITS;
+  int sub = (value >> shift) & ((1 << METRICS_SUB_BITS) - 1);
+  return ((shift + 1) << METRICS_SUB_BITS) + sub;
+}
+
+/**
+ * @brief returns the largest value that falls in a bucket
+*/
+uint64_t Metrics_Registry::bucketUpperBound(int bucket) {
+  if (bucket < (1 << METRICS_SUB_BITS)) {
+    return bucket;
+  }
+  int shift = (bucket >> METRICS_SUB_BITS) - 1;
+  uint64_t sub = bucket & ((1 << METRICS_SUB_BITS) - 1);
+  uint64_t lower = ((1ULL << METRICS_SUB_BITS) + sub) << shift;
+  return lower + ((1ULL << shift) - 1);
+}
+
+/**
+ * @brief records a value in a histogram
+ * @param histogram a HISTOGRAM_* index
+ * @param value the value in microseconds
+*/
+void Metrics_Registry::observe(int histogram, uint64_t value) {
+  Metrics_Shard & shard = local();
+  std::atomic<uint64_t> & count = shard.buckets[histogram][bucketOf(value)];
+  count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic<uint64_t> & sum = shard.sums[histogram];
+  sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * @brief sums the shards of all threads into snapshot
+*/
+void Metrics_Registry::snapshot(Metrics_Shard & snapshot) {
+  std::lock_guard<std::mutex> lock(shardsMutex);
+  merge(snapshot, *retired);
+  for (Metrics_Shard * shard : shards) {
+    merge(snapshot, *shard);
+  }
+}
+
+/**
+ * @brief appends the process wide metrics in the prometheus text format
+*/
+void Metrics_Registry::writePrometheus(std::string & out) {
+  std::unique_ptr<Metrics_Shard> total(new Metrics_Shard());
+  snapshot(*total);
+  for (int i = 0; i < METRIC_COUNTERS; i++) {
+    out += std::string("# HELP ") + counterNames[i].name + " " + counterNames[i].help + "\n";
+    out += std::string("# TYPE ") + counterNames[i].name + " counter\n";
+    out += std::string(counterNames[i].name) + " " +
+           std::to_string(total->counters[i].load(std::memory_order_relaxed)) + "\n";
+  }
+
+  const char * directions[] = {"received", "sent"};
+  for (int d = 0; d < 2; d++) {
+    std::atomic<uint64_t> * counts = d == 0 ? total->messagesIn : total->messagesOut;
+    std::string name = std::string("gnutella_messages_") + directions[d] + "_total";
+    out += "# HELP " + name + " Peer messages " + directions[d] + " by type.\n";
+    out += "# TYPE " + name + " counter\n";
+    uint64_t other = 0;
+    for (int type = 0; type < METRICS_MAX_TYPE; type++) {
+      other += counts[type].load(std::memory_order_relaxed);
+    }
+    for (const std::pair<int, const char *> & type : messageTypes) {
+      uint64_t count = counts[typeIndex(type.first)].load(std::memory_order_relaxed);
+      other -= count;
+      out += name + "{type=\"" + type.second + "\"} " + std::to_string(count) + "\n";
+    }
+    out += name + "{type=\"other\"} " + std::to_string(other) + "\n";
+  }
+
+  // histograms are exported as summaries, quantiles are bucket upper bounds
+  char value[64];
+  for (int h = 0; h < METRIC_HISTOGRAMS; h++) {
+    std::string name = histogramNames[h].name;
+    out += "# HELP " + name + " " + histogramNames[h].help + "\n";
+    out += "# TYPE " + name + " summary\n";
+    uint64_t count = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+      count += total->buckets[h][b].load(std::memory_order_relaxed);
+    }
+    for (double quantile : quantiles) {
+      if (count == 0) {
+        snprintf(value, sizeof(value), "{quantile=\"%g\"} NaN\n", quantile);
+        out += name + value;
+        continue;
+      }
+      double seconds = 0;
+      {
+        uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(quantile * count));
+        uint64_t seen = 0;
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+          seen += total->buckets[h][b].load(std::memory_order_relaxed);
+          if (seen >= rank) {
+            seconds = bucketUpperBound(b) / 1e6;
+            break;
+          }
+        }
+      }
+      snprintf(value, sizeof(value), "{quantile=\"%g\"} %g\n", quantile, seconds);
+      out += name + value;
+    }
+    snprintf(value, sizeof(value), "_sum %g\n", total->sums[h].load() / 1e6);
+    out += name + value;
+    out += name + "_count " + std::to_string(count) + "\n";
+  }
+}
+
+/**
+ * @brief returns a label value with backslashes, quotes and newlines escaped
+ * as the prometheus text format requires
+*/
+std::string Metrics_Registry::escapeLabel(const std::string & value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    }
+    else if (c == '"') {
+      escaped += "\\\"";
+    }
+    else if (c == '\n') {
+      escaped += "\\n";
+    }
+    else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
@@ -0,0 +1,166 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Protocol.hpp"
+
+#define METRICS_MAX_TYPE 1024        // message types counted, larger types count as 0
+#define METRICS_SUB_BITS 3           // sub buckets per power of two, 2^-3 = 12.5% precision
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS)
+
+// counters, indexes into every thread's shard
+#define METRIC_QUERIES_SENT 0        // queries started by this node
+#define METRIC_QUERY_HITS 1          // hits received for queries started here
+#define METRIC_QUERIES_RECEIVED 2    // queries received from peers
+#define METRIC_QUERY_DUPLICATES 3    // received queries already in the query cache
+#define METRIC_QUERIES_ANSWERED 4    // received queries for files shared here
+#define METRIC_SEARCHES_RECEIVED 5   // name searches received from peers
+#define METRIC_SEARCH_DUPLICATES 6   // received searches already in the search cache
+#define METRIC_FILES_HASHED 7        // shared files hashed
+#define METRIC_BYTES_HASHED 8        // bytes of shared files hashed
+#define METRIC_BYTES_UPLOADED 9      // file bytes served on the file port
+#define METRIC_BYTES_DOWNLOADED 10   // verified file bytes downloaded
+#define METRIC_CHUNKS_CORRUPT 11     // downloaded chunks failing verification
+#define METRIC_MESSAGES_DROPPED 12   // malformed or unknown peer messages
+#define METRIC_SESSIONS_AGREED 13    // transfer sessions agreed with a key exchange
+#define METRIC_SESSIONS_RESUMED 14   // transfer sessions resumed without one
+#define METRIC_CONNECTIONS_OPENED 15 // file connections opened to peers
+#define METRIC_CONNECTIONS_REUSED 16 // idle file connections taken from the pool
+#define METRIC_MESSAGES_SHED 17      // outbound messages dropped from full peer queues
+#define METRIC_PONG_REFRESHES 18     // rebuilds of the cached pongs
+#define METRIC_PONGS_CACHED 19       // pings answered with a cached pong
+#define METRIC_MESSAGES_REFUSED 20   // inbound messages dropped from a full handling queue
+#define METRIC_COUNTERS 21
+
+// latency histograms, values are microseconds
+#define HISTOGRAM_DISPATCH 0         // handling of one peer message
+#define HISTOGRAM_HASH_FILE 1        // hashing of one shared file
+#define HISTOGRAM_UPLOAD 2           // serving of one file range
+#define HISTOGRAM_CHUNK 3            // download of one chunk
+#define METRIC_HISTOGRAMS 4
+
+// the metrics written by one thread. only the owning thread writes, so updates
+// are a relaxed load and store without a locked instruction, readers may see
+// a value one update behind
+struct Metrics_Shard_t {
+  std::atomic<uint64_t> counters[METRIC_COUNTERS];                   //
+  std::atomic<uint64_t> messagesIn[METRICS_MAX_TYPE];                // type -> received
+  std::atomic<uint64_t> messagesOut[METRICS_MAX_TYPE];               // type -> sent
+  std::atomic<uint64_t> buckets[METRIC_HISTOGRAMS][METRICS_BUCKETS]; // value counts
+  std::atomic<uint64_t> sums[METRIC_HISTOGRAMS];                     // sum of values
+};
+typedef struct Metrics_Shard_t Metrics_Shard;
+
+// process wide metrics. every thread updates its own shard, a snapshot sums
+// the shards of live threads and the totals left by threads that exited.
+// histograms are log linear like HdrHistogram, values below 2^METRICS_SUB_BITS
+// are exact and larger ones fall in buckets 2^-METRICS_SUB_BITS wide relative
+// to their value
+class Metrics_Registry {
+  static std::mutex shardsMutex;                // mutex for shards and retired
+  static std::vector<Metrics_Shard *> shards;   // shards of live threads
+  static Metrics_Shard * retired;               // totals of exited threads
+
+  /**
+ * @brief returns the shard of the calling thread, created on first use
+*/
+  static Metrics_Shard & local();
+
+  /**
+ * @brief adds the shard of an exiting thread to retired and frees it
+*/
+  static void retire(Metrics_Shard * shard);
+
+  /**
+ * @brief adds every value of from into to
+*/
+  static void merge(Metrics_Shard & to, const Metrics_Shard & from);
+
+  friend struct Metrics_Thread_t;
+
+ public:
+  /**
+ * @brief adds to a counter
+ * @param counter a METRIC_* index
+ * @param amount the amount to add
+*/
+  static void add(int counter, uint64_t amount = 1) {
+    std::atomic<uint64_t> & value = local().counters[counter];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+
+  /**
+ * @brief counts a peer message received
+*/
+  static void messageIn(int type) {
+    std::atomic<uint64_t> & value = local().messagesIn[typeIndex(type)];
+    value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  /**
+ * @brief counts a peer message sent
+*/
+  static void messageOut(int type) {
+    std::atomic<uint64_t> & value = local().messagesOut[typeIndex(type)];
+    value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  /**
+ * @brief records a value in a histogram
+ * @param histogram a HISTOGRAM_* index
+ * @param value the value in microseconds
+*/
+  static void observe(int histogram, uint64_t value);
+
+  /**
+ * @brief returns the microseconds of a steady clock, for timing with observe
+*/
+  static uint64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  /**
+ * @brief returns the histogram bucket of a value
+*/
+  static int bucketOf(uint64_t value);
+
+  /**
+ * @brief returns the largest value that falls in a bucket
+*/
+  static uint64_t bucketUpperBound(int bucket);
+
+  /**
+ * @brief returns the index messages of a type are counted at
+*/
+  static int typeIndex(int type) { return type >= 0 && type < METRICS_MAX_TYPE ? type : 0; }
+
+  /**
+ * @brief sums the shards of all threads into snapshot
+*/
+  static void snapshot(Metrics_Shard & snapshot);
+
+  /**
+ * @brief appends the process wide metrics in the prometheus text format
+*/
+  static void writePrometheus(std::string & out);
+
+  /**
+ * @brief returns a label value with backslashes, quotes and newlines escaped
+ * as the prometheus text format requires
+*/
+  static std::string escapeLabel(const std::string & value);
+};
+
+#endif
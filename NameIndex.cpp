@@ -0,0 +1,271 @@
+#include "NameIndex.hpp"
+
+/**
+ * @brief returns the gram starting at name[i]
+*/
+static uint32_t gramAt(const std::string & name, size_t i) {
+  uint32_t gram = 0;
+  for (size_t j = 0; j < NAME_INDEX_GRAM; j++) {
+    gram = (gram << 8) | (unsigned char)name[i + j];
+  }
+  return gram;
+}
+
+/**
+ * @brief returns the distinct grams of a name
+*/
+static std::vector<uint32_t> gramsOf(const std::string & name) {
+  std::vector<uint32_t> result;
+  for (size_t i = 0; i + NAME_INDEX_GRAM <= name.size(); i++) {
+    result.push_back(gramAt(name, i));
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+/**
+ * @brief lower cases the ascii letters of a string
+*/
+static std::string lower(const std::string & text) {
+  std::string result = text;
+  for (char & c : result) {
+    if (c >= 'A' && c <= 'Z') {
+      c = c - 'A' + 'a';
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief removes one id from a posting list, order is not kept
+*/
+static void erasePosting(std::vector<uint32_t> & postings, uint32_t id) {
+  for (size_t i = 0; i < postings.size(); i++) {
+    if (postings[i] == id) {
+      postings[i] = postings.back();
+      postings.pop_back();
+      return;
+    }
+  }
+}
+
+/**
+ * @brief splits a name into lower case words, bytes that are not ascii letters
+ * or digits separate words unless they are part of a utf-8 sequence
+*/
+std::vector<std::string> Name_Index::tokenize(const std::string & name) {
+  std::vector<std::string> result;
+  std::string word;
+  for (char c : name) {
+    unsigned char byte = c;
+    if ((byte >= 'a' && byte <= 'z') || (byte >= '0' && byte <= '9') || byte >= 0x80) {
+      word.push_back(c);
+    }
+    else if (byte >= 'A' && byte <= 'Z') {
+      word.push_back(c - 'A' + 'a');
+    }
+    else if (!word.empty()) {
+      result.push_back(word);
+      word.clear();
+    }
+  }
+  if (!word.empty()) {
+    result.push_back(word);
+  }
+  return result;
+}
+
+/**
+ * @brief adds the name of a file, replacing an existing entry of the path
+ * @param path the absolute path of the file
+ * @param hash the hash of the file in hex
+*/
+void Name_Index::insert(const std::string & path, const std::string & hash) {
+  remove(path);
+  uint32_t id;
+  if (!freeIds.empty()) {
+    id = freeIds.back();
+    freeIds.pop_back();
+  }
+  else {
+    id = documents.size();
+    documents.push_back(Name_Document());
+  }
+  Name_Document & document = documents[id];
+  size_t lastSlash = path.find_last_of('/');
+  document.name = lower(lastSlash == std::string::npos ? path : path.substr(lastSlash + 1));
+  document.path = path;
+  document.hash = hash;
+  document.tokens = tokenize(document.name);
+  document.used = true;
+  ids[path] = id;
+  for (uint32_t gram : gramsOf(document.name)) {
+    grams[gram].push_back(id);
+  }
+  std::vector<std::string> distinct = document.tokens;
+  std::sort(distinct.begin(), distinct.end());
+  distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+  for (const std::string & word : distinct) {
+    words[word].push_back(id);
+  }
+}
+
+/**
+ * @brief removes the name of a file
+*/
+void Name_Index::remove(const std::string & path) {
+  std::unordered_map<std::string, uint32_t>::iterator it = ids.find(path);
+  if (it == ids.end()) {
+    return;
+  }
+  uint32_t id = it->second;
+  ids.erase(it);
+  Name_Document & document = documents[id];
+  for (uint32_t gram : gramsOf(document.name)) {
+    std::unordered_map<uint32_t, std::vector<uint32_t> >::iterator postings = grams.find(gram);
+    erasePosting(postings->second, id);
+    if (postings->second.empty()) {
+      grams.erase(postings);
+    }
+  }
+  for (const std::string & word : document.tokens) {
+    std::unordered_map<std::string, std::vector<uint32_t> >::iterator postings =
+        words.find(word);
+    if (postings == words.end()) {
+      // repeated word already removed
+      continue;
+    }
+    erasePosting(postings->second, id);
+    if (postings->second.empty()) {
+      words.erase(postings);
+    }
+  }
+  document = Name_Document();
+  document.used = false;
+  freeIds.push_back(id);
+}
+
+/**
+ * @brief returns the document ids of a search word, nullptr if none match
+*/
+const std::vector<uint32_t> * Name_Index::candidatesOf(const std::string & word) const {
+  if (word.size() < NAME_INDEX_GRAM) {
+    std::unordered_map<std::string, std::vector<uint32_t> >::const_iterator it =
+        words.find(word);
+    return it == words.end() ? nullptr : &it->second;
+  }
+  // the rarest gram of the word bounds the documents containing it
+  const std::vector<uint32_t> * best = nullptr;
+  for (size_t i = 0; i + NAME_INDEX_GRAM <= word.size(); i++) {
+    std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator it =
+        grams.find(gramAt(word, i));
+    if (it == grams.end()) {
+      return nullptr;
+    }
+    if (best == nullptr || it->second.size() < best->size()) {
+      best = &it->second;
+    }
+  }
+  return best;
+}
+
+/**
+ * @brief scores a document against the search words
+ * returns the score, 0 if a word does not match
+*/
+int Name_Index::score(const Name_Document & document,
+                      const std::string & query,
+                      const std::vector<std::string> & queryWords) const {
+  // cheap rejection before looking at words, the candidates only share one gram
+  for (const std::string & word : queryWords) {
+    if (word.size() >= NAME_INDEX_GRAM && document.name.find(word) == std::string::npos) {
+      return 0;
+    }
+  }
+  int total = 0;
+  for (const std::string & word : queryWords) {
+    int best = 0;
+    for (const std::string & token : document.tokens) {
+      if (token == word) {
+        best = 4;
+        break;
+      }
+      if (word.size() >= NAME_INDEX_GRAM && token.compare(0, word.size(), word) == 0) {
+        best = std::max(best, 3);
+      }
+    }
+    if (best == 0 && word.size() >= NAME_INDEX_GRAM &&
+        document.name.find(word) != std::string::npos) {
+      best = 1;
+    }
+    if (best == 0) {
+      return 0;
+    }
+    total += best;
+  }
+  // the words in the same order as typed
+  if (document.name.find(query) != std::string::npos) {
+    total += 2;
+  }
+  return total;
+}
+
+/**
+ * @brief finds the files whose names contain every word of query
+ * returns at most maxResults matches, best first
+ * @param query keywords or part of a file name
+ * @param maxResults the maximum number of matches returned
+*/
+std::vector<Name_Match> Name_Index::search(const std::string & query,
+                                           size_t maxResults) const {
+  std::vector<Name_Match> matches;
+  std::vector<std::string> queryWords = tokenize(query);
+  if (queryWords.empty() || maxResults == 0) {
+    return matches;
+  }
+  const std::vector<uint32_t> * candidates = nullptr;
+  for (const std::string & word : queryWords) {
+    const std::vector<uint32_t> * postings = candidatesOf(word);
+    if (postings == nullptr) {
+      return matches;
+    }
+    if (candidates == nullptr || postings->size() < candidates->size()) {
+      candidates = postings;
+    }
+  }
+  std::string phrase = lower(query);
+  std::vector<std::pair<int, uint32_t> > scored;
+  for (uint32_t id : *candidates) {
+    int points = score(documents[id], phrase, queryWords);
+    if (points > 0) {
+      scored.push_back(std::make_pair(points, id));
+    }
+  }
+  // best score first, shorter names first among equal scores
+  size_t count = std::min(maxResults, scored.size());
+  std::partial_sort(scored.begin(),
+                    scored.begin() + count,
+                    scored.end(),
+                    [this](const std::pair<int, uint32_t> & a,
+                           const std::pair<int, uint32_t> & b) {
+                      if (a.first != b.first) {
+                        return a.first > b.first;
+                      }
+                      const Name_Document & x = documents[a.second];
+                      const Name_Document & y = documents[b.second];
+                      if (x.name.size() != y.name.size()) {
+                        return x.name.size() < y.name.size();
+                      }
+                      return x.path < y.path;
+                    });
+  for (size_t i = 0; i < count; i++) {
+    const Name_Document & document = documents[scored[i].second];
+    Name_Match match;
+    match.path = document.path;
+    match.hash = document.hash;
+    match.score = scored[i].first;
+    matches.push_back(match);
+  }
+  return matches;
+}
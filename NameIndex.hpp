@@ -0,0 +1,90 @@
+#ifndef NAME_INDEX_HPP
+#define NAME_INDEX_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define NAME_INDEX_GRAM 3  // bytes per gram, shorter search words match whole words
+
+// a shared file matching a name search
+struct Name_Match_t {
+  std::string path;  // absolute path of the file
+  std::string hash;  // sha256 of the file in hex
+  int score;         // higher is a better match
+};
+typedef struct Name_Match_t Name_Match;
+
+// a shared file name in the index
+struct Name_Document_t {
+  std::string name;                 // lower case file name
+  std::string path;                 // absolute path of the file
+  std::string hash;                 // sha256 of the file in hex
+  std::vector<std::string> tokens;  // words of name
+  bool used;                        // is the document live
+};
+typedef struct Name_Document_t Name_Document;
+
+// inverted index over shared file names. names are lower cased and indexed by
+// every NAME_INDEX_GRAM byte gram and by every word, a search word of at least
+// NAME_INDEX_GRAM bytes matches anywhere in a name, a shorter one only a whole word.
+// not synchronized, File_Index guards it with its own mutex
+class Name_Index {
+  std::vector<Name_Document> documents;  // document id -> document
+  std::vector<uint32_t> freeIds;         // ids of removed documents
+  std::unordered_map<std::string,        //
+                     uint32_t>           //
+      ids;                               // file path -> document id
+  std::unordered_map<uint32_t,           //
+                     std::vector<uint32_t> >
+      grams;                             // gram -> ids of documents containing it
+  std::unordered_map<std::string,        //
+                     std::vector<uint32_t> >
+      words;                             // word -> ids of documents containing it
+
+  /**
+ * @brief returns the document ids of a search word, nullptr if none match
+*/
+  const std::vector<uint32_t> * candidatesOf(const std::string & word) const;
+
+  /**
+ * @brief scores a document against the search words
+ * returns the score, 0 if a word does not match
+*/
+  int score(const Name_Document & document,
+            const std::string & query,
+            const std::vector<std::string> & queryWords) const;
+
+ public:
+  Name_Index() : documents(), freeIds(), ids(), grams(), words() {}
+
+  /**
+ * @brief splits a name into lower case words, bytes that are not ascii letters
+ * or digits separate words unless they are part of a utf-8 sequence
+*/
+  static std::vector<std::string> tokenize(const std::string & name);
+
+  /**
+ * @brief adds the name of a file, replacing an existing entry of the path
+ * @param path the absolute path of the file
+ * @param hash the hash of the file in hex
+*/
+  void insert(const std::string & path, const std::string & hash);
+
+  /**
+ * @brief removes the name of a file
+*/
+  void remove(const std::string & path);
+
+  /**
+ * @brief finds the files whose names contain every word of query
+ * returns at most maxResults matches, best first
+ * @param query keywords or part of a file name
+ * @param maxResults the maximum number of matches returned
+*/
+  std::vector<Name_Match> search(const std::string & query, size_t maxResults) const;
+};
+
+#endif
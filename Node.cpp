@@ -2,27 +2,38 @@
 
 /**
  * @brief query identifier -> string
- * returns a string representation of a query identifier to be used as keys
- * 
+ * returns a readable representation of a query identifier for logs,
+ * queries are keyed by Query_Cache::makeKey
 */
 std::string Node::getQueryIdentifierString(Query_Identifier id) {
   std::stringstream ss;
-  ss << id.source.hostName << ":" << id.timestamp << ":" << id.hash;
+  ss << id.source.hostName << ":" << id.timestamp << ":"
+     << File_Util_Handler::digestToHex(id.hash, sizeof(id.hash));
   return ss.str();
 }
 
+/**
+ * @brief peer identifier -> string
+ * returns host:port of a peer to be used as keys
+*/
+std::string Node::getPeerIdentifierString(Peer_Identifier id) {
+  return std::string(id.hostName) + ":" + std::to_string(id.port);
+}
+
 /**
  * @brief sends a ping to a peer
  * returns 0 successful, -1 otherwise failed
 */
-int Node::sendPing(Peer_Identifier peer, Ping ping, int fd) {
+int Node::sendPing(Peer_Identifier peer, Ping ping, Connection_Id connection) {
   try {
-    if (socketUtilHandler.sendMessage(fd, (char *)&ping, sizeof(ping), T_PING) < 0) {
+    char buffer[WIRE_MAX_MESSAGE_LENGTH];
+    int length = Wire_Codec::encode(ping, buffer, sizeof(buffer));
+    if (length < 0 || eventLoop.sendMessage(connection, buffer, length, T_PING) < 0) {
       logger->logError("Error sending ping to " + std::string(peer.hostName));
       return -1;
     }
     else {
-      logger->logEvent("Sent ping to " + std::string(peer.hostName));
+      LOG_DEBUG(logger, "Sent ping to %s", peer.hostName);
       return 0;
     }
   }
@@ -33,31 +44,1522 @@ int Node::sendPing(Peer_Identifier peer, Ping ping, int fd) {
   }
 }
 
+/**
+ * @brief returns the pongs pings are answered with
+ * rebuilds them from the peers when they are older than PONG_CACHE_REFRESH_MS
+*/
+std::shared_ptr<const Cached_Pong> Node::cachedPong() {
+  if (pongCache.claimRefresh()) {
+    std::vector<Peer_Identifier> neighbours;
+    {
+      std::lock_guard<std::mutex> lock(peersMutex);
+      for (std::map<std::string, Peer_Info>::iterator it = peers.begin(); it != peers.end();
+           ++it) {
+        neighbours.push_back(it->second.id);
+      }
+    }
+    pongCache.refresh(neighbours);
+  }
+  return pongCache.get();
+}
+
 /**
  * @brief sends a pong to a peer
+ * the pong comes from pongCache, peersMutex is only taken to add the sender
+ * when there is room for it.
  * returns 0 if node allowed to add ping sender as a peer, 1 if not, -1 otherwise failed
 */
-int Node::handlePing(Ping ping, int fd) {
+int Node::handlePing(Ping ping, Connection_Id connection) {
+  try {
+    std::shared_ptr<const Cached_Pong> pong = cachedPong();
+    bool allowed = false;
+    // a full node, the common case under crawlers and reconnect storms, refuses
+    // without touching peersMutex
+    if (peerCount.load() < (size_t)maxPeers) {
+      std::string key = getPeerIdentifierString(ping.selfInfo);
+      std::lock_guard<std::mutex> lock(peersMutex);
+      allowed = peers.size() < (size_t)maxPeers && peers.find(key) == peers.end();
+      if (allowed) {
+        Peer_Info info;
+        info.id = ping.selfInfo;
+        info.connection = connection;
+        peers[key] = info;
+        peerCount = peers.size();
+        // selfInfo of a refused ping is unchecked, only accepted peers are listed
+        pongCache.addHost(ping.selfInfo);
+        pongCache.invalidate();
+        logger->logEvent("Added peer " + key);
+      }
+    }
+    const std::string & payload = allowed ? pong->accepted : pong->refused;
+    if (eventLoop.sendMessage(connection, payload.data(), payload.size(), T_PONG) < 0) {
+      logger->logError("Error sending pong to connection " + std::to_string(connection));
+      return -1;
+    }
+    Metrics_Registry::add(METRIC_PONGS_CACHED);
+    if (allowed) {
+      sendRouteTable(connection);
+    }
+    return allowed ? 0 : 1;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error handling ping: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+   * @brief handles a pong from a peer
+   * returns 0 if allowed to add peer, 1 if not, -1 otherwise failed
+   * if not allowed, tries to join the peers listed in the pong instead
+   * @param connection the connection that received the pong
+*/
+int Node::handlePong(Pong pong, Connection_Id connection) {
+  try {
+    std::vector<Peer_Identifier> candidates;
+    bool joined = false;
+    {
+      std::lock_guard<std::mutex> lock(peersMutex);
+      std::map<Connection_Id, Peer_Identifier>::iterator it = pendingPeers.find(connection);
+      if (it == pendingPeers.end()) {
+        logger->logError("Unexpected pong on connection " + std::to_string(connection));
+        return -1;
+      }
+      Peer_Identifier peer = it->second;
+      pendingPeers.erase(it);
+      // the peer answered our ping, the peers it lists are only its word
+      pongCache.addHost(peer);
+      std::string key = getPeerIdentifierString(peer);
+      if (pong.allowed && peers.size() < (size_t)maxPeers) {
+        Peer_Info info;
+        info.id = peer;
+        info.connection = connection;
+        peers[key] = info;
+        peerCount = peers.size();
+        backoffs.erase(key);
+        pongCache.invalidate();
+        logger->logEvent("Joined peer " + key);
+        joined = true;
+      }
+      else {
+        logger->logEvent("Peer " + key + " refused connection");
+        backOff(key);
+        // look for peers we are not connected to yet
+        for (int i = 0; i < pong.num_peers && i < PONG_MAX_PEERS; i++) {
+          std::string candidate = getPeerIdentifierString(pong.peers[i]);
+          if (peers.find(candidate) == peers.end() &&
+              candidate != getPeerIdentifierString(selfInfo)) {
+            candidates.push_back(pong.peers[i]);
+          }
+        }
+      }
+    }
+    if (joined) {
+      sendRouteTable(connection);
+      return 0;
+    }
+    eventLoop.closeConnection(connection);
+    if (!candidates.empty()) {
+      joinNetwork(candidates);
+    }
+    return 1;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error handling pong: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * @brief joins the network
+ * tries to connect to peers and connect to maximum of maxInitPeers peers.
+ * returns 0 if successful, -1 otherwise failed
+ * @param peers a vector of peers to connect to
+*/
+int Node::joinNetwork(std::vector<Peer_Identifier> & peers) {
+  int pinged = 0;
+  for (Peer_Identifier peer : peers) {
+    std::string key = getPeerIdentifierString(peer);
+    {
+      std::lock_guard<std::mutex> lock(peersMutex);
+      if (this->peers.size() + pendingPeers.size() >= (size_t)maxInitPeers) {
+        break;
+      }
+      if (this->peers.find(key) != this->peers.end()) {
+        continue;
+      }
+      std::map<std::string, Join_Backoff>::iterator backoff = backoffs.find(key);
+      if (backoff != backoffs.end() &&
+          std::chrono::steady_clock::now() < backoff->second.until) {
+        continue;
+      }
+    }
+    int fd = socketUtilHandler.initClientSocket(peer.hostName,
+                                                std::to_string(peer.port).c_str());
+    if (fd < 0) {
+      std::lock_guard<std::mutex> lock(peersMutex);
+      backOff(key);
+      continue;
+    }
+    Connection_Id connection = eventLoop.addConnection(fd);
+    if (connection < 0) {
+      close(fd);
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(peersMutex);
+      pendingPeers[connection] = peer;
+    }
+    Ping ping;
+    memset(&ping, 0, sizeof(ping));
+    ping.selfInfo = selfInfo;
+    ping.timestamp = time(NULL);
+    // a connection closed before it was pending is never seen by handleDisconnect,
+    // the ping then fails and the pending peer is dropped here
+    if (sendPing(peer, ping, connection) < 0) {
+      {
+        std::lock_guard<std::mutex> lock(peersMutex);
+        pendingPeers.erase(connection);
+      }
+      eventLoop.closeConnection(connection);
+      continue;
+    }
+    pinged++;
+  }
+  return pinged > 0 ? 0 : -1;
+}
+
+/**
+ * @brief makes joinNetwork skip a host that refused or could not be reached
+ * the wait starts at JOIN_BACKOFF_MS and doubles with every failure in a row up
+ * to JOIN_BACKOFF_MAX_MS, caller holds peersMutex
+ * @param key host:port of the host
+*/
+void Node::backOff(const std::string & key) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::map<std::string, Join_Backoff>::iterator it = backoffs.find(key);
+  if (it != backoffs.end()) {
+    it->second.delayMs = std::min(it->second.delayMs * 2, JOIN_BACKOFF_MAX_MS);
+    it->second.until = now + std::chrono::milliseconds(it->second.delayMs);
+    return;
+  }
+  if (backoffs.size() >= JOIN_BACKOFF_MAX_HOSTS) {
+    for (it = backoffs.begin(); it != backoffs.end();) {
+      it = it->second.until < now ? backoffs.erase(it) : std::next(it);
+    }
+    if (backoffs.size() >= JOIN_BACKOFF_MAX_HOSTS) {
+      backoffs.erase(backoffs.begin());
+    }
+  }
+  Join_Backoff backoff;
+  backoff.delayMs = JOIN_BACKOFF_MS;
+  backoff.until = now + std::chrono::milliseconds(backoff.delayMs);
+  backoffs[key] = backoff;
+}
+
+/**
+ * @brief generates and sends a query to all peers
+ * returns a query if successful, nullptr otherwise failed
+ * @param query the query to send
+*/
+Query Node::initQuery(std::string hash) {
+  Query query;
+  memset(&query, 0, sizeof(query));
+  query.id.source = selfInfo;
+  query.id.timestamp = time(NULL);
+  File_Util_Handler::hexToDigest(hash, query.id.hash);
+  query.prev = selfInfo;
+  query.ttl = queryTimeToLive;
+  Peer_Info source;
+  source.id = selfInfo;
+  source.connection = -1;
+  Query_Status status;
+  status.success = false;
+  status.timestamp = query.id.timestamp;
+  queries.insert(Query_Cache::makeKey(query.id), source, status);
+  Metrics_Registry::add(METRIC_QUERIES_SENT);
+  // the sends only queue, the peers are copied so they run without peersMutex
+  int sent = 0;
+  for (Connection_Id peerConnection : peerConnections(-1)) {
+    if (query.ttl > 1 || peerMayHave(peerConnection, query.id.hash)) {
+      sendQuery(query, peerConnection);
+      sent++;
+    }
+  }
+  LOG_DEBUG(logger, "Sent query for %s to %d peers", hash.c_str(), sent);
+  return query;
+}
+
+/**
+ * @brief sends a query to a peer
+ * returns 0 if successful, -1 otherwise failed
+ * @param query the query to send
+ * @param connection the connection of the peer to send the query to
+*/
+int Node::sendQuery(Query query, Connection_Id connection) {
+  char buffer[WIRE_MAX_MESSAGE_LENGTH];
+  int length = Wire_Codec::encode(query, buffer, sizeof(buffer));
+  if (length < 0 || eventLoop.sendMessage(connection, buffer, length, T_QUERY) < 0) {
+    logger->logError("Error sending query to connection " + std::to_string(connection));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief sends a query hit back
+ * returns 0 if successful, -1 otherwise failed
+ * @param query the query to send
+ * @param connection the connection of the peer to send the query hit to
+*/
+int Node::sendQueryHit(Query query, Connection_Id connection) {
+  Query_Hit queryHit;
+  memset(&queryHit, 0, sizeof(queryHit));
+  queryHit.id = query.id;
+  queryHit.prev = selfInfo;
+  // the file owner is reached on its file port
+  queryHit.destination = selfInfo;
+  queryHit.destination.port = filePort;
+  char buffer[WIRE_MAX_MESSAGE_LENGTH];
+  int length = Wire_Codec::encode(queryHit, buffer, sizeof(buffer));
+  if (length < 0 || eventLoop.sendMessage(connection, buffer, length, T_QUERY_HIT) < 0) {
+    logger->logError("Error sending query hit to connection " + std::to_string(connection));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief checks if a query on its last hop is worth sending to a peer
+ * returns false if the route table of the peer rules the file out
+ * @param connection the connection of the peer
+ * @param hash the hash of the queried file
+*/
+bool Node::peerMayHave(Connection_Id connection, const unsigned char * hash) {
+  std::shared_lock<std::shared_mutex> lock(peerTablesMutex);
+  std::map<Connection_Id, Route_Table>::iterator it = peerTables.find(connection);
+  // a peer that sent no table yet or whose table went out of sync gets every query
+  return it == peerTables.end() || !it->second.isSynced() || it->second.mayContain(hash);
+}
+
+/**
+ * @brief returns the connections of all peers except one
+ * @param except the connection to leave out, -1 for none
+*/
+std::vector<Connection_Id> Node::peerConnections(Connection_Id except) {
+  std::vector<Connection_Id> connections;
+  std::lock_guard<std::mutex> lock(peersMutex);
+  connections.reserve(peers.size());
+  for (std::map<std::string, Peer_Info>::iterator it = peers.begin(); it != peers.end(); ++it) {
+    if (it->second.connection != except) {
+      connections.push_back(it->second.connection);
+    }
+  }
+  return connections;
+}
+
+/**
+ * @brief handles a query from a peer
+ * returns 0 if has the file, 1 if not, -1 otherwise failed 
+ * if has the file, sends a query hit back along the path
+ * if doesn't have the file, sends the query to all peers except the previous peer.
+ * on the last hop only peers whose route table may contain the file get it
+ * cache the query accordingly
+ * @param query the received query
+ * @param connection the connection that received the query
+*/
+int Node::handleQuery(Query query, Connection_Id connection) {
+  try {
+    Peer_Info from;
+    from.id = query.prev;
+    from.connection = connection;
+    Query_Status status;
+    status.success = false;
+    status.timestamp = query.id.timestamp;
+    Metrics_Registry::add(METRIC_QUERIES_RECEIVED);
+    if (!queries.insert(Query_Cache::makeKey(query.id), from, status)) {
+      // already seen through another path
+      Metrics_Registry::add(METRIC_QUERY_DUPLICATES);
+      return 1;
+    }
+    std::string hash = File_Util_Handler::digestToHex(query.id.hash, sizeof(query.id.hash));
+    if (fileUtilHandler.fileWithHashExists(fileUtilHandler.getFileDirectory(), hash)) {
+      Metrics_Registry::add(METRIC_QUERIES_ANSWERED);
+      logger->logEvent("Query hit for " + hash);
+      return sendQueryHit(query, connection) < 0 ? -1 : 0;
+    }
+    query.ttl--;
+    if (query.ttl <= 0) {
+      return 1;
+    }
+    query.prev = selfInfo;
+    // receivers of a query with ttl 1 only look at their own files
+    bool lastHop = query.ttl == 1;
+    char buffer[WIRE_MAX_MESSAGE_LENGTH];
+    int length = Wire_Codec::encode(query, buffer, sizeof(buffer));
+    if (length < 0) {
+      return -1;
+    }
+    // the sends only queue, the peers are copied so they run without peersMutex
+    for (Connection_Id peerConnection : peerConnections(connection)) {
+      if (!lastHop || peerMayHave(peerConnection, query.id.hash)) {
+        eventLoop.sendMessage(peerConnection, buffer, length, T_QUERY);
+      }
+    }
+    return 1;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error handling query: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * @brief handles a query hit from a peer
+ * returns 0 if successful, -1 otherwise failed
+ * if the query hit was sent by the node, send a file request
+ * otherwise, send the query back
+ * @param queryHit the received query hit
+ * @param connection the connection that received the query hit
+*/
+int Node::handleQueryHit(Query_Hit queryHit, Connection_Id connection) {
   try {
+    Query_Key key = Query_Cache::makeKey(queryHit.id);
+    Peer_Info from;
+    if (!queries.lookup(key, from)) {
+      logger->logError("Query hit for unknown query " + getQueryIdentifierString(queryHit.id) +
+                       " from connection " + std::to_string(connection));
+      return -1;
+    }
+    if (from.connection < 0) {
+      // every holder answering is another source for the download
+      queries.markSuccess(key);
+      Metrics_Registry::add(METRIC_QUERY_HITS);
+      if (onQueryHit && onQueryHit(queryHit)) {
+        return 0;
+      }
+      logger->logEvent("File " +
+                       File_Util_Handler::digestToHex(queryHit.id.hash,
+                                                      sizeof(queryHit.id.hash)) +
+                       " found at " + getPeerIdentifierString(queryHit.destination));
+      return initFileRequest(queryHit);
+    }
+    queryHit.prev = selfInfo;
+    char buffer[WIRE_MAX_MESSAGE_LENGTH];
+    int length = Wire_Codec::encode(queryHit, buffer, sizeof(buffer));
+    if (length < 0 || eventLoop.sendMessage(from.connection, buffer, length, T_QUERY_HIT) < 0) {
+      logger->logError("Error forwarding query hit to " + getPeerIdentifierString(from.id));
+      return -1;
+    }
+    return 0;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error handling query hit: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * sends query identifier to the file holder
+ * hands the holder to downloadManager as a source of the file, every hit for the
+ * same file adds another source.
+ * returns 0 if successful, -1 otherwise failed
+ * @param queryHit the query hit contains file owner address and the query identifier to request
+*/
+int Node::initFileRequest(Query_Hit queryHit) {
+  std::string hash =
+      File_Util_Handler::digestToHex(queryHit.id.hash, sizeof(queryHit.id.hash));
+  if (fileUtilHandler.fileWithHashExists(fileUtilHandler.getFileDirectory(), hash)) {
+    return 0;
+  }
+  return downloadManager.addSource(queryHit) < 0 ? -1 : 0;
+}
+
+/**
+   * @brief handles a file request from a peer
+   * serves requests until the peer closes the connection or leaves it idle for
+   * FILE_IDLE_TIMEOUT_MS, requesters pool connections. a Query_Identifier asks
+   * for the whole file, a File_Range for part of it. each is answered with the
+   * File_Meta of the file followed by the requested bytes, sent straight from the
+   * page cache with sendfile. a Hash_Tree_Meta asks for the leaves of the file,
+   * they are sent in the clear and unauthenticated even under a session, downloaders
+   * only trust them as far as the hash of the whole file confirms them.
+   * a Secure_Check asks if transfers can be encrypted, a Session_Hello then
+   * agrees on or resumes the session key and switches the connection to it. with
+   * transfers encrypted, file requests without a session close the connection.
+   * closes fd when done
+   * returns 0 if successful, -1 otherwise failed
+   * @param fd the file descriptor that received the file request
+  */
+int Node::handleFileRequest(int fd) {
+  try {
+    // requesters keep connections open between downloads, drop the ones they forgot.
+    // longer than POOL_IDLE_TIMEOUT_MS so requesters close first
+    struct timeval timeout;
+    timeout.tv_sec = FILE_IDLE_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (FILE_IDLE_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::unique_ptr<Transfer_Cipher> cipher;
+    std::string sessionPeer;  // peer id of the session cipher was keyed from
+    Session session;
+    while (true) {
+      char request[std::max({sizeof(File_Range),
+                             sizeof(Query_Identifier),
+                             sizeof(Hash_Tree_Meta),
+                             sizeof(Secure_Check),
+                             sizeof(Session_Hello)})];
+      int length;
+      int type;
+      if (socketUtilHandler.recvMessage(fd, request, sizeof(request), &length, &type) < 0) {
+        // the requester is done with the connection
+        break;
+      }
+      File_Range range;
+      memset(&range, 0, sizeof(range));
+      bool wholeFile = false;
+      if (type == T_QUERY_IDENTIFIER && length == sizeof(Query_Identifier)) {
+        memcpy(range.hash, ((Query_Identifier *)request)->hash, sizeof(range.hash));
+        wholeFile = true;
+      }
+      else if (type == T_FILE_RANGE && length == sizeof(File_Range)) {
+        memcpy(&range, request, sizeof(range));
+      }
+      else if (type == T_HASH_TREE && length == sizeof(Hash_Tree_Meta)) {
+        Hash_Tree_Meta treeRequest;
+        memcpy(&treeRequest, request, sizeof(treeRequest));
+        if (serveHashTree(fd, treeRequest) < 0) {
+          break;
+        }
+        continue;
+      }
+      else if (type == T_SECURE_CHECK && length == sizeof(Secure_Check)) {
+        Secure_Check check;
+        memcpy(&check, request, sizeof(check));
+        check.secure = check.secure && sessions.isEnabled();
+        if (socketUtilHandler.sendMessage(fd, (char *)&check, sizeof(check), T_SECURE_CHECK) <
+            0) {
+          break;
+        }
+        continue;
+      }
+      else if (type == T_SESSION_HELLO && length == sizeof(Session_Hello) &&
+               sessions.isEnabled()) {
+        Session_Hello hello;
+        memcpy(&hello, request, sizeof(hello));
+        int status = sessions.accept(socketUtilHandler, fd, hello, session);
+        if (status < 0) {
+          break;
+        }
+        if (status == 1) {
+          cipher.reset(new Transfer_Cipher(session.key, true));
+          sessionPeer = Session_Cache::peerKey(hello.id);
+        }
+        continue;
+      }
+      else {
+        logger->logError("Invalid file request on fd " + std::to_string(fd));
+        break;
+      }
+      // without a session the requester may not hold the preshared key
+      if (sessions.isEnabled() && cipher == nullptr) {
+        logger->logError("Refusing unencrypted file request on fd " + std::to_string(fd));
+        break;
+      }
+      if (serveFileRange(fd, range, wholeFile, cipher.get()) < 0) {
+        break;
+      }
+      if (cipher != nullptr) {
+        sessions.addBytes(sessionPeer, session, cipher->takeBytes());
+      }
+    }
+    closeFileRequest(fd);
+    return 0;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error handling file request: " + std::string(e.what()));
+    closeFileRequest(fd);
+    return -1;
+  }
+}
+
+/**
+ * @brief closes the socket of a file request, the last one wakes stop
+*/
+void Node::closeFileRequest(int fd) {
+  // erased and closed together, so stop never shuts down a reused fd number
+  std::lock_guard<std::mutex> lock(stopMutex);
+  fileClients.erase(fd);
+  close(fd);
+  fileClientsCond.notify_all();
+}
+
+/**
+ * @brief answers one file request with the File_Meta and the requested bytes
+ * returns 0 if successful, -1 if the connection is unusable
+ * @param fd the file descriptor of the requester
+ * @param range the requested file and bytes
+ * @param wholeFile true to ignore the range and send the whole file
+ * @param cipher seals the meta and the bytes, NULL to send them in the clear
+*/
+int Node::serveFileRange(int fd, File_Range range, bool wholeFile, Transfer_Cipher * cipher) {
+  uint64_t start = Metrics_Registry::nowMicros();
+  std::string hash = File_Util_Handler::digestToHex(range.hash, sizeof(range.hash));
+  File_Meta meta;
+  memset(&meta, 0, sizeof(meta));
+  memcpy(meta.hash, range.hash, sizeof(meta.hash));
+  std::string path =
+      fileUtilHandler.getFilePathFromHash(fileUtilHandler.getFileDirectory(), hash);
+  int fileFd = -1;
+  struct stat st;
+  if (path != "") {
+    fileFd = open(path.c_str(), O_RDONLY);
+  }
+  meta.available = fileFd >= 0 && fstat(fileFd, &st) == 0;
+  if (meta.available) {
+    meta.fileSize = st.st_size;
+    strncpy(meta.name, fileUtilHandler.getFileName(path).c_str(), sizeof(meta.name) - 1);
+    if (wholeFile) {
+      range.offset = 0;
+      range.length = meta.fileSize;
+    }
+    meta.available = range.offset <= meta.fileSize &&
+                     range.length <= meta.fileSize - range.offset;
+  }
+  int status = cipher != NULL ? cipher->seal(meta) : 0;
+  // let the meta header ride in the first data segment
+  socketUtilHandler.setCork(fd, true);
+  if (status >= 0) {
+    status = socketUtilHandler.sendMessage(fd, (char *)&meta, sizeof(meta), T_FILE_META);
+  }
+  if (status >= 0 && meta.available && range.length > 0) {
+    // sealed records pass through user space, plain bytes go straight from the page cache
+    status = cipher != NULL
+                 ? cipher->sendRange(socketUtilHandler, fd, fileFd, range.offset, range.length)
+                 : socketUtilHandler.sendFile(fd, fileFd, range.offset, range.length);
+  }
+  socketUtilHandler.setCork(fd, false);
+  if (fileFd >= 0) {
+    close(fileFd);
+  }
+  if (status < 0) {
+    logger->logError("Error sending file " + hash);
+    return -1;
+  }
+  if (meta.available && range.length > 0) {
+    Metrics_Registry::add(METRIC_BYTES_UPLOADED, range.length);
+    Metrics_Registry::observe(HISTOGRAM_UPLOAD, Metrics_Registry::nowMicros() - start);
+    LOG_DEBUG(logger,
+              "Sent %llu bytes at %llu of %s",
+              (unsigned long long)range.length,
+              (unsigned long long)range.offset,
+              path.c_str());
+  }
+  return 0;
+}
+
+/**
+ * @brief returns the hash tree of a shared file, built on first use
+ * trees are saved in the tree directory and HASH_TREE_CACHE_MAX of them are kept
+ * in memory, until the file changes. returns nullptr if the file is not shared
+ * @param hash the hash of the file in hex
+ * @param leafSize bytes covered by each leaf
+*/
+std::shared_ptr<Hash_Tree> Node::getHashTree(const std::string & hash, uint32_t leafSize) {
+  std::string path =
+      fileUtilHandler.getFilePathFromHash(fileUtilHandler.getFileDirectory(), hash);
+  File_Entry entry;
+  if (path == "" || !filePaths.lookupPath(path, entry)) {
+    return nullptr;
+  }
+  {
+    std::lock_guard<std::mutex> lock(hashTreesMutex);
+    std::map<std::string, Cached_Tree>::iterator it = hashTrees.find(hash);
+    if (it != hashTrees.end()) {
+      if (it->second.tree->getLeafSize() == leafSize && it->second.entry.path == entry.path &&
+          fileUtilHandler.entryIsCurrent(it->second.entry)) {
+        it->second.lastUsed = ++hashTreeUses;
+        return it->second.tree;
+      }
+      hashTrees.erase(it);
+    }
+  }
+  // loading and hashing run without the lock, two requesters may build the same tree once
+  std::string treeDirectory = fileUtilHandler.getTreeDirectory();
+  std::string treePath = treeDirectory + "/" + hash + "." + std::to_string(leafSize);
+  std::shared_ptr<Hash_Tree> tree = std::make_shared<Hash_Tree>();
+  if (!fileUtilHandler.entryIsCurrent(entry) || tree->load(treePath, entry, leafSize) < 0) {
+    if (tree->build(path, leafSize) < 0 || tree->getFileSize() != entry.size) {
+      return nullptr;
+    }
+    if ((mkdir(treeDirectory.c_str(), 0755) < 0 && errno != EEXIST) ||
+        tree->save(treePath, entry) < 0) {
+      logger->logError("Error saving hash tree of " + hash + " to " + treePath);
+    }
+  }
+  std::lock_guard<std::mutex> lock(hashTreesMutex);
+  if (hashTrees.find(hash) == hashTrees.end() && hashTrees.size() >= HASH_TREE_CACHE_MAX) {
+    std::map<std::string, Cached_Tree>::iterator oldest = hashTrees.begin();
+    for (std::map<std::string, Cached_Tree>::iterator it = hashTrees.begin();
+         it != hashTrees.end();
+         ++it) {
+      if (it->second.lastUsed < oldest->second.lastUsed) {
+        oldest = it;
+      }
+    }
+    hashTrees.erase(oldest);
+  }
+  Cached_Tree & cached = hashTrees[hash];
+  cached.entry = entry;
+  cached.tree = tree;
+  cached.lastUsed = ++hashTreeUses;
+  return tree;
+}
+
+/**
+ * @brief answers a hash tree request with the Hash_Tree_Meta and the leaves
+ * returns 0 if successful, -1 if the connection is unusable
+ * @param fd the file descriptor of the requester
+ * @param request the requested file and leaf size
+*/
+int Node::serveHashTree(int fd, Hash_Tree_Meta request) {
+  std::string hash = File_Util_Handler::digestToHex(request.hash, sizeof(request.hash));
+  Hash_Tree_Meta meta;
+  memset(&meta, 0, sizeof(meta));
+  memcpy(meta.hash, request.hash, sizeof(meta.hash));
+  meta.leafSize = request.leafSize;
+  std::shared_ptr<Hash_Tree> tree;
+  if (request.leafSize >= HASH_TREE_MIN_LEAF_SIZE &&
+      request.leafSize <= HASH_TREE_MAX_LEAF_SIZE) {
+    tree = getHashTree(hash, request.leafSize);
+  }
+  meta.available = tree != nullptr;
+  if (meta.available) {
+    memcpy(meta.root, tree->getRoot(), sizeof(meta.root));
+    meta.fileSize = tree->getFileSize();
+    meta.leafCount = tree->leafCount();
+  }
+  socketUtilHandler.setCork(fd, true);
+  int status = socketUtilHandler.sendMessage(fd, (char *)&meta, sizeof(meta), T_HASH_TREE);
+  if (status >= 0 && meta.available) {
+    struct iovec iov;
+    iov.iov_base = (void *)tree->getLeaves().data();
+    iov.iov_len = tree->getLeaves().size();
+    status = socketUtilHandler.sendAll(fd, &iov, 1);
+  }
+  socketUtilHandler.setCork(fd, false);
+  if (status < 0) {
+    logger->logError("Error sending hash tree of " + hash);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief accepts file requests on the file port, each served on its own thread
+ * returns 0 when the node stops, -1 if the file port could not be opened
+*/
+int Node::fileThread() {
+  int serverFd = socketUtilHandler.initServerSocket(std::to_string(filePort).c_str());
+  if (serverFd < 0) {
+    logger->logError("Error listening on file port " + std::to_string(filePort));
+    return -1;
+  }
+  {
+    // a stop before the socket was published could not shut it down
+    std::lock_guard<std::mutex> lock(stopMutex);
+    if (stopping) {
+      close(serverFd);
+      return 0;
+    }
+    fileServerFd = serverFd;
+  }
+  while (!stopping) {
+    int clientFd = socketUtilHandler.handleClientSocket(serverFd);
+    if (clientFd < 0) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(stopMutex);
+      if (stopping) {
+        close(clientFd);
+        break;
+      }
+      fileClients.insert(clientFd);
+    }
+    try {
+      // stop waits for every socket in fileClients, so the thread may use this
+      std::thread(&Node::handleFileRequest, this, clientFd).detach();
+    }
+    catch (std::exception & e) {
+      logger->logError("Error starting file request thread: " + std::string(e.what()));
+      closeFileRequest(clientFd);
+    }
+  }
+  std::lock_guard<std::mutex> lock(stopMutex);
+  fileServerFd = -1;
+  close(serverFd);
+  return 0;
+}
+
+/**
+ * @brief sends the whole published route table to a new peer
+ * later changes reach the peer through publishRouteTable
+ * returns 0 if successful, -1 otherwise failed
+ * @param connection the connection of the peer
+*/
+int Node::sendRouteTable(Connection_Id connection) {
+  std::lock_guard<std::mutex> lock(routeMutex);
+  routedPeers.insert(connection);
+  // sent even when empty, a peer without a table gets every query
+  std::string patch = publishedTable.fullPatch(publishedSequence);
+  if (eventLoop.sendMessage(connection, patch.data(), patch.size(), T_ROUTE_PATCH) < 0) {
+    logger->logError("Error sending route table to connection " + std::to_string(connection));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief rebuilds the route table from the shared files and sends the change
+ * does nothing if no shared file changed since the last call.
+ * returns 0 if successful, -1 otherwise failed
+*/
+int Node::publishRouteTable() {
+  try {
+    uint64_t version = filePaths.getVersion();
+    std::lock_guard<std::mutex> lock(routeMutex);
+    if (version == publishedVersion) {
+      return 0;
+    }
+    Route_Table table;
+    unsigned char hash[32];
+    for (const File_Entry & entry : filePaths.snapshot()) {
+      File_Util_Handler::hexToDigest(entry.hash, hash);
+      table.add(hash);
+    }
+    publishedVersion = version;
+    if (table.equals(publishedTable)) {
+      return 0;
+    }
+    publishedSequence++;
+    std::string patch = table.patchFrom(publishedTable, publishedSequence);
+    publishedTable = table;
+    for (Connection_Id connection : routedPeers) {
+      eventLoop.sendMessage(connection, patch.data(), patch.size(), T_ROUTE_PATCH);
+    }
+    LOG_DEBUG(logger,
+              "Sent route table patch of %zu bytes to %zu peers",
+              patch.size(),
+              routedPeers.size());
+    return 0;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error publishing route table: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * @brief applies a route table patch received from a peer
+ * asks the peer for its whole table when the patch shows the tables went apart.
+ * returns 0 if successful, -1 otherwise failed
+ * @param patch the received patch
+ * @param connection the connection that received the patch
+*/
+int Node::handleRoutePatch(const std::string & patch, Connection_Id connection) {
+  {
+    // patches arriving after the connection closed would outlive it
     std::lock_guard<std::mutex> lock(peersMutex);
-    if (peers.size() >= maxPeers) {
+    bool known = pendingPeers.find(connection) != pendingPeers.end();
+    for (std::map<std::string, Peer_Info>::iterator it = peers.begin();
+         !known && it != peers.end();
+         ++it) {
+      known = it->second.connection == connection;
+    }
+    if (!known) {
+      return -1;
+    }
+  }
+  int status;
+  {
+    std::unique_lock<std::shared_mutex> lock(peerTablesMutex);
+    status = peerTables[connection].applyPatch(patch.data(), patch.size());
+  }
+  if (status < 0) {
+    logger->logError("Invalid route table patch from connection " + std::to_string(connection));
+    return -1;
+  }
+  if (status == 1) {
+    // the peer gets every query until its full table arrives
+    logger->logError("Route table of connection " + std::to_string(connection) +
+                     " is out of sync, asking for all of it");
+    if (eventLoop.sendMessage(connection, "", 0, T_ROUTE_RESET) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief sends the whole published route table again to a peer that asked for it
+ * returns 0 if successful, -1 otherwise failed
+ * @param connection the connection that received the request
+*/
+int Node::handleRouteReset(Connection_Id connection) {
+  {
+    std::lock_guard<std::mutex> lock(routeMutex);
+    if (routedPeers.find(connection) == routedPeers.end()) {
+      return -1;
+    }
+  }
+  return sendRouteTable(connection);
+}
+
+/**
+ * @brief queries for the partial downloads no source is fetching
+ * queries once the node has peers, then every DOWNLOAD_RESUME_MS until sources
+ * answer. called by routeThread
+*/
+void Node::resumeDownloads() {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  // a query sent without peers reaches nobody
+  if (peerCount.load() == 0 || now < nextResume) {
+    return;
+  }
+  nextResume = now + std::chrono::milliseconds(DOWNLOAD_RESUME_MS);
+  for (std::string hash : downloadManager.getUnfinishedDownloads()) {
+    logger->logEvent("Looking for sources of " + hash);
+    initQuery(hash);
+  }
+}
+
+/**
+ * @brief publishes changes of the route table every ROUTE_TABLE_UPDATE_MS
+ * and looks for sources of stalled downloads. returns 0 when the node stops
+*/
+int Node::routeThread() {
+  std::unique_lock<std::mutex> lock(stopMutex);
+  while (!stopping) {
+    lock.unlock();
+    publishRouteTable();
+    resumeDownloads();
+    lock.lock();
+    stopCond.wait_for(lock, std::chrono::milliseconds(ROUTE_TABLE_UPDATE_MS), [this] {
+      return stopping.load();
+    });
+  }
+  return 0;
+}
+
+/**
+ * @brief serves metrics on the user port, one connection at a time
+ * returns 0 when the node stops, -1 if the user port could not be opened
+*/
+int Node::userThread() {
+  int serverFd = socketUtilHandler.initServerSocket(std::to_string(userPort).c_str());
+  if (serverFd < 0) {
+    logger->logError("Error listening on user port " + std::to_string(userPort));
+    return -1;
+  }
+  {
+    // a stop before the socket was published could not shut it down
+    std::lock_guard<std::mutex> lock(stopMutex);
+    if (stopping) {
+      close(serverFd);
+      return 0;
+    }
+    userServerFd = serverFd;
+  }
+  while (!stopping) {
+    int clientFd = socketUtilHandler.handleClientSocket(serverFd);
+    if (clientFd < 0) {
+      continue;
+    }
+    serveUserRequest(clientFd);
+  }
+  std::lock_guard<std::mutex> lock(stopMutex);
+  userServerFd = -1;
+  close(serverFd);
+  return 0;
+}
+
+/**
+ * @brief answers one http request on the user port and closes fd
+ * GET /metrics returns getMetrics, anything else is not found
+ * @param fd the file descriptor of the client
+*/
+void Node::serveUserRequest(int fd) {
+  try {
+    // a client that never finishes its request or never reads the answer must not
+    // hold up the next one
+    struct timeval timeout;
+    timeout.tv_sec = USER_REQUEST_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (USER_REQUEST_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           request.size() < USER_REQUEST_MAX_LENGTH) {
+      ssize_t bytes_received = recv(fd, buffer, sizeof(buffer), 0);
+      if (bytes_received < 0 && errno == EINTR) {
+        continue;
+      }
+      if (bytes_received <= 0) {
+        break;
+      }
+      request.append(buffer, bytes_received);
+    }
+    std::string status = "404 Not Found";
+    std::string body = "not found\n";
+    if (request.compare(0, 13, "GET /metrics ") == 0) {
+      status = "200 OK";
+      body = getMetrics();
+    }
+    std::string header = "HTTP/1.0 " + status +
+                         "\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                         "Content-Length: " +
+                         std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    struct iovec iov[2];
+    iov[0].iov_base = (void *)header.data();
+    iov[0].iov_len = header.size();
+    iov[1].iov_base = (void *)body.data();
+    iov[1].iov_len = body.size();
+    if (socketUtilHandler.sendAll(fd, iov, 2) < 0) {
+      logger->logError("Error answering user request on fd " + std::to_string(fd));
+    }
+  }
+  catch (std::exception & e) {
+    logger->logError("Error serving user request: " + std::string(e.what()));
+  }
+  close(fd);
+}
+
+/**
+ * @brief returns the metrics of the node in the prometheus text format
+ * adds bytes per peer and the sizes of the caches and indexes to the
+ * process wide metrics of Metrics_Registry
+*/
+std::string Node::getMetrics() {
+  std::string out;
+  Metrics_Registry::writePrometheus(out);
+  std::unordered_map<Connection_Id, std::pair<uint64_t, uint64_t> > bytes =
+      eventLoop.getConnectionBytes();
+  std::string received =
+      "# HELP gnutella_peer_received_bytes_total Bytes received from a peer.\n"
+      "# TYPE gnutella_peer_received_bytes_total counter\n";
+  std::string sent =
+      "# HELP gnutella_peer_sent_bytes_total Bytes sent to a peer.\n"
+      "# TYPE gnutella_peer_sent_bytes_total counter\n";
+  {
+    std::lock_guard<std::mutex> lock(peersMutex);
+    for (std::map<std::string, Peer_Info>::iterator it = peers.begin(); it != peers.end();
+         ++it) {
+      std::unordered_map<Connection_Id, std::pair<uint64_t, uint64_t> >::iterator counts =
+          bytes.find(it->second.connection);
+      if (counts == bytes.end()) {
+        continue;
+      }
+      // host names come from the peers themselves
+      std::string label = Metrics_Registry::escapeLabel(it->first);
+      received += "gnutella_peer_received_bytes_total{peer=\"" + label + "\"} " +
+                  std::to_string(counts->second.first) + "\n";
+      sent += "gnutella_peer_sent_bytes_total{peer=\"" + label + "\"} " +
+              std::to_string(counts->second.second) + "\n";
+    }
+  }
+  out += received + sent;
+  const std::pair<const char *, size_t> gauges[] = {
+      {"gnutella_peers", peerCount.load()},
+      {"gnutella_shared_files", filePaths.size()},
+      {"gnutella_known_hosts", pongCache.hostCount()},
+      {"gnutella_query_cache_entries", queries.size()},
+      {"gnutella_search_cache_entries", searches.size()},
+      {"gnutella_active_downloads", downloadManager.activeDownloads()},
+      {"gnutella_idle_file_connections", downloadManager.idleConnections()},
+  };
+  for (const std::pair<const char *, size_t> & gauge : gauges) {
+    out += std::string("# TYPE ") + gauge.first + " gauge\n";
+    out += std::string(gauge.first) + " " + std::to_string(gauge.second) + "\n";
+  }
+  static const char * classNames[MESSAGE_CLASSES] = {"control", "hit", "flood"};
+  std::vector<size_t> outbound = eventLoop.getQueuedFrames();
+  out +=
+      "# HELP gnutella_inbound_queue_depth Received messages waiting for a worker.\n"
+      "# TYPE gnutella_inbound_queue_depth gauge\n";
+  for (int messageClass = 0; messageClass < MESSAGE_CLASSES; messageClass++) {
+    out += std::string("gnutella_inbound_queue_depth{class=\"") + classNames[messageClass] +
+           "\"} " + std::to_string(messagePool.queued(messageClass)) + "\n";
+  }
+  out +=
+      "# HELP gnutella_outbound_queue_depth Messages queued to peers and not written yet.\n"
+      "# TYPE gnutella_outbound_queue_depth gauge\n";
+  for (int messageClass = 0; messageClass < MESSAGE_CLASSES; messageClass++) {
+    out += std::string("gnutella_outbound_queue_depth{class=\"") + classNames[messageClass] +
+           "\"} " + std::to_string(outbound[messageClass]) + "\n";
+  }
+  return out;
+}
+
+/**
+ * @brief returns the MESSAGE_CLASS_ of a message type
+ * hits are answers somebody is waiting for, floods are queries and searches
+*/
+int Node::messageClass(int type) {
+  switch (type) {
+    case T_QUERY_HIT:
+    case T_NAME_SEARCH_HIT:
+      return MESSAGE_CLASS_HIT;
+    case T_QUERY:
+    case T_NAME_SEARCH:
+      return MESSAGE_CLASS_FLOOD;
+    default:
+      return MESSAGE_CLASS_CONTROL;
+  }
+}
+
+/**
+ * @brief passes a message received by the event loop to its handler
+ * runs on messagePool, unknown or malformed messages are dropped
+ * @param connection the connection that received the message
+ * @param type the type of the message
+ * @param message the payload of the message
+*/
+void Node::dispatchMessage(Connection_Id connection, int type, std::string message) {
+  switch (type) {
+    case T_PING: {
+      Ping ping;
+      if (Wire_Codec::decode(message.data(), message.size(), ping) == 0) {
+        handlePing(ping, connection);
+        return;
+      }
+      break;
+    }
+    case T_PONG: {
       Pong pong;
-      pong.allowed = false;
-      pong.timestamp = time(NULL);
-      pong.num_peers = peers.size();
-      int i = 0;
-      for (std::map<std::string, Peer_Info>::iterator it = peers.begin();
-           it != peers.end();
-           ++it) {
-        pong.peers[i] = it->second.id;
-        i++;
+      if (Wire_Codec::decode(message.data(), message.size(), pong) == 0) {
+        handlePong(pong, connection);
+        return;
+      }
+      break;
+    }
+    case T_QUERY: {
+      Query query;
+      if (Wire_Codec::decode(message.data(), message.size(), query) == 0) {
+        handleQuery(query, connection);
+        return;
       }
-      sendPong(pong, fd);
+      break;
+    }
+    case T_QUERY_HIT: {
+      Query_Hit queryHit;
+      if (Wire_Codec::decode(message.data(), message.size(), queryHit) == 0) {
+        handleQueryHit(queryHit, connection);
+        return;
+      }
+      break;
+    }
+    case T_NAME_SEARCH: {
+      Name_Search search;
+      if (Wire_Codec::decode(message.data(), message.size(), search) == 0) {
+        handleNameSearch(search, connection);
+        return;
+      }
+      break;
+    }
+    case T_NAME_SEARCH_HIT: {
+      Name_Search_Hit hit;
+      if (Wire_Codec::decode(message.data(), message.size(), hit) == 0) {
+        handleNameSearchHit(hit, connection);
+        return;
+      }
+      break;
+    }
+    case T_ROUTE_PATCH:
+      if (handleRoutePatch(message, connection) == 0) {
+        return;
+      }
+      break;
+    case T_ROUTE_RESET:
+      if (handleRouteReset(connection) == 0) {
+        return;
+      }
+      break;
+    default:
+      break;
+  }
+  Metrics_Registry::add(METRIC_MESSAGES_DROPPED);
+  logger->logError("Dropped message of type " + std::to_string(type) + " and length " +
+                   std::to_string(message.size()) + " from connection " +
+                   std::to_string(connection));
+}
+
+/**
+ * @brief forgets a peer whose connection was closed
+ * @param connection the closed connection
+*/
+void Node::handleDisconnect(Connection_Id connection) {
+  {
+    std::lock_guard<std::mutex> lock(routeMutex);
+    routedPeers.erase(connection);
+  }
+  {
+    std::unique_lock<std::shared_mutex> lock(peerTablesMutex);
+    peerTables.erase(connection);
+  }
+  std::lock_guard<std::mutex> lock(peersMutex);
+  pendingPeers.erase(connection);
+  for (std::map<std::string, Peer_Info>::iterator it = peers.begin(); it != peers.end();
+       ++it) {
+    if (it->second.connection == connection) {
+      logger->logEvent("Lost peer " + it->first);
+      peers.erase(it);
+      peerCount = peers.size();
+      pongCache.invalidate();
+      return;
+    }
+  }
+}
+
+/**
+ * @brief serves the message port and all peer connections on the event loop
+ * returns when the event loop stops. returns 0 if successful, -1 otherwise failed
+*/
+int Node::messageThread() {
+  int serverFd = socketUtilHandler.initServerSocket(std::to_string(messagePort).c_str());
+  if (serverFd < 0 || eventLoop.addListener(serverFd) < 0) {
+    logger->logError("Error listening on message port " + std::to_string(messagePort));
+    return -1;
+  }
+  return eventLoop.run();
+}
+
+/**
+ * @brief returns the key of a search in searches
+*/
+static Query_Key searchKey(const Peer_Identifier & source, unsigned int timestamp) {
+  Query_Identifier id;
+  memset(&id, 0, sizeof(id));
+  id.source = source;
+  id.timestamp = timestamp;
+  return Query_Cache::makeKey(id);
+}
+
+/**
+ * @brief sends a name search to all peers
+ * matches arrive as Name_Search_Hits and are collected in searchHits
+ * returns 0 if successful, -1 otherwise failed
+ * @param fileName the name of the file to search for
+ * returns -1 if filename too long as well
+*/
+int Node::sendSearch(std::string fileName) {
+  try {
+    Name_Search search;
+    memset(&search, 0, sizeof(search));
+    if (fileName.size() >= sizeof(search.name)) {
+      logger->logError("Search for " + fileName + " is too long");
+      return -1;
+    }
+    strcpy(search.name, fileName.c_str());
+    search.source = selfInfo;
+    search.prev = selfInfo;
+    search.ttl = queryTimeToLive;
+    {
+      // the timestamp tells searches of this node apart
+      std::lock_guard<std::mutex> lock(searchMutex);
+      lastSearchTimestamp = std::max((unsigned int)time(NULL), lastSearchTimestamp + 1);
+      search.timestamp = lastSearchTimestamp;
+    }
+    Peer_Info source;
+    source.id = selfInfo;
+    source.connection = -1;
+    Query_Status status;
+    status.success = false;
+    status.timestamp = search.timestamp;
+    searches.insert(searchKey(search.source, search.timestamp), source, status);
+    char buffer[WIRE_MAX_MESSAGE_LENGTH];
+    int length = Wire_Codec::encode(search, buffer, sizeof(buffer));
+    if (length < 0) {
+      return -1;
+    }
+    std::vector<Connection_Id> connections = peerConnections(-1);
+    for (Connection_Id peerConnection : connections) {
+      eventLoop.sendMessage(peerConnection, buffer, length, T_NAME_SEARCH);
+    }
+    logger->logEvent("Sent search for " + fileName + " to " +
+                     std::to_string(connections.size()) + " peers");
+    return 0;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error sending search: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * @brief handles a name search from a peer
+ * answers with the best matching shared files and forwards the search to all
+ * peers except the previous peer until its ttl runs out
+ * returns 0 if a file matched, 1 if not, -1 otherwise failed
+ * @param search the received search
+ * @param connection the connection that received the search
+*/
+int Node::handleNameSearch(Name_Search search, Connection_Id connection) {
+  try {
+    Peer_Info from;
+    from.id = search.prev;
+    from.connection = connection;
+    Query_Status status;
+    status.success = false;
+    status.timestamp = search.timestamp;
+    Metrics_Registry::add(METRIC_SEARCHES_RECEIVED);
+    if (!searches.insert(searchKey(search.source, search.timestamp), from, status)) {
+      // already seen through another path
+      Metrics_Registry::add(METRIC_SEARCH_DUPLICATES);
       return 1;
     }
+    char buffer[WIRE_MAX_MESSAGE_LENGTH];
+    std::vector<Name_Match> matches = filePaths.search(search.name, SEARCH_MAX_RESULTS);
+    for (const Name_Match & match : matches) {
+      Name_Search_Hit hit;
+      memset(&hit, 0, sizeof(hit));
+      strncpy(hit.matchId.name,
+              fileUtilHandler.getFileName(match.path).c_str(),
+              sizeof(hit.matchId.name) - 1);
+      File_Util_Handler::hexToDigest(match.hash, hit.matchId.hash);
+      hit.source = search.source;
+      // the file owner is reached on its file port
+      hit.destination = selfInfo;
+      hit.destination.port = filePort;
+      hit.timestamp = search.timestamp;
+      int length = Wire_Codec::encode(hit, buffer, sizeof(buffer));
+      if (length < 0 || eventLoop.sendMessage(connection, buffer, length, T_NAME_SEARCH_HIT) < 0) {
+        logger->logError("Error sending search hit to connection " + std::to_string(connection));
+        break;
+      }
+    }
+    if (!matches.empty()) {
+      logger->logEvent(std::to_string(matches.size()) + " matches for search " +
+                       std::string(search.name));
+    }
+    search.ttl--;
+    if (search.ttl > 0) {
+      search.prev = selfInfo;
+      int length = Wire_Codec::encode(search, buffer, sizeof(buffer));
+      for (Connection_Id peerConnection : peerConnections(connection)) {
+        if (length >= 0) {
+          eventLoop.sendMessage(peerConnection, buffer, length, T_NAME_SEARCH);
+        }
+      }
+    }
+    return matches.empty() ? 1 : 0;
   }
   catch (std::exception & e) {
-    logger->logError("Error handling ping: " + std::string(e.what()));
+    logger->logError("Error handling search: " + std::string(e.what()));
+    return -1;
+  }
+}
+
+/**
+ * @brief handles a name search hit from a peer
+ * keeps the hit if the search was started here, otherwise sends it back along the path
+ * returns 0 if successful, -1 otherwise failed
+ * @param hit the received hit
+ * @param connection the connection that received the hit
+*/
+int Node::handleNameSearchHit(Name_Search_Hit hit, Connection_Id connection) {
+  try {
+    Query_Key key = searchKey(hit.source, hit.timestamp);
+    Peer_Info from;
+    if (!searches.lookup(key, from)) {
+      logger->logError("Search hit for unknown search from connection " +
+                       std::to_string(connection));
+      return -1;
+    }
+    if (from.connection < 0) {
+      searches.markSuccess(key);
+      std::lock_guard<std::mutex> lock(searchMutex);
+      for (const Name_Search_Hit & known : searchHits) {
+        if (known.timestamp == hit.timestamp &&
+            memcmp(known.matchId.hash, hit.matchId.hash, sizeof(hit.matchId.hash)) == 0 &&
+            getPeerIdentifierString(known.destination) ==
+                getPeerIdentifierString(hit.destination)) {
+          return 0;
+        }
+      }
+      searchHits.push_back(hit);
+      logger->logEvent("Search match " + std::string(hit.matchId.name) + " (" +
+                       File_Util_Handler::digestToHex(hit.matchId.hash,
+                                                      sizeof(hit.matchId.hash)) +
+                       ") at " + getPeerIdentifierString(hit.destination));
+      return 0;
+    }
+    char buffer[WIRE_MAX_MESSAGE_LENGTH];
+    int length = Wire_Codec::encode(hit, buffer, sizeof(buffer));
+    if (length < 0 ||
+        eventLoop.sendMessage(from.connection, buffer, length, T_NAME_SEARCH_HIT) < 0) {
+      logger->logError("Error forwarding search hit to " + getPeerIdentifierString(from.id));
+      return -1;
+    }
+    return 0;
+  }
+  catch (std::exception & e) {
+    logger->logError("Error handling search hit: " + std::string(e.what()));
     return -1;
   }
 }
+
+/**
+ * @brief returns the matches found so far for searches started here
+*/
+std::vector<Name_Search_Hit> Node::getSearchHits() {
+  std::lock_guard<std::mutex> lock(searchMutex);
+  return searchHits;
+}
+
+/**
+ * @brief sets the host name peers reach the node at, call before init
+ * the name of the machine is used if never set
+*/
+void Node::setHostName(std::string hostName) {
+  this->hostName = hostName;
+}
+
+/**
+ * @brief sets the function called with hits for queries started by the node
+*/
+void Node::setQueryHitCallback(Query_Hit_Callback callback) {
+  onQueryHit = callback;
+}
+
+/**
+ * @brief turns encryption of file transfers on or off, call before run
+ * if on, downloads require sources to encrypt and uploads are only served under a
+ * session key. transfers are in the clear if never turned on
+ * @param encrypt are transfers encrypted
+ * @param presharedKey mixed into every session key, empty for none
+*/
+void Node::setTransferSecurity(bool encrypt, const std::vector<unsigned char> & presharedKey) {
+  sessions.setSecurity(encrypt, presharedKey);
+}
+
+/**
+ * @brief returns the number of connected peers
+*/
+size_t Node::getPeerCount() {
+  return peerCount.load();
+}
+
+/**
+ * @brief returns the bytes received from and sent to all peers
+ * returns (bytes in, bytes out) of the connections open now
+*/
+std::pair<uint64_t, uint64_t> Node::getTraffic() {
+  std::pair<uint64_t, uint64_t> total(0, 0);
+  for (const std::pair<const Connection_Id, std::pair<uint64_t, uint64_t> > & it :
+       eventLoop.getConnectionBytes()) {
+    total.first += it.second.first;
+    total.second += it.second.second;
+  }
+  return total;
+}
+
+/**
+ * @brief initializes the node
+ * necessary initialization steps of the node, sets up selfInfo and the event loop
+ * and starts indexing shared files on indexPool. queries are answered for files
+ * hashed so far while indexing runs. changes to shared files afterwards are picked
+ * up by fileWatcher
+*/
+void Node::init() {
+  memset(&selfInfo, 0, sizeof(selfInfo));
+  if (hostName != "") {
+    strncpy(selfInfo.hostName, hostName.c_str(), sizeof(selfInfo.hostName) - 1);
+  }
+  else if (gethostname(selfInfo.hostName, sizeof(selfInfo.hostName) - 1) < 0) {
+    strcpy(selfInfo.hostName, "localhost");
+  }
+  selfInfo.port = messagePort;
+  unsigned char id[(sizeof(selfInfo.id) - 1) / 2];
+  RAND_bytes(id, sizeof(id));
+  strcpy(selfInfo.id, File_Util_Handler::digestToHex(id, sizeof(id)).c_str());
+  sessions.setSelfId(selfInfo.id);
+  pongCache.setSelf(selfInfo);
+  pongCache.refresh(std::vector<Peer_Identifier>());
+
+  if (eventLoop.init() < 0) {
+    throw std::runtime_error("Error initializing event loop");
+  }
+  eventLoop.setMessageCallback([this](Connection_Id connection,
+                                      int type,
+                                      const char * message,
+                                      int length) {
+    std::string payload(message, length);
+    bool queued = messagePool.submit(
+        [this, connection, type, payload] {
+          uint64_t start = Metrics_Registry::nowMicros();
+          dispatchMessage(connection, type, payload);
+          Metrics_Registry::observe(HISTOGRAM_DISPATCH, Metrics_Registry::nowMicros() - start);
+        },
+        messageClass(type));
+    if (!queued) {
+      Metrics_Registry::add(METRIC_MESSAGES_REFUSED);
+    }
+  });
+  eventLoop.setCloseCallback([this](Connection_Id connection) { handleDisconnect(connection); });
+  // control goes out before hits, hits before floods, floods are shed from full queues
+  eventLoop.setClassCallback(&Node::messageClass);
+
+  // watch before walking so files created during the walk are not missed
+  if (fileWatcher.start() < 0) {
+    logger->logError("Error watching shared files, changes need a restart");
+  }
+  if (fileUtilHandler.refreshIndex(&indexPool) < 0) {
+    logger->logError("Error indexing shared files");
+  }
+}
+
+/**
+   * @brief runs the node
+   * serves peers until the message loop stops
+  */
+void Node::run() {
+  std::thread messages(&Node::messageThread, this);
+  std::thread files(&Node::fileThread, this);
+  std::thread routes(&Node::routeThread, this);
+  std::thread users(&Node::userThread, this);
+  // downloads interrupted by the last shutdown are resumed by routeThread once peers join
+  joinNetwork(famousPeers);
+  messages.join();
+  routes.join();
+  files.join();
+  users.join();
+}
+
+/**
+ * @brief makes run return
+ * stops the event loop, the route thread and the file and user listeners, run
+ * returns once all are done. file requests being served are cut off, stop returns
+ * once they and the download workers ended
+*/
+void Node::stop() {
+  {
+    std::lock_guard<std::mutex> lock(stopMutex);
+    stopping = true;
+    // a shut down socket fails accept and recv, so the threads using it see stopping
+    if (fileServerFd >= 0) {
+      shutdown(fileServerFd, SHUT_RDWR);
+    }
+    if (userServerFd >= 0) {
+      shutdown(userServerFd, SHUT_RDWR);
+    }
+    for (int fd : fileClients) {
+      shutdown(fd, SHUT_RDWR);
+    }
+  }
+  stopCond.notify_all();
+  eventLoop.stop();
+  downloadManager.stop();
+  std::unique_lock<std::mutex> lock(stopMutex);
+  fileClientsCond.wait(lock, [this] { return fileClients.empty(); });
+}
\ No newline at end of file
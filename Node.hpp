@@ -1,16 +1,75 @@
+#ifndef NODE_HPP
+#define NODE_HPP
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
+#include <set>
 #include <shared_mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "DownloadManager.hpp"
+#include "EventLoop.hpp"
 #include "FileUtilHandler.hpp"
+#include "FileWatcher.hpp"
+#include "HashTree.hpp"
+#include "Metrics.hpp"
+#include "PongCache.hpp"
 #include "Protocol.hpp"
+#include "QueryCache.hpp"
+#include "RouteTable.hpp"
+#include "SessionCache.hpp"
 #include "SocketUtilHandler.hpp"
+#include "ThreadPool.hpp"
+#include "TransferCipher.hpp"
+#include "WireCodec.hpp"
+
+#define USER_REQUEST_TIMEOUT_MS 2000   // longest wait for a request or a send on the user port
+#define USER_REQUEST_MAX_LENGTH 4096   // longest request header read on the user port
+#define FILE_IDLE_TIMEOUT_MS 60000     // file connections without a request this long are closed
+#define MESSAGE_WEIGHT_CONTROL 8       // control messages handled per round of messagePool
+#define MESSAGE_WEIGHT_HIT 4           // hits handled per round of messagePool
+#define MESSAGE_WEIGHT_FLOOD 1         // queries and searches handled per round of messagePool
+#define MESSAGE_QUEUE_MAX 65536        // received messages waiting in messagePool before more drop
+#define JOIN_BACKOFF_MS 1000           // wait before pinging a host that refused or was unreachable
+#define JOIN_BACKOFF_MAX_MS 60000      // longest wait, it doubles with every failure in a row
+#define JOIN_BACKOFF_MAX_HOSTS 1024    // hosts waited for, expired ones make room first
+#define HASH_TREE_CACHE_MAX 64         // hash trees kept in memory, least recently served go first
+
+// when joinNetwork may ping a host again
+struct Join_Backoff_t {
+  std::chrono::steady_clock::time_point until;  //
+  int delayMs;                                  // wait set by the last failure
+};
+typedef struct Join_Backoff_t Join_Backoff;
+
+// a hash tree served to downloaders
+struct Cached_Tree_t {
+  File_Entry entry;                 // entry of the file the tree was built from
+  std::shared_ptr<Hash_Tree> tree;  //
+  uint64_t lastUsed;                // hashTreeUses when the tree was last served
+};
+typedef struct Cached_Tree_t Cached_Tree;
+
+// called with the hits for queries started by the node, returns true if the
+// hit was consumed, false to download the file from the holder
+typedef std::function<bool(const Query_Hit & queryHit)> Query_Hit_Callback;
 
 class Node {
   Logger * logger;                           //
   File_Util_Handler fileUtilHandler;         //
   Socket_Util_Handler socketUtilHandler;     //
   Peer_Identifier selfInfo;                  // info of this node
+  std::string hostName;                      // host name given to peers, empty for gethostname
+  Query_Hit_Callback onQueryHit;             //
+  Session_Cache sessions;                    // peer id -> key of encrypted file transfers
                                              //
   int maxPeers;                              // maximum number of total peers
   int maxInitPeers;                          // maximum number of initial peers
@@ -23,21 +82,50 @@ class Node {
   std::vector<Peer_Identifier> famousPeers;  // a vector of peers
   std::map<std::string,                      //
            Peer_Info>                        //
-      peers;                                 // hostname-> peer info (peer id, fd)
-  std::map<std::string,                      //
-           Query>                            //
-      queries;                               // string(query id)-> query
+      peers;                                 // host:port -> peer info (peer id, connection)
+  std::atomic<size_t> peerCount;             // size of peers, read without peersMutex
+  Pong_Cache pongCache;                      // pongs answered to pings without peersMutex
+  std::map<Connection_Id,                    //
+           Peer_Identifier>                  //
+      pendingPeers;                          // connection -> peer pinged but not ponged yet
   std::map<std::string,                      //
-           Query_Status>                     //
-      queryStatuses;                         // hash -> query status
+           Join_Backoff>                     //
+      backoffs;                              // host:port -> when joinNetwork may ping it again
+  Query_Cache queries;                       // query key -> peer it came from and status
+  Query_Cache searches;                      // search key -> peer it came from
+  unsigned int lastSearchTimestamp;          // timestamp of the last search started here
+  std::vector<Name_Search_Hit> searchHits;   // matches found for searches started here
+  Route_Table publishedTable;                // route table last sent to peers
+  uint64_t publishedVersion;                 // filePaths version publishedTable was built from
+  uint64_t publishedSequence;                // sequence of the patch that made publishedTable
+  std::set<Connection_Id> routedPeers;       // connections of peers sent publishedTable
+  std::map<Connection_Id,                    //
+           Route_Table>                      //
+      peerTables;                            // connection -> route table received from the peer
+  File_Index filePaths;                      // hash -> shared file entry
   std::map<std::string,                      //
-           std::string>                      //
-      filePaths;                             // hash -> file path
-                                             //
-  std::mutex peersMutex;                     // mutex for peers map
-  std::mutex queriesMutex;                   // mutex for queries map
-  std::mutex queryStatusesMutex;             // mutex for query statuses map
-  std::mutex filePathsMutex;                 // mutex for file paths map
+           Cached_Tree>                      //
+      hashTrees;                             // hash -> tree served to downloaders
+  uint64_t hashTreeUses;                     // trees served so far, orders hashTrees by use
+  std::mutex peersMutex;                     // mutex for peers, pendingPeers and backoffs
+  std::mutex hashTreesMutex;                 // mutex for hashTrees and hashTreeUses
+  std::mutex searchMutex;                    // mutex for last search timestamp and hits
+  std::mutex routeMutex;                     // mutex for published table and routed peers
+  std::shared_mutex peerTablesMutex;         // mutex for peer tables map
+  std::atomic<bool> stopping;                // stop was called
+  std::mutex stopMutex;                      // mutex for stopCond, the server fds and fileClients
+  std::condition_variable stopCond;          // wakes the route thread when stopping
+  std::chrono::steady_clock::time_point      //
+      nextResume;                            // when routeThread looks for download sources
+  int fileServerFd;                          // listening socket of fileThread, -1 if none
+  int userServerFd;                          // listening socket of userThread, -1 if none
+  std::set<int> fileClients;                 // sockets of the file requests being served
+  std::condition_variable fileClientsCond;   // notified when a file request ends
+  Thread_Pool indexPool;                     // workers hashing shared files
+  File_Watcher fileWatcher;                  // keeps filePaths in sync with the disk
+  Event_Loop eventLoop;                      // serves all peer connections
+  Thread_Pool messagePool;                   // workers handling received messages
+  Download_Manager downloadManager;          // downloads of files found by queries
 
  public:
   Node(Logger * logger,
@@ -50,10 +138,15 @@ class Node {
        int queryTimeToLive,
        int cacheTimeToCheck,
        int chacheTimeToLive,
+       int indexThreads,
+       int messageThreads,
        std::vector<Peer_Identifier> famousPeers) :
       logger(logger),
-      fileUtilHandler(logger, filePath),
+      fileUtilHandler(logger, filePath, &filePaths, &indexPool),
       socketUtilHandler(logger),
+      hostName(),
+      onQueryHit(),
+      sessions(logger),
       maxPeers(maxPeers),
       maxInitPeers(maxInitPeers),
       messagePort(messagePort),
@@ -63,40 +156,85 @@ class Node {
       cacheTimeToCheck(cacheTimeToCheck),
       chacheTimeToLive(chacheTimeToLive),
       famousPeers(famousPeers),
-      queries(),
-      queryStatuses(),
+      peers(),
+      peerCount(0),
+      pongCache(),
+      pendingPeers(),
+      backoffs(),
+      queries(cacheTimeToCheck, chacheTimeToLive),
+      searches(cacheTimeToCheck, chacheTimeToLive),
+      lastSearchTimestamp(0),
+      searchHits(),
+      publishedTable(),
+      publishedVersion(0),
+      publishedSequence(0),
+      routedPeers(),
+      peerTables(),
       filePaths(),
+      hashTrees(),
+      hashTreeUses(0),
       peersMutex(),
-      queriesMutex(),
-      queryStatusesMutex(),
-      filePathsMutex(){};
+      hashTreesMutex(),
+      searchMutex(),
+      routeMutex(),
+      peerTablesMutex(),
+      stopping(false),
+      stopMutex(),
+      stopCond(),
+      nextResume(),
+      fileServerFd(-1),
+      userServerFd(-1),
+      fileClients(),
+      fileClientsCond(),
+      // 0 is one thread per hardware thread, negative counts would wrap to huge ones
+      indexPool(indexThreads < 0 ? 1 : indexThreads),
+      fileWatcher(logger, &fileUtilHandler, filePath),
+      eventLoop(logger),
+      messagePool(messageThreads < 0 ? 1 : messageThreads,
+                  {MESSAGE_WEIGHT_CONTROL, MESSAGE_WEIGHT_HIT, MESSAGE_WEIGHT_FLOOD},
+                  MESSAGE_QUEUE_MAX),
+      downloadManager(logger, &fileUtilHandler, &socketUtilHandler, &sessions){};
 
   /**
  * @brief query identifier -> string
- * returns a string representation of a query identifier to be used as keys
- * 
+ * returns a readable representation of a query identifier for logs,
+ * queries are keyed by Query_Cache::makeKey
 */
   std::string getQueryIdentifierString(Query_Identifier id);
 
+  /**
+ * @brief peer identifier -> string
+ * returns host:port of a peer to be used as keys
+*/
+  std::string getPeerIdentifierString(Peer_Identifier id);
+
   /**
  * @brief sends a ping to a peer
  * returns 0 successful, -1 otherwise failed
 */
-  int sendPing(Peer_Identifier peer, Ping ping, int fd);
+  int sendPing(Peer_Identifier peer, Ping ping, Connection_Id connection);
 
-  int sendPong(Pong pong, int fd);
+  /**
+ * @brief returns the pongs pings are answered with
+ * rebuilds them from the peers when they are older than PONG_CACHE_REFRESH_MS
+*/
+  std::shared_ptr<const Cached_Pong> cachedPong();
 
   /**
  * @brief sends a pong to a peer
+ * the pong comes from pongCache, peersMutex is only taken to add the sender
+ * when there is room for it.
  * returns 0 if node allowed to add ping sender as a peer, 1 if not, -1 otherwise failed
 */
-  int handlePing(Ping ping, int fd);
+  int handlePing(Ping ping, Connection_Id connection);
 
   /**
    * @brief handles a pong from a peer
    * returns 0 if allowed to add peer, 1 if not, -1 otherwise failed
+   * if not allowed, tries to join the peers listed in the pong instead
+   * @param connection the connection that received the pong
 */
-  int handlePong(Pong pong);
+  int handlePong(Pong pong, Connection_Id connection);
 
   /**
  * @brief joins the network
@@ -106,6 +244,14 @@ class Node {
 */
   int joinNetwork(std::vector<Peer_Identifier> & peers);
 
+  /**
+ * @brief makes joinNetwork skip a host that refused or could not be reached
+ * the wait starts at JOIN_BACKOFF_MS and doubles with every failure in a row up
+ * to JOIN_BACKOFF_MAX_MS, caller holds peersMutex
+ * @param key host:port of the host
+*/
+  void backOff(const std::string & key);
+
   /**
  * @brief generates and sends a query to all peers
  * returns a query if successful, nullptr otherwise failed
@@ -117,39 +263,110 @@ class Node {
  * @brief sends a query to a peer
  * returns 0 if successful, -1 otherwise failed
  * @param query the query to send
- * @param fd the file descriptor of the peer to send the query to
+ * @param connection the connection of the peer to send the query to
 */
-  int sendQuery(Query query, int fd);
+  int sendQuery(Query query, Connection_Id connection);
 
   /**
  * @brief sends a query hit back
  * returns 0 if successful, -1 otherwise failed
  * @param query the query to send
- * @param fd the file descriptor of the peer to send the query hit to
+ * @param connection the connection of the peer to send the query hit to
 */
-  int sendQueryHit(Query query, int fd);
+  int sendQueryHit(Query query, Connection_Id connection);
+
+  /**
+ * @brief checks if a query on its last hop is worth sending to a peer
+ * returns false if the route table of the peer rules the file out
+ * @param connection the connection of the peer
+ * @param hash the hash of the queried file
+*/
+  bool peerMayHave(Connection_Id connection, const unsigned char * hash);
+
+  /**
+ * @brief returns the connections of all peers except one
+ * @param except the connection to leave out, -1 for none
+*/
+  std::vector<Connection_Id> peerConnections(Connection_Id except);
 
   /**
  * @brief handles a query from a peer
  * returns 0 if has the file, 1 if not, -1 otherwise failed 
  * if has the file, sends a query hit back along the path
- * if doesn't have the file, sends the query to all peers except the previous peer
+ * if doesn't have the file, sends the query to all peers except the previous peer.
+ * on the last hop only peers whose route table may contain the file get it
  * cache the query accordingly
- * @param fd the file descriptor that received the query
+ * @param query the received query
+ * @param connection the connection that received the query
 */
-  int handleQuery(int fd);
+  int handleQuery(Query query, Connection_Id connection);
 
   /**
  * @brief handles a query hit from a peer
  * returns 0 if successful, -1 otherwise failed
  * if the query hit was sent by the node, send a file request
  * otherwise, send the query back
- * @param fd the file descriptor that received the query hit
+ * @param queryHit the received query hit
+ * @param connection the connection that received the query hit
+*/
+  int handleQueryHit(Query_Hit queryHit, Connection_Id connection);
+
+  /**
+ * @brief sends the whole published route table to a new peer
+ * later changes reach the peer through publishRouteTable
+ * returns 0 if successful, -1 otherwise failed
+ * @param connection the connection of the peer
 */
-  int handleQueryHit(int fd);
+  int sendRouteTable(Connection_Id connection);
+
+  /**
+ * @brief rebuilds the route table from the shared files and sends the change
+ * does nothing if no shared file changed since the last call.
+ * returns 0 if successful, -1 otherwise failed
+*/
+  int publishRouteTable();
+
+  /**
+ * @brief applies a route table patch received from a peer
+ * asks the peer for its whole table when the patch shows the tables went apart.
+ * returns 0 if successful, -1 otherwise failed
+ * @param patch the received patch
+ * @param connection the connection that received the patch
+*/
+  int handleRoutePatch(const std::string & patch, Connection_Id connection);
+
+  /**
+ * @brief sends the whole published route table again to a peer that asked for it
+ * returns 0 if successful, -1 otherwise failed
+ * @param connection the connection that received the request
+*/
+  int handleRouteReset(Connection_Id connection);
+
+  /**
+ * @brief returns the MESSAGE_CLASS_ of a message type
+ * hits are answers somebody is waiting for, floods are queries and searches
+*/
+  static int messageClass(int type);
+
+  /**
+ * @brief passes a message received by the event loop to its handler
+ * runs on messagePool, unknown or malformed messages are dropped
+ * @param connection the connection that received the message
+ * @param type the type of the message
+ * @param message the payload of the message
+*/
+  void dispatchMessage(Connection_Id connection, int type, std::string message);
+
+  /**
+ * @brief forgets a peer whose connection was closed
+ * @param connection the closed connection
+*/
+  void handleDisconnect(Connection_Id connection);
 
   /**
  * sends query identifier to the file holder
+ * hands the holder to downloadManager as a source of the file, every hit for the
+ * same file adds another source.
  * returns 0 if successful, -1 otherwise failed
  * @param queryHit the query hit contains file owner address and the query identifier to request
 */
@@ -157,36 +374,185 @@ class Node {
 
   /**
    * @brief handles a file request from a peer
+   * serves requests until the peer closes the connection or leaves it idle for
+   * FILE_IDLE_TIMEOUT_MS, requesters pool connections. a Query_Identifier asks
+   * for the whole file, a File_Range for part of it. each is answered with the
+   * File_Meta of the file followed by the requested bytes, sent straight from the
+   * page cache with sendfile. a Hash_Tree_Meta asks for the leaves of the file,
+   * they are sent in the clear and unauthenticated even under a session, downloaders
+   * only trust them as far as the hash of the whole file confirms them.
+   * a Secure_Check asks if transfers can be encrypted, a Session_Hello then
+   * agrees on or resumes the session key and switches the connection to it. with
+   * transfers encrypted, file requests without a session close the connection.
+   * closes fd when done
    * returns 0 if successful, -1 otherwise failed
    * @param fd the file descriptor that received the file request
   */
   int handleFileRequest(int fd);
 
+  /**
+ * @brief closes the socket of a file request, the last one wakes stop
+*/
+  void closeFileRequest(int fd);
+
+  /**
+ * @brief answers one file request with the File_Meta and the requested bytes
+ * returns 0 if successful, -1 if the connection is unusable
+ * @param fd the file descriptor of the requester
+ * @param range the requested file and bytes
+ * @param wholeFile true to ignore the range and send the whole file
+ * @param cipher seals the meta and the bytes, NULL to send them in the clear
+*/
+  int serveFileRange(int fd, File_Range range, bool wholeFile, Transfer_Cipher * cipher);
+
+  /**
+ * @brief returns the hash tree of a shared file, built on first use
+ * trees are saved in the tree directory and HASH_TREE_CACHE_MAX of them are kept
+ * in memory, until the file changes. returns nullptr if the file is not shared
+ * @param hash the hash of the file in hex
+ * @param leafSize bytes covered by each leaf
+*/
+  std::shared_ptr<Hash_Tree> getHashTree(const std::string & hash, uint32_t leafSize);
+
+  /**
+ * @brief answers a hash tree request with the Hash_Tree_Meta and the leaves
+ * returns 0 if successful, -1 if the connection is unusable
+ * @param fd the file descriptor of the requester
+ * @param request the requested file and leaf size
+*/
+  int serveHashTree(int fd, Hash_Tree_Meta request);
+
+  /**
+ * @brief serves the message port and all peer connections on the event loop
+ * returns when the event loop stops. returns 0 if successful, -1 otherwise failed
+*/
   int messageThread();
 
+  /**
+ * @brief accepts file requests on the file port, each served on its own thread
+ * returns 0 when the node stops, -1 if the file port could not be opened
+*/
   int fileThread();
 
+  /**
+ * @brief queries for the partial downloads no source is fetching
+ * queries once the node has peers, then every DOWNLOAD_RESUME_MS until sources
+ * answer. called by routeThread
+*/
+  void resumeDownloads();
+
+  /**
+ * @brief publishes changes of the route table every ROUTE_TABLE_UPDATE_MS
+ * and looks for sources of stalled downloads. returns 0 when the node stops
+*/
+  int routeThread();
+
+  /**
+ * @brief serves metrics on the user port, one connection at a time
+ * returns 0 when the node stops, -1 if the user port could not be opened
+*/
   int userThread();
 
-  //TODO
+  /**
+ * @brief answers one http request on the user port and closes fd
+ * GET /metrics returns getMetrics, anything else is not found
+ * @param fd the file descriptor of the client
+*/
+  void serveUserRequest(int fd);
+
+  /**
+ * @brief returns the metrics of the node in the prometheus text format
+ * adds bytes per peer and the sizes of the caches and indexes to the
+ * process wide metrics of Metrics_Registry
+*/
+  std::string getMetrics();
 
   /**
  * @brief sends a name search to all peers
+ * matches arrive as Name_Search_Hits and are collected in searchHits
  * returns 0 if successful, -1 otherwise failed
  * @param fileName the name of the file to search for
  * returns -1 if filename too long as well
 */
   int sendSearch(std::string fileName);
 
+  /**
+ * @brief handles a name search from a peer
+ * answers with the best matching shared files and forwards the search to all
+ * peers except the previous peer until its ttl runs out
+ * returns 0 if a file matched, 1 if not, -1 otherwise failed
+ * @param search the received search
+ * @param connection the connection that received the search
+*/
+  int handleNameSearch(Name_Search search, Connection_Id connection);
+
+  /**
+ * @brief handles a name search hit from a peer
+ * keeps the hit if the search was started here, otherwise sends it back along the path
+ * returns 0 if successful, -1 otherwise failed
+ * @param hit the received hit
+ * @param connection the connection that received the hit
+*/
+  int handleNameSearchHit(Name_Search_Hit hit, Connection_Id connection);
+
+  /**
+ * @brief returns the matches found so far for searches started here
+*/
+  std::vector<Name_Search_Hit> getSearchHits();
+
+  /**
+ * @brief sets the host name peers reach the node at, call before init
+ * the name of the machine is used if never set
+*/
+  void setHostName(std::string hostName);
+
+  /**
+ * @brief sets the function called with hits for queries started by the node
+*/
+  void setQueryHitCallback(Query_Hit_Callback callback);
+
+  /**
+ * @brief turns encryption of file transfers on or off, call before run
+ * if on, downloads require sources to encrypt and uploads are only served under a
+ * session key. transfers are in the clear if never turned on
+ * @param encrypt are transfers encrypted
+ * @param presharedKey mixed into every session key, empty for none
+*/
+  void setTransferSecurity(bool encrypt, const std::vector<unsigned char> & presharedKey);
+
+  /**
+ * @brief returns the number of connected peers
+*/
+  size_t getPeerCount();
+
+  /**
+ * @brief returns the bytes received from and sent to all peers
+ * returns (bytes in, bytes out) of the connections open now
+*/
+  std::pair<uint64_t, uint64_t> getTraffic();
+
   /**
  * @brief initializes the node
- * necessary initialization steps of the node
- * 
+ * necessary initialization steps of the node, sets up selfInfo and the event loop
+ * and starts indexing shared files on indexPool. queries are answered for files
+ * hashed so far while indexing runs. changes to shared files afterwards are picked
+ * up by fileWatcher
 */
   void init();
 
   /**
    * @brief runs the node
+   * serves peers until the message loop stops
   */
   void run();
-};
\ No newline at end of file
+
+  /**
+ * @brief makes run return
+ * stops the event loop, the route thread and the file and user listeners, run
+ * returns once all are done. file requests being served are cut off, stop returns
+ * once they and the download workers ended
+*/
+  void stop();
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "PongCache.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @brief returns the key of a host in hosts
+*/
+std::string Pong_Cache::hostKey(const Peer_Identifier & host) {
+  return std::string(host.hostName, strnlen(host.hostName, sizeof(host.hostName))) + ":" +
+         std::to_string(host.port);
+}
+
+/**
+ * @brief sets the host this node is reached at, it is never listed
+*/
+void Pong_Cache::setSelf(const Peer_Identifier & self) {
+  std::lock_guard<std::mutex> lock(hostsMutex);
+  selfKey = hostKey(self);
+  hosts.erase(selfKey);
+}
+
+/**
+ * @brief records that a host was alive
+ * @param host a host that answered a ping of this node or was accepted as a peer,
+ * hosts only named in pings and pongs are not checked and never added
+*/
+void Pong_Cache::addHost(const Peer_Identifier & host) {
+  std::string key = hostKey(host);
+  Clock::time_point seen = Clock::now();
+  std::lock_guard<std::mutex> lock(hostsMutex);
+  if (key == selfKey) {
+    return;
+  }
+  std::map<std::string, Known_Host>::iterator it = hosts.find(key);
+  if (it != hosts.end()) {
+    it->second.id = host;
+    it->second.lastSeen = seen;
+    return;
+  }
+  if (hosts.size() >= PONG_CACHE_MAX_HOSTS) {
+    std::map<std::string, Known_Host>::iterator oldest = hosts.begin();
+    for (it = hosts.begin(); it != hosts.end(); ++it) {
+      if (it->second.lastSeen < oldest->second.lastSeen) {
+        oldest = it;
+      }
+    }
+    hosts.erase(oldest);
+  }
+  Known_Host known;
+  known.id = host;
+  known.lastSeen = seen;
+  hosts[key] = known;
+}
+
+/**
+ * @brief makes the next claimRefresh rebuild the pongs, called when the peers change
+*/
+void Pong_Cache::invalidate() {
+  stale = true;
+}
+
+/**
+ * @brief returns true if the caller has to rebuild the pongs with refresh
+ * the pongs are rebuilt when invalidated or older than PONG_CACHE_REFRESH_MS,
+ * only one caller at a time is told to, until its refresh is done
+*/
+bool Pong_Cache::claimRefresh() {
+  std::shared_ptr<const Cached_Pong> pong = std::atomic_load(&current);
+  if (!stale && pong != nullptr &&
+      Clock::now() - pong->built < std::chrono::milliseconds(PONG_CACHE_REFRESH_MS)) {
+    return false;
+  }
+  if (refreshing.exchange(true)) {
+    return false;
+  }
+  // a change after this point is not in the snapshot the caller takes next
+  stale = false;
+  return true;
+}
+
+/**
+ * @brief rebuilds the pongs from the known hosts, ends a claimRefresh
+ * @param neighbours the direct peers of the node, counted as seen now
+*/
+void Pong_Cache::refresh(const std::vector<Peer_Identifier> & neighbours) {
+  for (const Peer_Identifier & neighbour : neighbours) {
+    addHost(neighbour);
+  }
+  Pong pong;
+  memset(&pong, 0, sizeof(pong));
+  pong.timestamp = time(NULL);
+  {
+    std::lock_guard<std::mutex> lock(hostsMutex);
+    Clock::time_point oldest = Clock::now() - std::chrono::milliseconds(PONG_CACHE_HOST_TTL_MS);
+    std::vector<const Known_Host *> fresh;
+    std::map<std::string, Known_Host>::iterator it = hosts.begin();
+    while (it != hosts.end()) {
+      if (it->second.lastSeen < oldest) {
+        it = hosts.erase(it);
+        continue;
+      }
+      fresh.push_back(&it->second);
+      ++it;
+    }
+    size_t listed = std::min(fresh.size(), (size_t)PONG_MAX_PEERS);
+    std::partial_sort(fresh.begin(),
+                      fresh.begin() + listed,
+                      fresh.end(),
+                      [](const Known_Host * a, const Known_Host * b) {
+                        return a->lastSeen > b->lastSeen;
+                      });
+    for (size_t i = 0; i < listed; i++) {
+      pong.peers[i] = fresh[i]->id;
+    }
+    pong.num_peers = listed;
+  }
+
+  std::shared_ptr<Cached_Pong> pongs = std::make_shared<Cached_Pong>();
+  char buffer[WIRE_MAX_MESSAGE_LENGTH];
+  pong.allowed = true;
+  int length = Wire_Codec::encode(pong, buffer, sizeof(buffer));
+  pongs->accepted.assign(buffer, length < 0 ? 0 : length);
+  pong.allowed = false;
+  length = Wire_Codec::encode(pong, buffer, sizeof(buffer));
+  pongs->refused.assign(buffer, length < 0 ? 0 : length);
+  pongs->built = Clock::now();
+  std::atomic_store(&current, std::shared_ptr<const Cached_Pong>(pongs));
+  Metrics_Registry::add(METRIC_PONG_REFRESHES);
+  refreshing = false;
+}
+
+/**
+ * @brief returns the current pongs, nullptr before the first refresh
+*/
+std::shared_ptr<const Cached_Pong> Pong_Cache::get() {
+  return std::atomic_load(&current);
+}
+
+/**
+ * @brief returns the number of known hosts
+*/
+size_t Pong_Cache::hostCount() {
+  std::lock_guard<std::mutex> lock(hostsMutex);
+  return hosts.size();
+}
@@ -0,0 +1,107 @@
+#ifndef PONG_CACHE_HPP
+#define PONG_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Metrics.hpp"
+#include "Protocol.hpp"
+#include "WireCodec.hpp"
+
+#define PONG_CACHE_REFRESH_MS 1000      // age of the cached pongs before they are rebuilt
+#define PONG_CACHE_HOST_TTL_MS 600000   // known hosts not seen this long are forgotten
+#define PONG_CACHE_MAX_HOSTS 256        // known hosts kept, the least recently seen go first
+#define PONG_MAX_PEERS 10               // entries of Pong.peers
+
+// the encoded pongs every ping is answered with until the next refresh
+struct Cached_Pong_t {
+  std::string accepted;                         // payload with allowed set
+  std::string refused;                          // payload with allowed unset
+  std::chrono::steady_clock::time_point built;  //
+};
+typedef struct Cached_Pong_t Cached_Pong;
+
+// a host this node heard of
+struct Known_Host_t {
+  Peer_Identifier id;                              //
+  std::chrono::steady_clock::time_point lastSeen;  // last pong, accepted ping or refresh naming it
+};
+typedef struct Known_Host_t Known_Host;
+
+// pongs built once and answered to many pings. the pong lists the
+// PONG_MAX_PEERS most recently seen hosts, direct peers and hosts this node
+// exchanged a ping and pong with, never hosts it only heard of. it is rebuilt
+// when the peers change or every PONG_CACHE_REFRESH_MS, so ping floods are
+// answered without walking the peers of the node
+class Pong_Cache {
+  std::shared_ptr<const Cached_Pong> current;  // read and replaced with atomic_load/atomic_store
+  std::map<std::string, Known_Host> hosts;     // host:port -> host
+  std::string selfKey;                         // host:port of this node, never listed
+  std::mutex hostsMutex;                       // mutex for hosts and selfKey
+  std::atomic<bool> refreshing;                // a caller of claimRefresh is rebuilding
+  std::atomic<bool> stale;                     // the peers changed since the last rebuild
+
+ public:
+  Pong_Cache() :
+      current(),
+      hosts(),
+      selfKey(),
+      hostsMutex(),
+      refreshing(false),
+      stale(true) {}
+
+  /**
+ * @brief returns the key of a host in hosts
+*/
+  static std::string hostKey(const Peer_Identifier & host);
+
+  /**
+ * @brief sets the host this node is reached at, it is never listed
+*/
+  void setSelf(const Peer_Identifier & self);
+
+  /**
+ * @brief records that a host was alive
+ * @param host a host that answered a ping of this node or was accepted as a peer,
+ * hosts only named in pings and pongs are not checked and never added
+*/
+  void addHost(const Peer_Identifier & host);
+
+  /**
+ * @brief makes the next claimRefresh rebuild the pongs, called when the peers change
+*/
+  void invalidate();
+
+  /**
+ * @brief returns true if the caller has to rebuild the pongs with refresh
+ * the pongs are rebuilt when invalidated or older than PONG_CACHE_REFRESH_MS,
+ * only one caller at a time is told to, until its refresh is done
+*/
+  bool claimRefresh();
+
+  /**
+ * @brief rebuilds the pongs from the known hosts, ends a claimRefresh
+ * @param neighbours the direct peers of the node, counted as seen now
+*/
+  void refresh(const std::vector<Peer_Identifier> & neighbours);
+
+  /**
+ * @brief returns the current pongs, nullptr before the first refresh
+*/
+  std::shared_ptr<const Cached_Pong> get();
+
+  /**
+ * @brief returns the number of known hosts
+*/
+  size_t hostCount();
+};
+
+#endif
@@ -1,3 +1,6 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
 #include <cstddef>
 #include <cstdint>
 
@@ -10,11 +13,22 @@
 #define T_QUERY 301
 #define T_QUERY_HIT 302
 #define T_QUERY_STATUS 303
+#define T_ROUTE_PATCH 304
+#define T_ROUTE_RESET 305
 #define T_FILE_META 400
+#define T_FILE_RANGE 401
+#define T_HASH_TREE 402
 #define T_NAME_SEARCH 500
 #define T_SEARCH_MATCH_IDENTIFIER 501
 #define T_NAME_SEARCH_HIT 502
 #define T_SECURE_CHECK 600
+#define T_SESSION_HELLO 601
+
+// scheduling classes of peer messages, lower classes are handled and sent first
+#define MESSAGE_CLASS_CONTROL 0  // pings, pongs and route patches
+#define MESSAGE_CLASS_HIT 1      // query and search hits somebody is waiting for
+#define MESSAGE_CLASS_FLOOD 2    // queries and searches, shed first under load
+#define MESSAGE_CLASSES 3
 
 // message used to identify a peer
 // 100
@@ -25,10 +39,14 @@ struct Peer_Identifier_t {
 };
 typedef struct Peer_Identifier_t Peer_Identifier;
 
+// identifies a connection to a peer, unlike file descriptors ids are never
+// reused so a late message or close cannot be mistaken for a newer connection
+typedef int64_t Connection_Id;
+
 // 101
 struct Peer_Info_t {
-  Peer_Identifier id;  //
-  int fd;              // file descriptor of the peer
+  Peer_Identifier id;        //
+  Connection_Id connection;  // connection to the peer, -1 for none
 };
 typedef struct Peer_Info_t Peer_Info;
 
@@ -92,6 +110,14 @@ struct Query_Status_t {
 };
 typedef struct Query_Status_t Query_Status;
 
+// 304
+// message used to update the route table a peer keeps for the sender,
+// the payload is a patch encoded by Route_Table::patchFrom or fullPatch
+
+// 305
+// message asking a peer for its whole route table after a patch did not match
+// the checksum, the payload is empty
+
 // 400
 // message used to identify a file transfer
 struct File_Meta_t {
@@ -104,12 +130,38 @@ struct File_Meta_t {
 };
 typedef struct File_Meta_t File_Meta;
 
+// 401
+// message used to request part of a file, answered with File_Meta and the bytes
+struct File_Range_t {
+  unsigned char hash[32];  // hash of the file
+  uint64_t offset;         // first byte requested
+  uint64_t length;         // number of bytes requested, 0 to only get the File_Meta
+};
+typedef struct File_Range_t File_Range;
+
+// 402
+// message used to request the merkle tree of a file, only hash and leafSize are set.
+// answered with the same message followed by leafCount 32 byte leaf hashes
+struct Hash_Tree_Meta_t {
+  unsigned char hash[32];  // sha256 of the whole file
+  unsigned char root[32];  // root of the merkle tree over the leaves
+  uint64_t fileSize;       // size of the file
+  uint32_t leafSize;       // bytes covered by each leaf
+  uint32_t leafCount;      // number of leaves
+  bool available;          // does the sender have the file
+};
+typedef struct Hash_Tree_Meta_t Hash_Tree_Meta;
+
 // 500
-// message used to search for a file by name
+// message used to search for a file by name, every holder answers with a
+// Name_Search_Hit per match, at most SEARCH_MAX_RESULTS best matches first
+#define SEARCH_MAX_RESULTS 10
 struct Name_Search_t {
   Peer_Identifier source;  // initiator of search
-  char name[256];          // name of the file
-  unsigned int timestamp;  //
+  char name[256];          // keywords or part of the name of the file
+  unsigned int timestamp;  // unique among the searches of the initiator
+  Peer_Identifier prev;    // previous peer in the search path
+  int ttl;                 // time to live
 };
 typedef struct Name_Search_t Name_Search;
 
@@ -138,3 +190,18 @@ struct Secure_Check_t {
   bool secure;          // sender allows secure transmissionz
 };
 typedef struct Secure_Check_t Secure_Check;
+
+// 601
+// message used to agree on the key of encrypted file transfers, sent by the
+// requester after a Secure_Check and answered with the same message. a known
+// session is resumed without a key exchange
+struct Session_Hello_t {
+  char id[16];                  // Peer_Identifier.id of the sender
+  unsigned char session[16];    // session to resume, zero to agree on a new one
+  unsigned char publicKey[32];  // ephemeral x25519 key, zero when resuming
+  bool resumed;                 // set in the answer if session was resumed
+};
+typedef struct Session_Hello_t Session_Hello;
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include "QueryCache.hpp"
+
+#define TIMER_WHEEL_MASK ((1u << TIMER_WHEEL_BITS) - 1)
+
+/**
+ * @brief mixes the bits of x, the finalizer of splitmix64
+*/
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/**
+ * @brief returns the slot a key hashes to in a table of capacity slots
+*/
+static size_t slotOf(const Query_Key & key, size_t capacity) {
+  uint64_t hash;
+  memcpy(&hash, key.hash, sizeof(hash));
+  return mix(hash ^ key.source ^ ((uint64_t)key.timestamp << 32)) & (capacity - 1);
+}
+
+/**
+ * @brief puts an entry in the slot of its expiry relative to current
+*/
+void Timer_Wheel::place(const Timer_Entry & entry) {
+  uint64_t expiry = std::max(entry.expiry, current);
+  uint64_t delta = expiry - current;
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+    level++;
+  }
+  if (delta >= (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))) {
+    // beyond the wheel, parked in the last slot and placed again when it comes up
+    expiry = current + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+  }
+  size_t slot = (expiry >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+  slots[(level << TIMER_WHEEL_BITS) + slot].push_back(entry);
+}
+
+/**
+ * @brief schedules a key to expire at a tick
+ * @param key the key to expire
+ * @param expiry the tick at which the key expires
+*/
+void Timer_Wheel::schedule(const Query_Key & key, uint64_t expiry) {
+  Timer_Entry entry;
+  entry.key = key;
+  entry.expiry = expiry;
+  place(entry);
+  count++;
+}
+
+/**
+ * @brief processes every tick up to now
+ * @param now the current tick
+ * @param expired will be appended the keys that expired
+*/
+void Timer_Wheel::advance(uint64_t now, std::vector<Query_Key> & expired) {
+  std::vector<Timer_Entry> due;
+  while (current <= now) {
+    if (count == 0) {
+      current = now + 1;
+      return;
+    }
+    // move the slots of higher levels down when the levels below wrap around
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if ((current & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1)) != 0) {
+        break;
+      }
+      size_t slot = (current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+      due.clear();
+      due.swap(slots[(level << TIMER_WHEEL_BITS) + slot]);
+      for (const Timer_Entry & entry : due) {
+        place(entry);
+      }
+    }
+    due.clear();
+    due.swap(slots[current & TIMER_WHEEL_MASK]);
+    for (const Timer_Entry & entry : due) {
+      if (entry.expiry <= current) {
+        expired.push_back(entry.key);
+        count--;
+      }
+      else {
+        place(entry);
+      }
+    }
+    current++;
+  }
+}
+
+/**
+ * @brief returns the number of keys on the wheel
+*/
+size_t Timer_Wheel::size() const {
+  return count;
+}
+
+/**
+ * @param cacheTimeToCheck seconds between expiry checks
+ * @param cacheTimeToLive seconds a query is remembered
+*/
+Query_Cache::Query_Cache(int cacheTimeToCheck, int cacheTimeToLive) :
+    table(QUERY_CACHE_MIN_CAPACITY),
+    used(0),
+    tickSeconds(std::max(cacheTimeToCheck, 1)),
+    ttlTicks(std::max<uint64_t>((std::max(cacheTimeToLive, 1) + tickSeconds - 1) / tickSeconds,
+                                1)),
+    start(std::chrono::steady_clock::now()),
+    wheel(0),
+    expired(),
+    cacheMutex() {
+  for (Query_Cache_Entry & entry : table) {
+    entry.used = false;
+  }
+}
+
+/**
+ * @brief returns the current tick of the wheel
+*/
+uint64_t Query_Cache::currentTick() const {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() -
+                                                          start)
+             .count() /
+         tickSeconds;
+}
+
+/**
+ * @brief builds the key of a query
+*/
+Query_Key Query_Cache::makeKey(const Query_Identifier & id) {
+  Query_Key key;
+  memset(&key, 0, sizeof(key));
+  // fnv-1a over the host name and port of the initiator
+  uint64_t source = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < sizeof(id.source.hostName) && id.source.hostName[i] != '\0'; i++) {
+    source = (source ^ (unsigned char)id.source.hostName[i]) * 0x100000001b3ULL;
+  }
+  source = (source ^ id.source.port) * 0x100000001b3ULL;
+  key.source = source;
+  key.timestamp = id.timestamp;
+  memcpy(key.hash, id.hash, sizeof(key.hash));
+  return key;
+}
+
+/**
+ * @brief returns the slot of key, or the empty slot it would be inserted at
+*/
+size_t Query_Cache::find(const Query_Key & key) const {
+  size_t mask = table.size() - 1;
+  size_t slot = slotOf(key, table.size());
+  while (table[slot].used && !(table[slot].key == key)) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+/**
+ * @brief removes the entry in a slot, moving back entries that probed past it
+*/
+void Query_Cache::erase(size_t slot) {
+  size_t mask = table.size() - 1;
+  size_t hole = slot;
+  size_t next = (hole + 1) & mask;
+  while (table[next].used) {
+    size_t home = slotOf(table[next].key, table.size());
+    // an entry may fill the hole if the hole lies between its home and itself
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      table[hole] = table[next];
+      hole = next;
+    }
+    next = (next + 1) & mask;
+  }
+  table[hole].used = false;
+  used--;
+}
+
+/**
+ * @brief doubles the capacity of the table
+*/
+void Query_Cache::grow() {
+  std::vector<Query_Cache_Entry> old(table.size() * 2);
+  old.swap(table);
+  for (Query_Cache_Entry & entry : table) {
+    entry.used = false;
+  }
+  for (const Query_Cache_Entry & entry : old) {
+    if (entry.used) {
+      table[find(entry.key)] = entry;
+    }
+  }
+}
+
+/**
+ * @brief removes the entries whose time to live has passed, caller holds cacheMutex
+*/
+void Query_Cache::expire() {
+  expired.clear();
+  wheel.advance(currentTick(), expired);
+  for (const Query_Key & key : expired) {
+    size_t slot = find(key);
+    if (table[slot].used) {
+      erase(slot);
+    }
+  }
+}
+
+/**
+ * @brief adds a query unless it is already cached
+ * returns true if the query was added, false if it was seen before
+ * @param key the key of the query
+ * @param from the peer the query came from
+ * @param status the status of the query
+*/
+bool Query_Cache::insert(const Query_Key & key,
+                         const Peer_Info & from,
+                         const Query_Status & status) {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  expire();
+  size_t slot = find(key);
+  if (table[slot].used) {
+    return false;
+  }
+  if (2 * (used + 1) > table.size()) {
+    grow();
+    slot = find(key);
+  }
+  table[slot].key = key;
+  table[slot].from = from;
+  table[slot].status = status;
+  table[slot].used = true;
+  used++;
+  wheel.schedule(key, currentTick() + ttlTicks);
+  return true;
+}
+
+/**
+ * @brief looks up the peer a query came from
+ * returns true and fills from if the query is cached, false otherwise
+ * @param key the key of the query
+ * @param from will be set to the peer the query came from
+*/
+bool Query_Cache::lookup(const Query_Key & key, Peer_Info & from) {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  expire();
+  size_t slot = find(key);
+  if (!table[slot].used) {
+    return false;
+  }
+  from = table[slot].from;
+  return true;
+}
+
+/**
+ * @brief marks a cached query as answered
+ * returns true if the query is cached, false otherwise
+*/
+bool Query_Cache::markSuccess(const Query_Key & key) {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  size_t slot = find(key);
+  if (!table[slot].used) {
+    return false;
+  }
+  table[slot].status.success = true;
+  return true;
+}
+
+/**
+ * @brief returns the number of cached queries
+*/
+size_t Query_Cache::size() const {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  return used;
+}
@@ -0,0 +1,162 @@
+#ifndef QUERY_CACHE_HPP
+#define QUERY_CACHE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "Protocol.hpp"
+
+#define QUERY_CACHE_MIN_CAPACITY 1024  // slots allocated for an empty cache
+#define TIMER_WHEEL_BITS 6             // slots per wheel level is 1 << TIMER_WHEEL_BITS
+#define TIMER_WHEEL_LEVELS 4           // levels of the timer wheel
+
+// fixed size key of a query, derived from its Query_Identifier
+struct Query_Key_t {
+  uint64_t source;         // hash of the initiator host name and port
+  uint32_t timestamp;      // timestamp of the query
+  uint32_t reserved;       // always 0
+  unsigned char hash[32];  // hash of the file being queried
+
+  bool operator==(const Query_Key_t & other) const {
+    return memcmp(this, &other, sizeof(other)) == 0;
+  }
+};
+typedef struct Query_Key_t Query_Key;
+
+// a query key waiting on the timer wheel
+struct Timer_Entry_t {
+  Query_Key key;    //
+  uint64_t expiry;  // tick at which the key expires
+};
+typedef struct Timer_Entry_t Timer_Entry;
+
+// hierarchical timer wheel. level l holds keys expiring up to
+// 1 << (TIMER_WHEEL_BITS * (l + 1)) ticks ahead, a slot of a higher level is
+// moved down a level when the lower level wraps around
+class Timer_Wheel {
+  std::vector<std::vector<Timer_Entry> > slots;  // TIMER_WHEEL_LEVELS levels of slots
+  uint64_t current;                              // next tick to process
+  size_t count;                                  // keys on the wheel
+
+  /**
+ * @brief puts an entry in the slot of its expiry relative to current
+*/
+  void place(const Timer_Entry & entry);
+
+ public:
+  Timer_Wheel(uint64_t now) :
+      slots(TIMER_WHEEL_LEVELS << TIMER_WHEEL_BITS), current(now), count(0) {}
+
+  /**
+ * @brief schedules a key to expire at a tick
+ * @param key the key to expire
+ * @param expiry the tick at which the key expires
+*/
+  void schedule(const Query_Key & key, uint64_t expiry);
+
+  /**
+ * @brief processes every tick up to now
+ * @param now the current tick
+ * @param expired will be appended the keys that expired
+*/
+  void advance(uint64_t now, std::vector<Query_Key> & expired);
+
+  /**
+ * @brief returns the number of keys on the wheel
+*/
+  size_t size() const;
+};
+
+// a query seen by this node
+struct Query_Cache_Entry_t {
+  Query_Key key;        //
+  Peer_Info from;       // peer the query came from, connection is -1 if started by this node
+  Query_Status status;  //
+  bool used;            // is the slot taken
+};
+typedef struct Query_Cache_Entry_t Query_Cache_Entry;
+
+// open addressing table of recently seen queries. each query expires
+// chacheTimeToLive seconds after it was added, the wheel is advanced every
+// cacheTimeToCheck seconds by whichever call comes first
+class Query_Cache {
+  std::vector<Query_Cache_Entry> table;  // linear probing, power of two capacity
+  size_t used;                           // taken slots
+  uint64_t tickSeconds;                  // seconds per tick of the wheel
+  uint64_t ttlTicks;                     // ticks until an entry expires
+  std::chrono::steady_clock::time_point start;  // tick 0
+  Timer_Wheel wheel;                            //
+  std::vector<Query_Key> expired;               // reused by expire
+  mutable std::mutex cacheMutex;                // mutex for everything above
+
+  /**
+ * @brief returns the current tick of the wheel
+*/
+  uint64_t currentTick() const;
+
+  /**
+ * @brief returns the slot of key, or the empty slot it would be inserted at
+*/
+  size_t find(const Query_Key & key) const;
+
+  /**
+ * @brief removes the entry in a slot, moving back entries that probed past it
+*/
+  void erase(size_t slot);
+
+  /**
+ * @brief doubles the capacity of the table
+*/
+  void grow();
+
+  /**
+ * @brief removes the entries whose time to live has passed, caller holds cacheMutex
+*/
+  void expire();
+
+ public:
+  /**
+ * @param cacheTimeToCheck seconds between expiry checks
+ * @param cacheTimeToLive seconds a query is remembered
+*/
+  Query_Cache(int cacheTimeToCheck, int cacheTimeToLive);
+
+  /**
+ * @brief builds the key of a query
+*/
+  static Query_Key makeKey(const Query_Identifier & id);
+
+  /**
+ * @brief adds a query unless it is already cached
+ * returns true if the query was added, false if it was seen before
+ * @param key the key of the query
+ * @param from the peer the query came from
+ * @param status the status of the query
+*/
+  bool insert(const Query_Key & key, const Peer_Info & from, const Query_Status & status);
+
+  /**
+ * @brief looks up the peer a query came from
+ * returns true and fills from if the query is cached, false otherwise
+ * @param key the key of the query
+ * @param from will be set to the peer the query came from
+*/
+  bool lookup(const Query_Key & key, Peer_Info & from);
+
+  /**
+ * @brief marks a cached query as answered
+ * returns true if the query is cached, false otherwise
+*/
+  bool markSuccess(const Query_Key & key);
+
+  /**
+ * @brief returns the number of cached queries
+*/
+  size_t size() const;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "RouteTable.hpp"
+
+/**
+ * @brief returns the i-th bit position of a hash, file hashes are uniform already
+*/
+static uint32_t bitOf(const unsigned char * hash, int i) {
+  uint32_t position;
+  memcpy(&position, hash + 4 * i, sizeof(position));
+  return position & (ROUTE_TABLE_BITS - 1);
+}
+
+/**
+ * @brief appends a base 128 varint
+*/
+static void putVarint(std::string & out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((char)value);
+}
+
+/**
+ * @brief reads a base 128 varint
+ * returns false if data ends before the varint does
+*/
+static bool getVarint(const unsigned char * data, size_t length, size_t & offset, uint64_t & value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && offset < length; shift += 7) {
+    unsigned char byte = data[offset++];
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief sets the bits of a file hash
+ * @param hash the 32 byte hash of the file
+*/
+void Route_Table::add(const unsigned char * hash) {
+  for (int i = 0; i < ROUTE_TABLE_HASHES; i++) {
+    uint32_t bit = bitOf(hash, i);
+    words[bit / 64] |= 1ULL << (bit % 64);
+  }
+}
+
+/**
+ * @brief checks the bits of a file hash
+ * returns false if the peer cannot have the file, true if it may have it
+ * @param hash the 32 byte hash of the file
+*/
+bool Route_Table::mayContain(const unsigned char * hash) const {
+  for (int i = 0; i < ROUTE_TABLE_HASHES; i++) {
+    uint32_t bit = bitOf(hash, i);
+    if ((words[bit / 64] & (1ULL << (bit % 64))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief encodes the bits that differ from another table
+ * @param previous the table the receiver has
+ * @param sequence the sequence number of the patch
+ * @param flags ROUTE_PATCH_ flags of the patch
+*/
+std::string Route_Table::encode(const Route_Table & previous, uint64_t sequence, int flags) const {
+  std::string patch;
+  patch.push_back((char)ROUTE_TABLE_VERSION);
+  putVarint(patch, ROUTE_TABLE_BITS);
+  patch.push_back((char)flags);
+  putVarint(patch, sequence);
+  uint64_t sum = checksum();
+  for (int b = 0; b < 8; b++) {
+    patch.push_back((char)(sum >> (8 * b)));
+  }
+  uint64_t skipped = 0;
+  for (size_t i = 0; i < words.size(); i++) {
+    uint64_t changed = words[i] ^ previous.words[i];
+    if (changed == 0) {
+      skipped++;
+      continue;
+    }
+    putVarint(patch, skipped);
+    for (int b = 0; b < 8; b++) {
+      patch.push_back((char)(changed >> (8 * b)));
+    }
+    skipped = 0;
+  }
+  return patch;
+}
+
+/**
+ * @brief encodes the bits that differ from another table
+ * returns the patch, a patch of equal tables only carries the header
+ * @param previous the table the receiver has
+ * @param sequence the sequence number of the patch, one more than the one of the
+ * patch that made previous
+*/
+std::string Route_Table::patchFrom(const Route_Table & previous, uint64_t sequence) const {
+  return encode(previous, sequence, 0);
+}
+
+/**
+ * @brief encodes the whole table, the receiver replaces its table with it
+ * @param sequence the sequence number of the patch that made the table
+*/
+std::string Route_Table::fullPatch(uint64_t sequence) const {
+  return encode(Route_Table(), sequence, ROUTE_PATCH_FULL);
+}
+
+/**
+ * @brief applies a patch whose turn it is
+ * returns 1 if the table no longer matches the checksum of the patch, 0 otherwise
+*/
+int Route_Table::apply(const Route_Patch & patch) {
+  if (patch.full) {
+    std::fill(words.begin(), words.end(), 0);
+    synced = true;
+  }
+  for (const std::pair<size_t, uint64_t> & change : patch.changes) {
+    words[change.first] ^= change.second;
+  }
+  next = patch.sequence + 1;
+  if (synced && checksum() != patch.checksum) {
+    synced = false;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief applies a patch received from a peer
+ * patches coming before an earlier one wait for it, a full patch replaces the
+ * table and the patches before it.
+ * returns 0 if successful, 1 if the table no longer matches the one of the peer
+ * and a full patch has to be asked for, -1 if the patch is malformed, the table
+ * is unchanged then
+ * @param data the patch
+ * @param length the length of data
+*/
+int Route_Table::applyPatch(const char * data, size_t length) {
+  const unsigned char * bytes = (const unsigned char *)data;
+  size_t offset = 0;
+  uint64_t bits;
+  if (length < 1 || bytes[offset++] != ROUTE_TABLE_VERSION ||
+      !getVarint(bytes, length, offset, bits) || bits != ROUTE_TABLE_BITS || offset >= length) {
+    return -1;
+  }
+  Route_Patch patch;
+  patch.full = (bytes[offset++] & ROUTE_PATCH_FULL) != 0;
+  if (!getVarint(bytes, length, offset, patch.sequence) || length - offset < 8) {
+    return -1;
+  }
+  patch.checksum = 0;
+  for (int b = 0; b < 8; b++) {
+    patch.checksum |= (uint64_t)bytes[offset++] << (8 * b);
+  }
+  // validate the whole patch before touching the table
+  size_t word = 0;
+  while (offset < length) {
+    uint64_t skipped;
+    if (!getVarint(bytes, length, offset, skipped) || skipped >= words.size() - word ||
+        length - offset < 8) {
+      return -1;
+    }
+    word += skipped;
+    uint64_t changed = 0;
+    for (int b = 0; b < 8; b++) {
+      changed |= (uint64_t)bytes[offset++] << (8 * b);
+    }
+    patch.changes.push_back(std::make_pair(word, changed));
+    word++;
+  }
+  // a full patch may repeat the sequence of the last patch when it was asked for
+  if (patch.full ? patch.sequence + 1 < next : patch.sequence < next) {
+    return 0;
+  }
+  if (!patch.full && patch.sequence > next) {
+    if (waiting.size() >= ROUTE_TABLE_MAX_WAITING) {
+      // the missing patch is not coming, start over from a full patch
+      bool wasSynced = synced;
+      waiting.clear();
+      synced = false;
+      return wasSynced ? 1 : 0;
+    }
+    waiting[patch.sequence] = patch;
+    return 0;
+  }
+  int status = apply(patch);
+  waiting.erase(waiting.begin(), waiting.upper_bound(patch.sequence));
+  while (!waiting.empty() && waiting.begin()->first == next) {
+    status |= apply(waiting.begin()->second);
+    waiting.erase(waiting.begin());
+  }
+  return status;
+}
+
+/**
+ * @brief checks if a received table can be used to rule files out
+ * returns false before the first full patch and after a failed checksum
+*/
+bool Route_Table::isSynced() const {
+  return synced;
+}
+
+/**
+ * @brief returns the checksum of the bits sent with every patch
+*/
+uint64_t Route_Table::checksum() const {
+  // fnv-1a over the words
+  uint64_t sum = 14695981039346656037ULL;
+  for (uint64_t w : words) {
+    sum = (sum ^ w) * 1099511628211ULL;
+  }
+  return sum;
+}
+
+/**
+ * @brief checks if two tables have the same bits
+*/
+bool Route_Table::equals(const Route_Table & other) const {
+  return words == other.words;
+}
+
+/**
+ * @brief returns the fraction of bits set
+*/
+double Route_Table::fill() const {
+  size_t set = 0;
+  for (uint64_t w : words) {
+    set += __builtin_popcountll(w);
+  }
+  return (double)set / ROUTE_TABLE_BITS;
+}
@@ -0,0 +1,123 @@
+#ifndef ROUTE_TABLE_HPP
+#define ROUTE_TABLE_HPP
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#define ROUTE_TABLE_BITS (1 << 17)   // bits of a table, a power of two
+#define ROUTE_TABLE_HASHES 3         // bits set per shared file
+#define ROUTE_TABLE_UPDATE_MS 1000   // how often the local table is rebuilt
+#define ROUTE_TABLE_VERSION 2        // first byte of every patch
+#define ROUTE_PATCH_FULL 1           // flag of a patch replacing the whole table
+#define ROUTE_TABLE_MAX_WAITING 64   // patches kept while an earlier one is missing
+
+// a patch decoded by Route_Table::applyPatch
+struct Route_Patch_t {
+  bool full;                                          // replaces the table
+  uint64_t sequence;                                  //
+  uint64_t checksum;                                  // checksum of the table after the patch
+  std::vector<std::pair<size_t, uint64_t> > changes;  // word -> bits to flip
+};
+typedef struct Route_Patch_t Route_Patch;
+
+// bloom filter of the hashes a peer shares, used to route queries.
+// tables are exchanged as patches, each patch holds the xor of the bits that
+// changed, so the first patch of a connection is the xor against an empty table.
+// a patch is ROUTE_TABLE_VERSION, the table size in bits as a varint, a flags
+// byte, the sequence number of the patch as a varint and the checksum of the
+// table after it in 8 bytes, then runs of a varint count of unchanged 64 bit
+// words followed by one changed word, words are in little endian order.
+// received patches are applied in sequence order and the checksum is compared
+// after each, a receiver whose table went apart asks for a full patch
+class Route_Table {
+  std::vector<uint64_t> words;                // ROUTE_TABLE_BITS / 64 words
+  bool synced;                                // received tables: matches the table of the peer
+  uint64_t next;                              // received tables: sequence of the next patch
+  std::map<uint64_t, Route_Patch> waiting;    // received tables: sequence -> patch that came
+                                              // before an earlier one
+
+  /**
+ * @brief encodes the bits that differ from another table
+ * @param previous the table the receiver has
+ * @param sequence the sequence number of the patch
+ * @param flags ROUTE_PATCH_ flags of the patch
+*/
+  std::string encode(const Route_Table & previous, uint64_t sequence, int flags) const;
+
+  /**
+ * @brief applies a patch whose turn it is
+ * returns 1 if the table no longer matches the checksum of the patch, 0 otherwise
+*/
+  int apply(const Route_Patch & patch);
+
+ public:
+  Route_Table() : words(ROUTE_TABLE_BITS / 64, 0), synced(false), next(0), waiting() {}
+
+  /**
+ * @brief sets the bits of a file hash
+ * @param hash the 32 byte hash of the file
+*/
+  void add(const unsigned char * hash);
+
+  /**
+ * @brief checks the bits of a file hash
+ * returns false if the peer cannot have the file, true if it may have it
+ * @param hash the 32 byte hash of the file
+*/
+  bool mayContain(const unsigned char * hash) const;
+
+  /**
+ * @brief encodes the bits that differ from another table
+ * returns the patch, a patch of equal tables only carries the header
+ * @param previous the table the receiver has
+ * @param sequence the sequence number of the patch, one more than the one of the
+ * patch that made previous
+*/
+  std::string patchFrom(const Route_Table & previous, uint64_t sequence) const;
+
+  /**
+ * @brief encodes the whole table, the receiver replaces its table with it
+ * @param sequence the sequence number of the patch that made the table
+*/
+  std::string fullPatch(uint64_t sequence) const;
+
+  /**
+ * @brief applies a patch received from a peer
+ * patches coming before an earlier one wait for it, a full patch replaces the
+ * table and the patches before it.
+ * returns 0 if successful, 1 if the table no longer matches the one of the peer
+ * and a full patch has to be asked for, -1 if the patch is malformed, the table
+ * is unchanged then
+ * @param data the patch
+ * @param length the length of data
+*/
+  int applyPatch(const char * data, size_t length);
+
+  /**
+ * @brief checks if a received table can be used to rule files out
+ * returns false before the first full patch and after a failed checksum until
+ * the next full patch
+*/
+  bool isSynced() const;
+
+  /**
+ * @brief returns the checksum of the bits sent with every patch
+*/
+  uint64_t checksum() const;
+
+  /**
+ * @brief checks if two tables have the same bits
+*/
+  bool equals(const Route_Table & other) const;
+
+  /**
+ * @brief returns the fraction of bits set
+*/
+  double fill() const;
+};
+
+#endif
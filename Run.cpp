@@ -79,6 +79,34 @@ int main(int argc, char * argv[]) {
     int queryTimeToLive = config["queryTimeToLive"];
     int cacheTimeToCheck = config["cacheTimeToCheck"];
     int chacheTimeToLive = config["cacheTimeToLive"];
+    int indexThreads = config.value("indexThreads", 0);
+    int messageThreads = config.value("messageThreads", 4);
+    size_t logRingSize = config.value("logRingSize", LOG_RING_SIZE);
+    int logFlushIntervalMs = config.value("logFlushIntervalMs", LOG_FLUSH_INTERVAL_MS);
+    bool logBlockWhenFull = config.value("logBlockWhenFull", false);
+    int logLevel = Logger::parseLevel(config.value("logLevel", std::string("event")));
+    if (logLevel < 0) {
+      std::cout << "====================\nUnknown logLevel, use debug, event, error or none"
+                   "\n====================\n";
+      return 1;
+    }
+    if (indexThreads < 0 || messageThreads < 0) {
+      std::cout << "====================\nindexThreads and messageThreads must be 0 (one per"
+                   " hardware thread) or more\n====================\n";
+      return 1;
+    }
+    bool encryptTransfers = config.value("encryptTransfers", false);
+    std::string transferKeyHex = config.value("transferKey", std::string(""));
+    std::vector<unsigned char> transferKey;
+    if (transferKeyHex != "") {
+      transferKey.resize(TRANSFER_KEY_SIZE);
+      if (transferKeyHex.length() != 2 * TRANSFER_KEY_SIZE ||
+          !File_Util_Handler::hexToDigest(transferKeyHex, transferKey.data())) {
+        std::cout << "====================\ntransferKey must be 64 hex digits or empty"
+                     "\n====================\n";
+        return 1;
+      }
+    }
     std::vector<Peer_Identifier> peers;
     for (nlohmann::json peer : config["famousNodes"]) {
       Peer_Identifier peerIdentifier;
@@ -94,7 +122,8 @@ int main(int argc, char * argv[]) {
       peers.push_back(peerIdentifier);
     }
 
-    Logger logger(logFilePath);
+    Logger logger(logFilePath, logRingSize, logFlushIntervalMs, logBlockWhenFull);
+    logger.setLevel(logLevel);
     logger.init();
     Node node(&logger,
               fileDirectory,
@@ -106,7 +135,10 @@ int main(int argc, char * argv[]) {
               queryTimeToLive,
               cacheTimeToCheck,
               chacheTimeToLive,
+              indexThreads,
+              messageThreads,
               peers);
+    node.setTransferSecurity(encryptTransfers, transferKey);
     try {
       node.init();
       node.run();
@@ -0,0 +1,280 @@
+#include "SessionCache.hpp"
+
+static const unsigned char zeroBytes[32] = {0};
+
+/**
+ * @brief generates an ephemeral x25519 key pair
+ * returns the key pair, NULL if failed
+*/
+static EVP_PKEY * generateKey() {
+  EVP_PKEY * key = NULL;
+  EVP_PKEY_CTX * ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+  if (ctx == NULL || 1 != EVP_PKEY_keygen_init(ctx) || 1 != EVP_PKEY_keygen(ctx, &key)) {
+    key = NULL;
+  }
+  EVP_PKEY_CTX_free(ctx);
+  return key;
+}
+
+/**
+ * @brief sets the 32 byte public key of a key pair
+ * returns 0 if successful, -1 otherwise
+*/
+static int publicKeyOf(EVP_PKEY * key, unsigned char * publicKey) {
+  size_t length = 32;
+  if (1 != EVP_PKEY_get_raw_public_key(key, publicKey, &length) || length != 32) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief sets the Peer_Identifier.id peers know this node by
+*/
+void Session_Cache::setSelfId(const std::string & selfId) {
+  this->selfId = selfId;
+}
+
+/**
+ * @brief turns encryption of transfers on or off, call before transfers start
+ * @param enabled are transfers encrypted
+ * @param presharedKey mixed into every session key, empty for none
+*/
+void Session_Cache::setSecurity(bool enabled, const std::vector<unsigned char> & presharedKey) {
+  this->enabled = enabled;
+  this->presharedKey = presharedKey;
+}
+
+/**
+ * @brief returns true if transfers are encrypted
+*/
+bool Session_Cache::isEnabled() {
+  return enabled;
+}
+
+/**
+ * @brief returns a peer id from a Peer_Identifier.id field
+*/
+std::string Session_Cache::peerKey(const char * id) {
+  return std::string(id, strnlen(id, sizeof(((Peer_Identifier *)0)->id)));
+}
+
+/**
+ * @brief returns the fresh session of a peer
+ * returns true if there is one, expired sessions are dropped
+*/
+bool Session_Cache::lookup(const std::string & peer, Session & session) {
+  std::lock_guard<std::mutex> lock(sessionsMutex);
+  std::map<std::string, Session>::iterator it = sessions.find(peer);
+  if (it == sessions.end()) {
+    return false;
+  }
+  if (it->second.created + SESSION_TIME_TO_LIVE <= time(NULL) ||
+      it->second.bytes >= SESSION_MAX_BYTES) {
+    sessions.erase(it);
+    return false;
+  }
+  session = it->second;
+  return true;
+}
+
+/**
+ * @brief stores the session of a peer, replacing an older one
+*/
+void Session_Cache::insert(const std::string & peer, const Session & session) {
+  std::lock_guard<std::mutex> lock(sessionsMutex);
+  if (sessions.size() >= SESSION_CACHE_MAX_PEERS && sessions.count(peer) == 0) {
+    std::map<std::string, Session>::iterator oldest = sessions.begin();
+    for (std::map<std::string, Session>::iterator it = sessions.begin(); it != sessions.end();
+         ++it) {
+      if (it->second.created < oldest->second.created) {
+        oldest = it;
+      }
+    }
+    sessions.erase(oldest);
+  }
+  sessions[peer] = session;
+}
+
+/**
+ * @brief sets the key of a session from the x25519 exchange
+ * returns 0 if successful, -1 otherwise
+ * @param own the ephemeral key pair of this node
+ * @param peerPublic the public key of the peer
+ * @param requesterPublic the public key of the requester of the session
+ * @param accepterPublic the public key of the peer that accepted it
+ * @param session its id is set, its key will be set
+*/
+int Session_Cache::deriveKey(EVP_PKEY * own,
+                             const unsigned char * peerPublic,
+                             const unsigned char * requesterPublic,
+                             const unsigned char * accepterPublic,
+                             Session & session) {
+  unsigned char secret[32];
+  size_t secretLength = sizeof(secret);
+  EVP_PKEY * peerKey = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peerPublic, 32);
+  EVP_PKEY_CTX * ctx = EVP_PKEY_CTX_new(own, NULL);
+  // fails for public keys of low order, their shared secret is zero
+  bool agreed = peerKey != NULL && ctx != NULL && 1 == EVP_PKEY_derive_init(ctx) &&
+                1 == EVP_PKEY_derive_set_peer(ctx, peerKey) &&
+                1 == EVP_PKEY_derive(ctx, secret, &secretLength);
+  EVP_PKEY_CTX_free(ctx);
+  EVP_PKEY_free(peerKey);
+  if (!agreed) {
+    return -1;
+  }
+
+  // both public keys and the session id are bound into the key
+  std::string info = SESSION_KEY_INFO;
+  info.append((const char *)session.id, sizeof(session.id));
+  info.append((const char *)requesterPublic, 32);
+  info.append((const char *)accepterPublic, 32);
+  size_t keyLength = sizeof(session.key);
+  EVP_PKEY_CTX * kdf = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+  bool derived = kdf != NULL && 1 == EVP_PKEY_derive_init(kdf) &&
+                 1 == EVP_PKEY_CTX_set_hkdf_md(kdf, EVP_sha256()) &&
+                 (presharedKey.empty() ||
+                  1 == EVP_PKEY_CTX_set1_hkdf_salt(kdf, presharedKey.data(), presharedKey.size())) &&
+                 1 == EVP_PKEY_CTX_set1_hkdf_key(kdf, secret, secretLength) &&
+                 1 == EVP_PKEY_CTX_add1_hkdf_info(
+                          kdf, (const unsigned char *)info.data(), info.size()) &&
+                 1 == EVP_PKEY_derive(kdf, session.key, &keyLength) &&
+                 keyLength == sizeof(session.key);
+  EVP_PKEY_CTX_free(kdf);
+  OPENSSL_cleanse(secret, sizeof(secret));
+  return derived ? 0 : -1;
+}
+
+/**
+ * @brief agrees on a session with the peer at the other end of fd
+ * resumes the session of the peer if there is one, otherwise runs an exchange.
+ * returns 0 if successful, -1 otherwise
+ * @param socketUtilHandler the handler to send and receive with
+ * @param fd the connection to the peer, after a successful Secure_Check
+ * @param peer the Peer_Identifier.id of the peer
+ * @param session will be set to the session
+*/
+int Session_Cache::connect(Socket_Util_Handler & socketUtilHandler,
+                           int fd,
+                           const std::string & peer,
+                           Session & session) {
+  Session_Hello hello;
+  Session_Hello reply;
+  memset(&hello, 0, sizeof(hello));
+  strncpy(hello.id, selfId.c_str(), sizeof(hello.id) - 1);
+  int length;
+  int type;
+  if (lookup(peer, session)) {
+    memcpy(hello.session, session.id, sizeof(hello.session));
+    if (socketUtilHandler.sendMessage(fd, (char *)&hello, sizeof(hello), T_SESSION_HELLO) <
+            0 ||
+        socketUtilHandler.recvMessage(fd, (char *)&reply, sizeof(reply), &length, &type) < 0 ||
+        type != T_SESSION_HELLO || length != sizeof(reply)) {
+      return -1;
+    }
+    if (reply.resumed && memcmp(reply.session, session.id, sizeof(session.id)) == 0) {
+      Metrics_Registry::add(METRIC_SESSIONS_RESUMED);
+      return 0;
+    }
+    // the peer forgot the session, agree on a new one
+    memset(hello.session, 0, sizeof(hello.session));
+  }
+
+  EVP_PKEY * own = generateKey();
+  if (own == NULL || publicKeyOf(own, hello.publicKey) < 0) {
+    EVP_PKEY_free(own);
+    logger->logError("Error generating session key pair");
+    return -1;
+  }
+  int status = -1;
+  if (socketUtilHandler.sendMessage(fd, (char *)&hello, sizeof(hello), T_SESSION_HELLO) >= 0 &&
+      socketUtilHandler.recvMessage(fd, (char *)&reply, sizeof(reply), &length, &type) >= 0 &&
+      type == T_SESSION_HELLO && length == sizeof(reply) && !reply.resumed &&
+      memcmp(reply.publicKey, zeroBytes, sizeof(reply.publicKey)) != 0) {
+    memcpy(session.id, reply.session, sizeof(session.id));
+    session.created = time(NULL);
+    session.bytes = 0;
+    status = deriveKey(own, reply.publicKey, hello.publicKey, reply.publicKey, session);
+  }
+  EVP_PKEY_free(own);
+  if (status < 0) {
+    logger->logError("Error agreeing on a session with " + peer);
+    return -1;
+  }
+  insert(peer, session);
+  Metrics_Registry::add(METRIC_SESSIONS_AGREED);
+  return 0;
+}
+
+/**
+ * @brief answers a Session_Hello received on fd
+ * resumes the session named in hello if it is still fresh, otherwise runs an
+ * exchange if hello carries a public key.
+ * returns 1 if a session was agreed, 0 if the requester has to send its public
+ * key, -1 otherwise
+ * @param socketUtilHandler the handler to send with
+ * @param fd the connection to the requester
+ * @param hello the hello received
+ * @param session will be set to the session if one was agreed
+*/
+int Session_Cache::accept(Socket_Util_Handler & socketUtilHandler,
+                          int fd,
+                          const Session_Hello & hello,
+                          Session & session) {
+  std::string peer = peerKey(hello.id);
+  Session_Hello reply;
+  memset(&reply, 0, sizeof(reply));
+  strncpy(reply.id, selfId.c_str(), sizeof(reply.id) - 1);
+  int status = 0;
+  if (memcmp(hello.session, zeroBytes, sizeof(hello.session)) != 0 && lookup(peer, session) &&
+      memcmp(session.id, hello.session, sizeof(session.id)) == 0) {
+    memcpy(reply.session, session.id, sizeof(reply.session));
+    reply.resumed = true;
+    status = 1;
+    Metrics_Registry::add(METRIC_SESSIONS_RESUMED);
+  }
+  else if (memcmp(hello.publicKey, zeroBytes, sizeof(hello.publicKey)) != 0) {
+    EVP_PKEY * own = generateKey();
+    if (own == NULL || publicKeyOf(own, reply.publicKey) < 0 ||
+        1 != RAND_bytes(session.id, sizeof(session.id)) ||
+        deriveKey(own, hello.publicKey, hello.publicKey, reply.publicKey, session) < 0) {
+      EVP_PKEY_free(own);
+      logger->logError("Error agreeing on a session with " + peer);
+      return -1;
+    }
+    EVP_PKEY_free(own);
+    session.created = time(NULL);
+    session.bytes = 0;
+    memcpy(reply.session, session.id, sizeof(reply.session));
+    insert(peer, session);
+    status = 1;
+    Metrics_Registry::add(METRIC_SESSIONS_AGREED);
+  }
+  if (socketUtilHandler.sendMessage(fd, (char *)&reply, sizeof(reply), T_SESSION_HELLO) < 0) {
+    return -1;
+  }
+  return status;
+}
+
+/**
+ * @brief counts bytes protected by a session
+ * a session that reaches SESSION_MAX_BYTES is dropped so the next connection
+ * agrees on a new key. returns true if the session can go on, false otherwise
+ * @param peer the Peer_Identifier.id of the peer
+ * @param session the session the bytes were protected with
+ * @param bytes the number of bytes
+*/
+bool Session_Cache::addBytes(const std::string & peer, const Session & session, uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(sessionsMutex);
+  std::map<std::string, Session>::iterator it = sessions.find(peer);
+  if (it == sessions.end() || memcmp(it->second.id, session.id, sizeof(session.id)) != 0) {
+    // replaced by a newer session, only the newest one is counted
+    return true;
+  }
+  it->second.bytes += bytes;
+  if (it->second.bytes >= SESSION_MAX_BYTES) {
+    sessions.erase(it);
+    return false;
+  }
+  return true;
+}
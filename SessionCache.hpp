@@ -0,0 +1,148 @@
+#ifndef SESSION_CACHE_HPP
+#define SESSION_CACHE_HPP
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Protocol.hpp"
+#include "SocketUtilHandler.hpp"
+#include "TransferCipher.hpp"
+
+#define SESSION_TIME_TO_LIVE 3600           // seconds a session can be resumed for
+#define SESSION_MAX_BYTES (1ULL << 34)      // bytes encrypted under one key before a rekey
+#define SESSION_CACHE_MAX_PEERS 1024        // sessions kept, the oldest is dropped beyond
+#define SESSION_KEY_INFO "gnutella transfer session"
+
+// key of encrypted transfers agreed between this node and a peer. a session
+// works in both directions, whichever peer requests files can resume it
+struct Session_t {
+  unsigned char id[16];                   // chosen by the peer that accepted the exchange
+  unsigned char key[TRANSFER_KEY_SIZE];   //
+  time_t created;                         //
+  uint64_t bytes;                         // bytes sealed or opened with key so far
+};
+typedef struct Session_t Session;
+
+// sessions of encrypted file transfers by Peer_Identifier.id of the peer.
+// a new session is an ephemeral x25519 exchange, the key is hkdf-sha256 of the
+// shared secret salted with the preshared key if there is one. later
+// connections resume the session with its id and skip the exchange until it
+// expires or has protected SESSION_MAX_BYTES
+class Session_Cache {
+  Logger * logger;
+  bool enabled;                             // are transfers encrypted
+  std::vector<unsigned char> presharedKey;  // salt of session keys, may be empty
+  std::string selfId;                       // Peer_Identifier.id of this node
+  std::map<std::string, Session> sessions;  // peer id -> session
+  std::mutex sessionsMutex;                 // mutex for sessions map
+
+  /**
+ * @brief returns the fresh session of a peer
+ * returns true if there is one, expired sessions are dropped
+*/
+  bool lookup(const std::string & peer, Session & session);
+
+  /**
+ * @brief stores the session of a peer, replacing an older one
+*/
+  void insert(const std::string & peer, const Session & session);
+
+  /**
+ * @brief sets the key of a session from the x25519 exchange
+ * returns 0 if successful, -1 otherwise
+ * @param own the ephemeral key pair of this node
+ * @param peerPublic the public key of the peer
+ * @param requesterPublic the public key of the requester of the session
+ * @param accepterPublic the public key of the peer that accepted it
+ * @param session its id is set, its key will be set
+*/
+  int deriveKey(EVP_PKEY * own,
+                const unsigned char * peerPublic,
+                const unsigned char * requesterPublic,
+                const unsigned char * accepterPublic,
+                Session & session);
+
+ public:
+  Session_Cache(Logger * logger) :
+      logger(logger),
+      enabled(false),
+      presharedKey(),
+      selfId(),
+      sessions(),
+      sessionsMutex() {}
+
+  /**
+ * @brief turns encryption of transfers on or off, call before transfers start
+ * @param enabled are transfers encrypted
+ * @param presharedKey mixed into every session key, empty for none
+*/
+  void setSecurity(bool enabled, const std::vector<unsigned char> & presharedKey);
+
+  /**
+ * @brief sets the Peer_Identifier.id peers know this node by
+*/
+  void setSelfId(const std::string & selfId);
+
+  /**
+ * @brief returns true if transfers are encrypted
+*/
+  bool isEnabled();
+
+  /**
+ * @brief agrees on a session with the peer at the other end of fd
+ * resumes the session of the peer if there is one, otherwise runs an exchange.
+ * returns 0 if successful, -1 otherwise
+ * @param socketUtilHandler the handler to send and receive with
+ * @param fd the connection to the peer, after a successful Secure_Check
+ * @param peer the Peer_Identifier.id of the peer
+ * @param session will be set to the session
+*/
+  int connect(Socket_Util_Handler & socketUtilHandler,
+              int fd,
+              const std::string & peer,
+              Session & session);
+
+  /**
+ * @brief answers a Session_Hello received on fd
+ * resumes the session named in hello if it is still fresh, otherwise runs an
+ * exchange if hello carries a public key.
+ * returns 1 if a session was agreed, 0 if the requester has to send its public
+ * key, -1 otherwise
+ * @param socketUtilHandler the handler to send with
+ * @param fd the connection to the requester
+ * @param hello the hello received
+ * @param session will be set to the session if one was agreed
+*/
+  int accept(Socket_Util_Handler & socketUtilHandler,
+             int fd,
+             const Session_Hello & hello,
+             Session & session);
+
+  /**
+ * @brief counts bytes protected by a session
+ * a session that reaches SESSION_MAX_BYTES is dropped so the next connection
+ * agrees on a new key. returns true if the session can go on, false otherwise
+ * @param peer the Peer_Identifier.id of the peer
+ * @param session the session the bytes were protected with
+ * @param bytes the number of bytes
+*/
+  bool addBytes(const std::string & peer, const Session & session, uint64_t bytes);
+
+  /**
+ * @brief returns a peer id from a Peer_Identifier.id field
+*/
+  static std::string peerKey(const char * id);
+};
+
+#endif
@@ -0,0 +1,436 @@
+// runs many nodes in one process over loopback and measures query floods.
+// build like run, from every source file except the other mains:
+//   g++ -std=c++17 -O2 Simulator.cpp $(ls *.cpp | grep -v -e Run.cpp -e Bench.cpp
+//       -e Simulator.cpp) -lcrypto -pthread -o simulate
+// usage: ./simulate [key=value ...], see Sim_Config for the keys. results are
+// written to stdout as json
+#include <sys/resource.h>
+
+#include <condition_variable>
+#include <filesystem>
+#include <random>
+
+#include <nlohmann/json.hpp>
+
+#include "Node.hpp"
+
+#define SIM_SETTLE_MS 2500         // wait for handshakes and route tables after joining
+#define SIM_QUIET_MS 300           // a flood is over when no query or hit was sent this long
+#define SIM_QUERY_TIMEOUT_MS 10000 // longest wait for a flood to end
+#define SIM_POLL_MS 10             // interval of checks while waiting
+#define SIM_LOG_PATH "/tmp/gnutella-sim.log"
+
+typedef std::chrono::steady_clock Clock;
+
+// parameters of a simulation, each can be set as key=value on the command line
+struct Sim_Config_t {
+  int nodes;            // nodes in the overlay
+  std::string topology; // random, ring or scale-free
+  int maxPeers;         // maxPeers of every node
+  int maxInitPeers;     // maxInitPeers of every node, peers each node dials
+  int ttl;              // queryTimeToLive of every node
+  int holders;          // nodes sharing each queried file
+  int queries;          // queries started, one after another
+  int basePort;         // node i listens for messages on basePort + i
+  unsigned int seed;    // seed of topology and placement choices
+};
+typedef struct Sim_Config_t Sim_Config;
+
+// time of the first hit of each query, filled by the query hit callbacks
+struct Sim_Hits_t {
+  std::mutex hitsMutex;                                   //
+  std::condition_variable hitsCond;                       // signalled on a first hit
+  std::map<std::string, Clock::time_point> firstHit;      // hash -> first hit
+  std::map<std::string, int> hitCount;                    // hash -> hits received
+};
+typedef struct Sim_Hits_t Sim_Hits;
+
+/**
+ * @brief returns the q quantile of values, 0 if empty
+*/
+static double quantile(std::vector<double> values, double q) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  size_t index = std::min(values.size() - 1, (size_t)(q * values.size()));
+  return values[index];
+}
+
+/**
+ * @brief returns the mean, median, p99 and max of values as json
+*/
+static nlohmann::json summarize(const std::vector<double> & values) {
+  nlohmann::json summary;
+  double sum = 0;
+  for (double value : values) {
+    sum += value;
+  }
+  summary["mean"] = values.empty() ? 0 : sum / values.size();
+  summary["p50"] = quantile(values, 0.5);
+  summary["p99"] = quantile(values, 0.99);
+  summary["max"] = quantile(values, 1);
+  return summary;
+}
+
+/**
+ * @brief returns the peers each node dials, in the order it dials them
+ * random: maxInitPeers nodes chosen uniformly among all others.
+ * ring: the next node, then the node half way around, then random ones.
+ * scale-free: earlier nodes chosen with probability growing with their degree,
+ * like the preferential attachment of real gnutella overlays
+*/
+static std::vector<std::vector<int> > makeTopology(const Sim_Config & config,
+                                                   std::mt19937 & random) {
+  std::vector<std::vector<int> > targets(config.nodes);
+  std::uniform_int_distribution<int> anyNode(0, config.nodes - 1);
+  if (config.topology == "scale-free") {
+    std::vector<int> endpoints;  // every node once plus once per edge end
+    for (int i = 0; i < config.nodes; i++) {
+      int wanted = std::min(config.maxInitPeers, i);
+      for (int attempt = 0; (int)targets[i].size() < wanted && attempt < 8 * wanted; attempt++) {
+        std::uniform_int_distribution<size_t> pick(0, endpoints.size() - 1);
+        int target = endpoints[pick(random)];
+        if (std::find(targets[i].begin(), targets[i].end(), target) == targets[i].end()) {
+          targets[i].push_back(target);
+        }
+      }
+      for (int target : targets[i]) {
+        endpoints.push_back(target);
+        endpoints.push_back(i);
+      }
+      endpoints.push_back(i);
+    }
+    return targets;
+  }
+  for (int i = 0; i < config.nodes; i++) {
+    if (config.topology == "ring") {
+      targets[i].push_back((i + 1) % config.nodes);
+      targets[i].push_back((i + config.nodes / 2) % config.nodes);
+    }
+    while ((int)targets[i].size() < std::min(config.maxInitPeers, config.nodes - 1)) {
+      int target = anyNode(random);
+      if (target != i &&
+          std::find(targets[i].begin(), targets[i].end(), target) == targets[i].end()) {
+        targets[i].push_back(target);
+      }
+    }
+  }
+  return targets;
+}
+
+/**
+ * @brief returns the messages sent so far by type, summed over all nodes
+ * flood counts queries and hits, background everything else
+*/
+static std::map<std::string, uint64_t> messagesSent() {
+  std::unique_ptr<Metrics_Shard> total(new Metrics_Shard());
+  Metrics_Registry::snapshot(*total);
+  std::map<std::string, uint64_t> sent;
+  uint64_t all = 0;
+  for (int type = 0; type < METRICS_MAX_TYPE; type++) {
+    all += total->messagesOut[type].load();
+  }
+  sent["query"] = total->messagesOut[Metrics_Registry::typeIndex(T_QUERY)].load();
+  sent["query_hit"] = total->messagesOut[Metrics_Registry::typeIndex(T_QUERY_HIT)].load();
+  sent["flood"] = sent["query"] + sent["query_hit"];
+  sent["background"] = all - sent["flood"];
+  sent["queries_received"] = total->counters[METRIC_QUERIES_RECEIVED].load();
+  sent["query_duplicates"] = total->counters[METRIC_QUERY_DUPLICATES].load();
+  return sent;
+}
+
+/**
+ * @brief waits until no query or hit was sent for SIM_QUIET_MS or the timeout passes
+ * pings and route patches keep flowing between floods and are not waited for
+*/
+static void waitQuiet() {
+  Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(SIM_QUERY_TIMEOUT_MS);
+  uint64_t last = messagesSent()["flood"];
+  Clock::time_point lastChange = Clock::now();
+  while (Clock::now() < deadline &&
+         Clock::now() - lastChange < std::chrono::milliseconds(SIM_QUIET_MS)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_POLL_MS));
+    uint64_t now = messagesSent()["flood"];
+    if (now != last) {
+      last = now;
+      lastChange = Clock::now();
+    }
+  }
+}
+
+/**
+ * @brief parses key=value arguments into config
+ * returns 0 if successful, -1 if an argument is unknown
+*/
+static int parseArguments(int argc, char * argv[], Sim_Config & config) {
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    size_t equals = argument.find('=');
+    if (equals == std::string::npos) {
+      return -1;
+    }
+    std::string key = argument.substr(0, equals);
+    std::string value = argument.substr(equals + 1);
+    if (key == "topology") {
+      config.topology = value;
+    }
+    else if (key == "nodes") {
+      config.nodes = std::stoi(value);
+    }
+    else if (key == "maxPeers") {
+      config.maxPeers = std::stoi(value);
+    }
+    else if (key == "maxInitPeers") {
+      config.maxInitPeers = std::stoi(value);
+    }
+    else if (key == "ttl") {
+      config.ttl = std::stoi(value);
+    }
+    else if (key == "holders") {
+      config.holders = std::stoi(value);
+    }
+    else if (key == "queries") {
+      config.queries = std::stoi(value);
+    }
+    else if (key == "basePort") {
+      config.basePort = std::stoi(value);
+    }
+    else if (key == "seed") {
+      config.seed = std::stoul(value);
+    }
+    else {
+      return -1;
+    }
+  }
+  if (config.topology != "random" && config.topology != "ring" &&
+      config.topology != "scale-free") {
+    return -1;
+  }
+  return config.nodes >= 2 && config.holders <= config.nodes ? 0 : -1;
+}
+
+int main(int argc, char * argv[]) {
+  Sim_Config config = {100, "random", 5, 3, 7, 3, 20, 31000, 1};
+  try {
+    if (parseArguments(argc, argv, config) < 0) {
+      std::cerr << "Usage: ./simulate [nodes=100] [topology=random|ring|scale-free] "
+                   "[maxPeers=5] [maxInitPeers=3] [ttl=7] [holders=3] [queries=20] "
+                   "[basePort=31000] [seed=1]\n";
+      return 1;
+    }
+  }
+  catch (std::exception & e) {
+    std::cerr << "Invalid argument: " << e.what() << "\n";
+    return 1;
+  }
+  // every node needs a few descriptors for its listeners and one per connection
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  char directoryTemplate[] = "/tmp/gnutella-sim-XXXXXX";
+  if (mkdtemp(directoryTemplate) == NULL) {
+    std::cerr << "Error creating simulation directory\n";
+    return 1;
+  }
+  std::string root = directoryTemplate;
+  std::mt19937 random(config.seed);
+
+  // each queried file is shared by config.holders random nodes
+  std::vector<std::string> hashes;
+  std::vector<std::vector<int> > holdersOf;
+  std::vector<std::string> directories;
+  for (int i = 0; i < config.nodes; i++) {
+    directories.push_back(root + "/node-" + std::to_string(i));
+    mkdir(directories.back().c_str(), 0755);
+  }
+  std::uniform_int_distribution<int> anyNode(0, config.nodes - 1);
+  for (int q = 0; q < config.queries; q++) {
+    std::string content = "simulated file " + std::to_string(q) + " " +
+                          std::to_string(config.seed) + "\n";
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256((const unsigned char *)content.data(), content.size(), digest);
+    hashes.push_back(File_Util_Handler::digestToHex(digest, sizeof(digest)));
+    std::vector<int> holders;
+    while ((int)holders.size() < config.holders) {
+      int holder = anyNode(random);
+      if (std::find(holders.begin(), holders.end(), holder) != holders.end()) {
+        continue;
+      }
+      holders.push_back(holder);
+      std::ofstream file(directories[holder] + "/file-" + std::to_string(q));
+      file << content;
+    }
+    holdersOf.push_back(holders);
+  }
+
+  Logger logger(SIM_LOG_PATH);
+  logger.setLevel(LOG_LEVEL_ERROR);
+  logger.init();
+  Sim_Hits hits;
+  std::vector<std::unique_ptr<Node> > nodes;
+  std::vector<std::thread> runners;
+  std::vector<Peer_Identifier> noPeers;
+  for (int i = 0; i < config.nodes; i++) {
+    // file and user ports are picked by the kernel, nothing is downloaded
+    nodes.emplace_back(new Node(&logger,
+                                directories[i],
+                                config.maxPeers,
+                                config.maxInitPeers,
+                                config.basePort + i,
+                                0,
+                                0,
+                                config.ttl,
+                                SIM_QUERY_TIMEOUT_MS / 1000,
+                                2 * SIM_QUERY_TIMEOUT_MS / 1000,
+                                1,
+                                1,
+                                noPeers));
+    nodes[i]->setHostName("127.0.0.1");
+    nodes[i]->setQueryHitCallback([&hits](const Query_Hit & queryHit) {
+      std::string hash =
+          File_Util_Handler::digestToHex(queryHit.id.hash, sizeof(queryHit.id.hash));
+      std::lock_guard<std::mutex> lock(hits.hitsMutex);
+      if (hits.firstHit.find(hash) == hits.firstHit.end()) {
+        hits.firstHit[hash] = Clock::now();
+        hits.hitsCond.notify_all();
+      }
+      hits.hitCount[hash]++;
+      return true;
+    });
+    nodes[i]->init();
+    runners.push_back(std::thread(&Node::run, nodes[i].get()));
+  }
+
+  // listeners are up once run started, then every node dials its targets
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  std::vector<std::vector<int> > targets = makeTopology(config, random);
+  for (int i = 0; i < config.nodes; i++) {
+    std::vector<Peer_Identifier> peers;
+    for (int target : targets[i]) {
+      Peer_Identifier peer;
+      memset(&peer, 0, sizeof(peer));
+      strcpy(peer.hostName, "127.0.0.1");
+      peer.port = config.basePort + target;
+      peers.push_back(peer);
+    }
+    nodes[i]->joinNetwork(peers);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(SIM_SETTLE_MS));
+  waitQuiet();
+
+  nlohmann::json report;
+  report["config"]["nodes"] = config.nodes;
+  report["config"]["topology"] = config.topology;
+  report["config"]["maxPeers"] = config.maxPeers;
+  report["config"]["maxInitPeers"] = config.maxInitPeers;
+  report["config"]["ttl"] = config.ttl;
+  report["config"]["holders"] = config.holders;
+  report["config"]["queries"] = config.queries;
+  report["config"]["seed"] = config.seed;
+  std::vector<double> degrees;
+  for (std::unique_ptr<Node> & node : nodes) {
+    degrees.push_back(node->getPeerCount());
+  }
+  report["degree"] = summarize(degrees);
+  report["degree"]["isolated"] = std::count(degrees.begin(), degrees.end(), 0.0);
+
+  std::vector<double> firstHitMs;
+  std::vector<double> queryMessages;
+  std::vector<double> duplicateRates;
+  std::vector<double> bytesPerNode;
+  std::vector<double> backgroundRates;
+  int answered = 0;
+  std::uniform_int_distribution<int> anyOrigin(0, config.nodes - 1);
+  report["queries"] = nlohmann::json::array();
+  for (int q = 0; q < config.queries; q++) {
+    int origin = anyOrigin(random);
+    std::map<std::string, uint64_t> before = messagesSent();
+    std::vector<std::pair<uint64_t, uint64_t> > trafficBefore;
+    for (std::unique_ptr<Node> & node : nodes) {
+      trafficBefore.push_back(node->getTraffic());
+    }
+    Clock::time_point start = Clock::now();
+    nodes[origin]->initQuery(hashes[q]);
+    {
+      std::unique_lock<std::mutex> lock(hits.hitsMutex);
+      hits.hitsCond.wait_for(lock, std::chrono::milliseconds(SIM_QUERY_TIMEOUT_MS), [&] {
+        return hits.firstHit.count(hashes[q]) > 0;
+      });
+    }
+    waitQuiet();
+    std::map<std::string, uint64_t> after = messagesSent();
+
+    nlohmann::json result;
+    result["origin"] = origin;
+    result["holders"] = holdersOf[q];
+    {
+      std::lock_guard<std::mutex> lock(hits.hitsMutex);
+      std::map<std::string, Clock::time_point>::iterator hit = hits.firstHit.find(hashes[q]);
+      if (hit != hits.firstHit.end()) {
+        double ms = std::chrono::duration<double, std::milli>(hit->second - start).count();
+        result["first_hit_ms"] = ms;
+        result["hits"] = hits.hitCount[hashes[q]];
+        firstHitMs.push_back(ms);
+        answered++;
+      }
+      else {
+        result["first_hit_ms"] = nullptr;
+        result["hits"] = 0;
+      }
+    }
+    uint64_t received = after["queries_received"] - before["queries_received"];
+    uint64_t duplicates = after["query_duplicates"] - before["query_duplicates"];
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result["messages"] = after["flood"] - before["flood"];
+    result["query_messages"] = after["query"] - before["query"];
+    result["query_hit_messages"] = after["query_hit"] - before["query_hit"];
+    result["background_messages_per_second"] = (after["background"] - before["background"]) /
+                                               seconds;
+    result["duplicate_drops"] = duplicates;
+    result["duplicate_rate"] = received > 0 ? (double)duplicates / received : 0;
+    queryMessages.push_back(after["flood"] - before["flood"]);
+    backgroundRates.push_back((after["background"] - before["background"]) / seconds);
+    duplicateRates.push_back(received > 0 ? (double)duplicates / received : 0);
+    std::vector<double> nodeBytes;
+    for (size_t i = 0; i < nodes.size(); i++) {
+      std::pair<uint64_t, uint64_t> traffic = nodes[i]->getTraffic();
+      // connections opened during the query start from zero
+      uint64_t in = traffic.first >= trafficBefore[i].first ? traffic.first - trafficBefore[i].first
+                                                             : traffic.first;
+      uint64_t out = traffic.second >= trafficBefore[i].second
+                         ? traffic.second - trafficBefore[i].second
+                         : traffic.second;
+      nodeBytes.push_back(in + out);
+      bytesPerNode.push_back(in + out);
+    }
+    result["bytes_per_node"] = summarize(nodeBytes);
+    report["queries"].push_back(result);
+  }
+
+  report["summary"]["answered"] = answered;
+  report["summary"]["answer_rate"] = config.queries > 0 ? (double)answered / config.queries : 0;
+  report["summary"]["first_hit_ms"] = summarize(firstHitMs);
+  report["summary"]["messages_per_query"] = summarize(queryMessages);
+  report["summary"]["duplicate_rate"] = summarize(duplicateRates);
+  report["summary"]["bytes_per_node_per_query"] = summarize(bytesPerNode);
+  report["summary"]["background_messages_per_second"] = summarize(backgroundRates);
+  std::cout << report.dump(2) << std::endl;
+
+  for (std::unique_ptr<Node> & node : nodes) {
+    node->stop();
+  }
+  for (std::thread & runner : runners) {
+    runner.join();
+  }
+  nodes.clear();
+  logger.stop();
+  std::error_code error;
+  std::filesystem::remove_all(root, error);
+  if (error) {
+    std::cerr << "Error removing " << root << ": " << error.message() << "\n";
+  }
+  return 0;
+}
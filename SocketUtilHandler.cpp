@@ -35,7 +35,7 @@ int Socket_Util_Handler::initServerSocket(const char * port) {
   const char * hostname = NULL;
   struct addrinfo host_info;
   struct addrinfo * host_info_list;
-  int status, socket_fd;
+  int socket_fd;
 
   memset(&host_info, 0, sizeof(host_info));
 
@@ -43,8 +43,9 @@ int Socket_Util_Handler::initServerSocket(const char * port) {
   host_info.ai_socktype = SOCK_STREAM;
   host_info.ai_flags = AI_PASSIVE;
 
-  if (getaddrinfo(hostname, port, &host_info, &host_info_list) < 0) {
+  if (getaddrinfo(hostname, port, &host_info, &host_info_list) != 0) {
     logError("Error getting address info for host");
+    return -1;
   }
 
   //generate a port
@@ -57,6 +58,8 @@ int Socket_Util_Handler::initServerSocket(const char * port) {
                      host_info_list->ai_protocol);
   if (socket_fd < 0) {
     logError("Error creating socket");
+    freeaddrinfo(host_info_list);
+    return -1;
   }
 
   int yes = 1;
@@ -66,10 +69,16 @@ int Socket_Util_Handler::initServerSocket(const char * port) {
 
   if (bind(socket_fd, host_info_list->ai_addr, host_info_list->ai_addrlen) < 0) {
     logError("Error binding socket");
+    freeaddrinfo(host_info_list);
+    close(socket_fd);
+    return -1;
   }
 
   if (listen(socket_fd, 100) < 0) {
     logError("Error listening on socket");
+    freeaddrinfo(host_info_list);
+    close(socket_fd);
+    return -1;
   }
 
   freeaddrinfo(host_info_list);
@@ -82,7 +91,6 @@ int Socket_Util_Handler::initServerSocket(const char * port) {
    * returns a socket file descriptor if successful, -1 otherwise
   */
 int Socket_Util_Handler::initClientSocket(const char * hostname, const char * port) {
-  int status;
   int socket_fd;
   struct addrinfo host_info;
   struct addrinfo * host_info_list;
@@ -91,8 +99,9 @@ int Socket_Util_Handler::initClientSocket(const char * hostname, const char * po
   host_info.ai_family = AF_INET;
   host_info.ai_socktype = SOCK_STREAM;
 
-  if (getaddrinfo(hostname, port, &host_info, &host_info_list) < 0) {
-    logError("Error getting address info for host");
+  if (getaddrinfo(hostname, port, &host_info, &host_info_list) != 0) {
+    logError("Error getting address info for host " + std::string(hostname));
+    return -1;
   }
 
   socket_fd = socket(host_info_list->ai_family,
@@ -100,10 +109,15 @@ int Socket_Util_Handler::initClientSocket(const char * hostname, const char * po
                      host_info_list->ai_protocol);
   if (socket_fd < 0) {
     logError("Error creating socket");
+    freeaddrinfo(host_info_list);
+    return -1;
   }
 
   if (connect(socket_fd, host_info_list->ai_addr, host_info_list->ai_addrlen) < 0) {
-    logError("Error connecting to socket");
+    logError("Error connecting to " + std::string(hostname) + ":" + std::string(port));
+    freeaddrinfo(host_info_list);
+    close(socket_fd);
+    return -1;
   }
 
   freeaddrinfo(host_info_list);
@@ -121,53 +135,173 @@ int Socket_Util_Handler::handleClientSocket(int socket_fd) {
   int client_fd = accept(socket_fd, (struct sockaddr *)&socket_addr, &socket_addr_len);
   if (client_fd < 0) {
     logError("Error accepting connection");
+    return -1;
   }
   logEvent("Accepted connection from client");
   return client_fd;
 }
 
 /**
- * @brief send message to fd
+ * @brief send all bytes of the given buffers to fd
+ * retries on partial writes and interrupts.
  * returns 0 if successful, -1 otherwise
+ * @param fd the file descriptor to send to
+ * @param iov the buffers to send, modified while sending
+ * @param iovcnt the number of buffers
+*/
+int Socket_Util_Handler::sendAll(int fd, struct iovec * iov, int iovcnt) {
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+  while (msg.msg_iovlen > 0) {
+    ssize_t bytes_sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (bytes_sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    // skip the buffers that went out completely and trim the partial one
+    while (msg.msg_iovlen > 0 && (size_t)bytes_sent >= msg.msg_iov->iov_len) {
+      bytes_sent -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + bytes_sent;
+      msg.msg_iov->iov_len -= bytes_sent;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief receive exactly length bytes from fd
+ * retries on partial reads and interrupts.
+ * returns 0 if successful, -1 on error or if the peer closed the connection
+ * @param fd the file descriptor to receive from
+ * @param buffer the buffer to receive into
+ * @param length the number of bytes to receive
+*/
+int Socket_Util_Handler::recvAll(int fd, char * buffer, size_t length) {
+  size_t received = 0;
+  while (received < length) {
+    ssize_t bytes_received = recv(fd, buffer + received, length - received, 0);
+    if (bytes_received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (bytes_received == 0) {
+      return -1;
+    }
+    received += bytes_received;
+  }
+  return 0;
+}
+
+/**
+ * @brief send message to fd
+ * header and payload go out in a single sendmsg call.
+ * returns the length of the message if successful, -1 otherwise
  * @param fd the file descriptor to send the message to
  * @param message the message to send
  * @param length the length of the message
+ * @param type the type of the message
 */
 int Socket_Util_Handler::sendMessage(int fd, const char * message, int length, int type) {
-  if (send(fd, &type, sizeof(int), 0) < 0) {
-    logError("Error sending message type");
-  }
-  if (send(fd, &length, sizeof(int), 0) < 0) {
-    logError("Error sending message length");
+  Message_Header header;
+  header.type = htonl(type);
+  header.length = htonl(length);
+  struct iovec iov[2];
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = (void *)message;
+  iov[1].iov_len = length;
+  if (sendAll(fd, iov, 2) < 0) {
+    logError("Error sending message to fd " + std::to_string(fd));
+    return -1;
   }
-  int bytes_sent = send(fd, message, length, 0);
-  if (bytes_sent != length) {
-    logError("Error sending message");
-  }
-  logEvent("sent " + std::to_string(bytes_sent) + " bytes to fd " + std::to_string(fd));
-  return bytes_sent;
+  LOG_DEBUG(logger, "sent %d bytes to fd %d", length, fd);
+  return length;
 }
 
 /**
  * @brief receive message from fd
- * returns 0 if successful, -1 otherwise
+ * returns the length of the message if successful, -1 otherwise
  * @param fd the file descriptor to receive the message from
  * @param message the message to receive
+ * @param capacity the size of the message buffer
  * @param length will be set to the length of the message
  * @param type will be set to the type of the message
 */
-int Socket_Util_Handler::recvMessage(int fd, char * message, int * length, int * type) {
-  if (recv(fd, type, sizeof(int), 0) < 0) {
-    logError("Error receiving message type");
+int Socket_Util_Handler::recvMessage(int fd,
+                                     char * message,
+                                     int capacity,
+                                     int * length,
+                                     int * type) {
+  Message_Header header;
+  if (recvAll(fd, (char *)&header, sizeof(header)) < 0) {
+    logError("Error receiving message header from fd " + std::to_string(fd));
+    return -1;
+  }
+  header.type = ntohl(header.type);
+  header.length = ntohl(header.length);
+  if (header.length < 0 || header.length > capacity) {
+    logError("Message of " + std::to_string(header.length) + " bytes from fd " +
+             std::to_string(fd) + " does not fit in " + std::to_string(capacity));
+    return -1;
+  }
+  if (recvAll(fd, message, header.length) < 0) {
+    logError("Error receiving message from fd " + std::to_string(fd));
+    return -1;
   }
-  if (recv(fd, length, sizeof(int), 0) < 0) {
-    logError("Error receiving message length");
+  *type = header.type;
+  *length = header.length;
+  LOG_DEBUG(logger, "received %d bytes from fd %d", (int)header.length, fd);
+  return header.length;
+}
+
+/**
+ * @brief sends part of a file to fd without copying it through user space
+ * the data goes from the page cache to the socket with sendfile.
+ * returns 0 if successful, -1 otherwise
+ * @param fd the socket to send to
+ * @param fileFd the file to send from
+ * @param offset the offset in the file to start at
+ * @param length the number of bytes to send
+*/
+int Socket_Util_Handler::sendFile(int fd, int fileFd, off_t offset, size_t length) {
+  while (length > 0) {
+    ssize_t bytes_sent = sendfile(fd, fileFd, &offset, length);
+    if (bytes_sent < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      logError("Error sending file to fd " + std::to_string(fd));
+      return -1;
+    }
+    if (bytes_sent == 0) {
+      logError("File ended early while sending to fd " + std::to_string(fd));
+      return -1;
+    }
+    length -= bytes_sent;
   }
-  int bytes_received = recv(fd, message, *length, 0);
-  if (bytes_received != *length) {
-    logError("Error receiving message");
+  return 0;
+}
+
+/**
+ * @brief sets TCP_CORK on fd so a header and the data following it share segments
+ * returns 0 if successful, -1 otherwise
+ * @param fd the socket
+ * @param cork true to hold partial segments back, false to flush them
+*/
+int Socket_Util_Handler::setCork(int fd, bool cork) {
+  int value = cork ? 1 : 0;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) < 0) {
+    return -1;
   }
-  logEvent("received " + std::to_string(bytes_received) + " bytes from fd " +
-           std::to_string(fd));
-  return bytes_received;
+  return 0;
 }
\ No newline at end of file
@@ -1,12 +1,23 @@
+#ifndef SOCKET_UTIL_HANDLER_HPP
+#define SOCKET_UTIL_HANDLER_HPP
+
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <cstdlib>
 
+#include "FrameBuffer.hpp"
 #include "Logger.hpp"
+
 class Socket_Util_Handler {
   Logger * logger;
 
@@ -49,8 +60,29 @@ class Socket_Util_Handler {
   int handleClientSocket(int socket_fd);
 
   /**
- * @brief send message to fd
+ * @brief send all bytes of the given buffers to fd
+ * retries on partial writes and interrupts.
  * returns 0 if successful, -1 otherwise
+ * @param fd the file descriptor to send to
+ * @param iov the buffers to send, modified while sending
+ * @param iovcnt the number of buffers
+*/
+  int sendAll(int fd, struct iovec * iov, int iovcnt);
+
+  /**
+ * @brief receive exactly length bytes from fd
+ * retries on partial reads and interrupts.
+ * returns 0 if successful, -1 on error or if the peer closed the connection
+ * @param fd the file descriptor to receive from
+ * @param buffer the buffer to receive into
+ * @param length the number of bytes to receive
+*/
+  int recvAll(int fd, char * buffer, size_t length);
+
+  /**
+ * @brief send message to fd
+ * header and payload go out in a single sendmsg call.
+ * returns the length of the message if successful, -1 otherwise
  * @param fd the file descriptor to send the message to
  * @param message the message to send
  * @param length the length of the message
@@ -60,11 +92,33 @@ class Socket_Util_Handler {
 
   /**
  * @brief receive message from fd
- * returns 0 if successful, -1 otherwise
+ * returns the length of the message if successful, -1 otherwise
  * @param fd the file descriptor to receive the message from
  * @param message the message to receive
+ * @param capacity the size of the message buffer
  * @param length will be set to the length of the message
  * @param type will be set to the type of the message
 */
-  int recvMessage(int fd, char * message, int * length, int * type);
-};
\ No newline at end of file
+  int recvMessage(int fd, char * message, int capacity, int * length, int * type);
+
+  /**
+ * @brief sends part of a file to fd without copying it through user space
+ * the data goes from the page cache to the socket with sendfile.
+ * returns 0 if successful, -1 otherwise
+ * @param fd the socket to send to
+ * @param fileFd the file to send from
+ * @param offset the offset in the file to start at
+ * @param length the number of bytes to send
+*/
+  int sendFile(int fd, int fileFd, off_t offset, size_t length);
+
+  /**
+ * @brief sets TCP_CORK on fd so a header and the data following it share segments
+ * returns 0 if successful, -1 otherwise
+ * @param fd the socket
+ * @param cork true to hold partial segments back, false to flush them
+*/
+  int setCork(int fd, bool cork);
+};
+
+#endif
\ No newline at end of file
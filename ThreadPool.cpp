@@ -0,0 +1,165 @@
+#include "ThreadPool.hpp"
+
+/**
+ * @brief starts the worker threads
+ * @param numThreads the number of workers, 0 to use one per hardware thread
+*/
+Thread_Pool::Thread_Pool(size_t numThreads) :
+    Thread_Pool(numThreads, std::vector<size_t>(1, 1)) {}
+
+/**
+ * @brief starts the worker threads with one queue per priority
+ * @param numThreads the number of workers, 0 to use one per hardware thread
+ * @param weights tasks of each priority run per round, at least 1 each
+ * @param maxQueued tasks waiting before submit refuses more, 0 for no limit
+ * throws if weights is empty or has a weight of 0
+*/
+Thread_Pool::Thread_Pool(size_t numThreads,
+                         const std::vector<size_t> & weights,
+                         size_t maxQueued) :
+    workers(),
+    tasks(weights.size()),
+    weights(weights),
+    credits(weights),
+    queuedTasks(0),
+    maxQueued(maxQueued),
+    tasksMutex(),
+    tasksCond(),
+    idleCond(),
+    activeTasks(0),
+    stopping(false) {
+  // a priority with weight 0 never gets a turn and nextTask would spin on it
+  if (weights.empty() ||
+      std::find(weights.begin(), weights.end(), (size_t)0) != weights.end()) {
+    throw std::invalid_argument("thread pool weights must be at least 1");
+  }
+  if (numThreads == 0) {
+    numThreads = std::thread::hardware_concurrency();
+  }
+  if (numThreads == 0) {
+    numThreads = 1;
+  }
+  for (size_t i = 0; i < numThreads; i++) {
+    workers.push_back(std::thread(&Thread_Pool::workerLoop, this));
+  }
+}
+
+Thread_Pool::~Thread_Pool() {
+  stop();
+}
+
+/**
+ * @brief takes the next task by weighted round robin, caller holds tasksMutex
+ * and at least one task is queued
+*/
+std::function<void()> Thread_Pool::nextTask() {
+  while (true) {
+    for (size_t priority = 0; priority < tasks.size(); priority++) {
+      if (credits[priority] > 0 && !tasks[priority].empty()) {
+        credits[priority]--;
+        std::function<void()> task = std::move(tasks[priority].front());
+        tasks[priority].pop();
+        queuedTasks--;
+        return task;
+      }
+    }
+    // every priority with tasks used its turns, start the next round
+    credits = weights;
+  }
+}
+
+/**
+ * @brief runs tasks until the pool is stopped
+*/
+void Thread_Pool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(tasksMutex);
+      tasksCond.wait(lock, [this] { return stopping || queuedTasks > 0; });
+      if (queuedTasks == 0) {
+        return;
+      }
+      task = nextTask();
+      activeTasks++;
+    }
+    try {
+      task();
+    }
+    catch (std::exception & e) {
+      // tasks report their own errors, keep the worker alive
+    }
+    {
+      std::lock_guard<std::mutex> lock(tasksMutex);
+      activeTasks--;
+    }
+    idleCond.notify_all();
+  }
+}
+
+/**
+ * @brief queues a task for the workers
+ * returns true if queued, false if the pool is stopping or its queue is full
+ * @param task the task to run
+ * @param priority the priority of the task, lower runs first
+*/
+bool Thread_Pool::submit(std::function<void()> task, size_t priority) {
+  {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    if (stopping || (maxQueued > 0 && queuedTasks >= maxQueued)) {
+      return false;
+    }
+    // unknown priorities queue with the lowest one
+    tasks[std::min(priority, tasks.size() - 1)].push(std::move(task));
+    queuedTasks++;
+  }
+  tasksCond.notify_one();
+  return true;
+}
+
+/**
+ * @brief blocks until no task is queued or running
+*/
+void Thread_Pool::waitIdle() {
+  std::unique_lock<std::mutex> lock(tasksMutex);
+  idleCond.wait(lock, [this] { return queuedTasks == 0 && activeTasks == 0; });
+}
+
+/**
+ * @brief stops accepting tasks, runs the queued ones and joins the workers
+*/
+void Thread_Pool::stop() {
+  {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    stopping = true;
+  }
+  tasksCond.notify_all();
+  for (std::thread & worker : workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+/**
+ * @brief returns the number of worker threads
+*/
+size_t Thread_Pool::size() const {
+  return workers.size();
+}
+
+/**
+ * @brief returns the number of queued and running tasks
+*/
+size_t Thread_Pool::pending() {
+  std::lock_guard<std::mutex> lock(tasksMutex);
+  return queuedTasks + activeTasks;
+}
+
+/**
+ * @brief returns the number of tasks of a priority waiting for a worker
+*/
+size_t Thread_Pool::queued(size_t priority) {
+  std::lock_guard<std::mutex> lock(tasksMutex);
+  return priority < tasks.size() ? tasks[priority].size() : 0;
+}
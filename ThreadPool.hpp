@@ -0,0 +1,93 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// workers running queued tasks. tasks are queued by priority, 0 first, and
+// each priority is served weighted round robin: within a round priority p runs
+// up to weights[p] tasks before lower priorities get a turn, a priority with
+// nothing queued gives its turn away
+class Thread_Pool {
+  std::vector<std::thread> workers;                        // worker threads
+  std::vector<std::queue<std::function<void()> > > tasks;  // priority -> tasks waiting
+  std::vector<size_t> weights;                             // priority -> tasks per round
+  std::vector<size_t> credits;                             // priority -> tasks left this round
+  size_t queuedTasks;                                      // tasks waiting in any priority
+  size_t maxQueued;                                        // queuedTasks limit, 0 for none
+  std::mutex tasksMutex;                                   // mutex for tasks and counters
+  std::condition_variable tasksCond;                       // signalled when a task is queued
+  std::condition_variable idleCond;                        // signalled when a task finishes
+  size_t activeTasks;                                      // tasks currently running
+  bool stopping;                                           // set when the pool shuts down
+
+  /**
+ * @brief takes the next task by weighted round robin, caller holds tasksMutex
+ * and at least one task is queued
+*/
+  std::function<void()> nextTask();
+
+  /**
+ * @brief runs tasks until the pool is stopped
+*/
+  void workerLoop();
+
+ public:
+  /**
+ * @brief starts the worker threads
+ * @param numThreads the number of workers, 0 to use one per hardware thread
+*/
+  Thread_Pool(size_t numThreads);
+
+  /**
+ * @brief starts the worker threads with one queue per priority
+ * @param numThreads the number of workers, 0 to use one per hardware thread
+ * @param weights tasks of each priority run per round, at least 1 each
+ * @param maxQueued tasks waiting before submit refuses more, 0 for no limit
+ * throws if weights is empty or has a weight of 0
+*/
+  Thread_Pool(size_t numThreads, const std::vector<size_t> & weights, size_t maxQueued = 0);
+
+  ~Thread_Pool();
+
+  /**
+ * @brief queues a task for the workers
+ * returns true if queued, false if the pool is stopping or its queue is full
+ * @param task the task to run
+ * @param priority the priority of the task, lower runs first
+*/
+  bool submit(std::function<void()> task, size_t priority = 0);
+
+  /**
+ * @brief blocks until no task is queued or running
+*/
+  void waitIdle();
+
+  /**
+ * @brief stops accepting tasks, runs the queued ones and joins the workers
+*/
+  void stop();
+
+  /**
+ * @brief returns the number of worker threads
+*/
+  size_t size() const;
+
+  /**
+ * @brief returns the number of queued and running tasks
+*/
+  size_t pending();
+
+  /**
+ * @brief returns the number of tasks of a priority waiting for a worker
+*/
+  size_t queued(size_t priority);
+};
+
+#endif
@@ -0,0 +1,347 @@
+#include "TransferCipher.hpp"
+
+typedef std::function<int(uint64_t record, int slot)> Pipeline_Stage;
+
+/**
+ * @brief passes records through stages, every stage on its own thread
+ * stage s takes record r once stage s - 1 is done with it, at most depth records
+ * are past the first stage and not yet through the last, so slot r % depth is
+ * free again when record r enters. the last stage runs on the calling thread.
+ * stops at the first stage returning -1
+ * returns 0 if successful, -1 otherwise
+*/
+static int runPipeline(uint64_t records, int depth, const std::vector<Pipeline_Stage> & stages) {
+  if (records < 2) {
+    // nothing to overlap, spare the threads
+    for (uint64_t r = 0; r < records; r++) {
+      for (const Pipeline_Stage & stage : stages) {
+        if (stage(r, 0) < 0) {
+          return -1;
+        }
+      }
+    }
+    return 0;
+  }
+  std::mutex pipelineMutex;
+  std::condition_variable pipelineCond;
+  std::vector<uint64_t> done(stages.size(), 0);  // stage -> records it finished
+  bool failed = false;
+  std::function<void(size_t)> runStage = [&](size_t s) {
+    for (uint64_t r = 0; r < records; r++) {
+      {
+        std::unique_lock<std::mutex> lock(pipelineMutex);
+        pipelineCond.wait(lock, [&] {
+          return failed || (s > 0 ? done[s - 1] > r : r < done.back() + depth);
+        });
+        if (failed) {
+          return;
+        }
+      }
+      int status = stages[s](r, r % depth);
+      {
+        std::lock_guard<std::mutex> lock(pipelineMutex);
+        if (status < 0) {
+          failed = true;
+        }
+        else {
+          done[s] = r + 1;
+        }
+      }
+      pipelineCond.notify_all();
+      if (status < 0) {
+        return;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t s = 0; s + 1 < stages.size(); s++) {
+    threads.push_back(std::thread(runStage, s));
+  }
+  runStage(stages.size() - 1);
+  for (std::thread & thread : threads) {
+    thread.join();
+  }
+  return failed ? -1 : 0;
+}
+
+/**
+ * @brief reads exactly length bytes of fd at offset
+ * returns 0 if successful, -1 on error or end of file
+*/
+static int readAt(int fd, char * data, size_t length, off_t offset) {
+  while (length > 0) {
+    ssize_t bytes_read = pread(fd, data, length, offset);
+    if (bytes_read < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (bytes_read == 0) {
+      return -1;
+    }
+    data += bytes_read;
+    length -= bytes_read;
+    offset += bytes_read;
+  }
+  return 0;
+}
+
+/**
+ * @brief sets the additional data of a record, the file hash and the big endian offset
+*/
+static void recordAad(const unsigned char * hash, uint64_t offset, unsigned char * aad) {
+  memcpy(aad, hash, 32);
+  for (int i = 0; i < 8; i++) {
+    aad[32 + i] = (offset >> (56 - 8 * i)) & 0xff;
+  }
+}
+
+/**
+ * @brief keys a cipher for one direction of a connection
+ * throws if the cipher cannot be set up
+ * @param key TRANSFER_KEY_SIZE bytes shared by both peers
+ * @param encrypt true for the sender of files, false for the receiver
+*/
+Transfer_Cipher::Transfer_Cipher(const unsigned char * key, bool encrypt) :
+    ctx(EVP_CIPHER_CTX_new()),
+    encrypt(encrypt),
+    bytes(0),
+    slots() {
+  memset(iv, 0, sizeof(iv));
+  memset(hash, 0, sizeof(hash));
+  memset(tags, 0, sizeof(tags));
+  // the key schedule is set up once, records only change the nonce
+  if (ctx == NULL ||
+      1 != EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, key, NULL, encrypt ? 1 : 0)) {
+    EVP_CIPHER_CTX_free(ctx);
+    throw std::runtime_error("could not set up aes-256-gcm");
+  }
+}
+
+Transfer_Cipher::~Transfer_Cipher() {
+  EVP_CIPHER_CTX_free(ctx);
+}
+
+/**
+ * @brief seals or opens one record in place
+ * returns 0 if successful, -1 if opening fails authentication
+*/
+int Transfer_Cipher::apply(uint64_t record,
+                           const unsigned char * aad,
+                           size_t aadLength,
+                           char * data,
+                           size_t length,
+                           unsigned char * tag) {
+  unsigned char nonce[TRANSFER_NONCE_SIZE];
+  memcpy(nonce, iv, sizeof(nonce));
+  for (int i = 0; i < 8; i++) {
+    nonce[TRANSFER_NONCE_SIZE - 1 - i] ^= (record >> (8 * i)) & 0xff;
+  }
+  unsigned char final[TRANSFER_TAG_SIZE];
+  int outLength;
+  if (1 != EVP_CipherInit_ex(ctx, NULL, NULL, NULL, nonce, -1) ||
+      1 != EVP_CipherUpdate(ctx, NULL, &outLength, aad, aadLength)) {
+    return -1;
+  }
+  if (length > 0 && 1 != EVP_CipherUpdate(ctx,
+                                          (unsigned char *)data,
+                                          &outLength,
+                                          (const unsigned char *)data,
+                                          length)) {
+    return -1;
+  }
+  if (!encrypt &&
+      1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TRANSFER_TAG_SIZE, (void *)tag)) {
+    return -1;
+  }
+  if (1 != EVP_CipherFinal_ex(ctx, final, &outLength)) {
+    return -1;
+  }
+  if (encrypt && 1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TRANSFER_TAG_SIZE, tag)) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief picks a fresh iv for meta and sets its tag, records sent after it use that iv
+ * returns 0 if successful, -1 otherwise
+ * @param meta the meta to send, iv and tag are overwritten
+*/
+int Transfer_Cipher::seal(File_Meta & meta) {
+  if (1 != RAND_bytes((unsigned char *)meta.iv, sizeof(meta.iv))) {
+    return -1;
+  }
+  memcpy(iv, meta.iv, sizeof(iv));
+  memcpy(hash, meta.hash, sizeof(hash));
+  // the meta is the additional data of an empty record, its tag counts as zero
+  memset(meta.tag, 0, sizeof(meta.tag));
+  unsigned char tag[TRANSFER_TAG_SIZE];
+  if (apply(TRANSFER_META_RECORD, (const unsigned char *)&meta, sizeof(meta), NULL, 0, tag) <
+      0) {
+    return -1;
+  }
+  memcpy(meta.tag, tag, sizeof(meta.tag));
+  return 0;
+}
+
+/**
+ * @brief checks the tag of a received meta, records received after it use its iv
+ * returns true if the meta is authentic
+ * @param meta the meta received
+*/
+bool Transfer_Cipher::open(const File_Meta & meta) {
+  File_Meta aad;
+  memcpy(&aad, &meta, sizeof(aad));
+  memset(aad.tag, 0, sizeof(aad.tag));
+  unsigned char tag[TRANSFER_TAG_SIZE];
+  memcpy(tag, meta.tag, sizeof(tag));
+  memcpy(iv, meta.iv, sizeof(iv));
+  memcpy(hash, meta.hash, sizeof(hash));
+  return apply(TRANSFER_META_RECORD, (const unsigned char *)&aad, sizeof(aad), NULL, 0, tag) ==
+         0;
+}
+
+/**
+ * @brief seals one record in place
+ * returns 0 if successful, -1 otherwise
+ * @param record the index of the record in the range
+ * @param offset the offset of the record in the file
+ * @param data the record, replaced by its ciphertext
+ * @param length the length of the record
+ * @param tag will be set to the TRANSFER_TAG_SIZE byte tag
+*/
+int Transfer_Cipher::sealRecord(uint64_t record,
+                                uint64_t offset,
+                                char * data,
+                                size_t length,
+                                unsigned char * tag) {
+  unsigned char aad[40];
+  recordAad(hash, offset, aad);
+  if (apply(record, aad, sizeof(aad), data, length, tag) < 0) {
+    return -1;
+  }
+  bytes += length;
+  return 0;
+}
+
+/**
+ * @brief opens one record in place
+ * returns 0 if the record is authentic, -1 otherwise
+ * @param record the index of the record in the range
+ * @param offset the offset of the record in the file
+ * @param data the ciphertext, replaced by the record
+ * @param length the length of the record
+ * @param tag the tag received with the record
+*/
+int Transfer_Cipher::openRecord(uint64_t record,
+                                uint64_t offset,
+                                char * data,
+                                size_t length,
+                                const unsigned char * tag) {
+  unsigned char aad[40];
+  recordAad(hash, offset, aad);
+  unsigned char expected[TRANSFER_TAG_SIZE];
+  memcpy(expected, tag, sizeof(expected));
+  if (apply(record, aad, sizeof(aad), data, length, expected) < 0) {
+    return -1;
+  }
+  bytes += length;
+  return 0;
+}
+
+/**
+ * @brief returns the bytes sealed or opened since the last call
+*/
+uint64_t Transfer_Cipher::takeBytes() {
+  uint64_t taken = bytes;
+  bytes = 0;
+  return taken;
+}
+
+/**
+ * @brief sends part of a file as sealed records
+ * reading, sealing and sending run on their own threads so the three overlap.
+ * returns 0 if successful, -1 otherwise
+ * @param socketUtilHandler the handler to send with
+ * @param fd the socket to send to
+ * @param fileFd the file to read from
+ * @param offset the offset in the file to start at
+ * @param length the number of bytes to send
+*/
+int Transfer_Cipher::sendRange(Socket_Util_Handler & socketUtilHandler,
+                               int fd,
+                               int fileFd,
+                               uint64_t offset,
+                               uint64_t length) {
+  if (slots.empty()) {
+    slots.resize((size_t)TRANSFER_PIPELINE_DEPTH * TRANSFER_RECORD_SIZE);
+  }
+  uint64_t records = (length + TRANSFER_RECORD_SIZE - 1) / TRANSFER_RECORD_SIZE;
+  std::function<size_t(uint64_t)> recordLength = [&](uint64_t record) {
+    return (size_t)std::min((uint64_t)TRANSFER_RECORD_SIZE,
+                            length - record * TRANSFER_RECORD_SIZE);
+  };
+  std::vector<Pipeline_Stage> stages;
+  stages.push_back([&](uint64_t record, int slot) {
+    return readAt(fileFd,
+                  slots.data() + (size_t)slot * TRANSFER_RECORD_SIZE,
+                  recordLength(record),
+                  offset + record * TRANSFER_RECORD_SIZE);
+  });
+  stages.push_back([&](uint64_t record, int slot) {
+    return sealRecord(record,
+                      offset + record * TRANSFER_RECORD_SIZE,
+                      slots.data() + (size_t)slot * TRANSFER_RECORD_SIZE,
+                      recordLength(record),
+                      tags[slot]);
+  });
+  stages.push_back([&](uint64_t record, int slot) {
+    struct iovec iov[2];
+    iov[0].iov_base = slots.data() + (size_t)slot * TRANSFER_RECORD_SIZE;
+    iov[0].iov_len = recordLength(record);
+    iov[1].iov_base = tags[slot];
+    iov[1].iov_len = TRANSFER_TAG_SIZE;
+    return socketUtilHandler.sendAll(fd, iov, 2);
+  });
+  return runPipeline(records, TRANSFER_PIPELINE_DEPTH, stages);
+}
+
+/**
+ * @brief receives part of a file sent by sendRange
+ * records are opened on another thread while the next ones arrive.
+ * returns 0 if every record is authentic, -1 otherwise
+ * @param socketUtilHandler the handler to receive with
+ * @param fd the socket to receive from
+ * @param buffer will be set to the bytes, must hold length bytes
+ * @param offset the offset in the file of the first byte
+ * @param length the number of bytes to receive
+*/
+int Transfer_Cipher::recvRange(Socket_Util_Handler & socketUtilHandler,
+                               int fd,
+                               char * buffer,
+                               uint64_t offset,
+                               uint64_t length) {
+  uint64_t records = (length + TRANSFER_RECORD_SIZE - 1) / TRANSFER_RECORD_SIZE;
+  std::function<size_t(uint64_t)> recordLength = [&](uint64_t record) {
+    return (size_t)std::min((uint64_t)TRANSFER_RECORD_SIZE,
+                            length - record * TRANSFER_RECORD_SIZE);
+  };
+  std::vector<Pipeline_Stage> stages;
+  stages.push_back([&](uint64_t record, int slot) {
+    if (socketUtilHandler.recvAll(
+            fd, buffer + record * TRANSFER_RECORD_SIZE, recordLength(record)) < 0) {
+      return -1;
+    }
+    return socketUtilHandler.recvAll(fd, (char *)tags[slot], TRANSFER_TAG_SIZE);
+  });
+  stages.push_back([&](uint64_t record, int slot) {
+    return openRecord(record,
+                      offset + record * TRANSFER_RECORD_SIZE,
+                      buffer + record * TRANSFER_RECORD_SIZE,
+                      recordLength(record),
+                      tags[slot]);
+  });
+  return runPipeline(records, TRANSFER_PIPELINE_DEPTH, stages);
+}
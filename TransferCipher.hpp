@@ -0,0 +1,150 @@
+#ifndef TRANSFER_CIPHER_HPP
+#define TRANSFER_CIPHER_HPP
+
+#include <errno.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Protocol.hpp"
+#include "SocketUtilHandler.hpp"
+
+#define TRANSFER_KEY_SIZE 32              // aes-256
+#define TRANSFER_NONCE_SIZE 12            // gcm nonce, the first bytes of File_Meta.iv
+#define TRANSFER_TAG_SIZE 16              // gcm tag following every record
+#define TRANSFER_RECORD_SIZE (1 << 16)    // plaintext bytes sealed per record
+#define TRANSFER_PIPELINE_DEPTH 8         // records in flight between pipeline stages
+#define TRANSFER_META_RECORD UINT64_MAX   // record number the File_Meta is sealed as
+
+// AES-256-GCM of the file bytes sent on a file connection. every File_Meta
+// carries a fresh random iv and a tag authenticating the meta itself, the
+// requested bytes follow as records of TRANSFER_RECORD_SIZE, each sealed on its
+// own and followed by its tag. the nonce of record n is the iv xor n, the
+// record is bound to the file hash and its offset so records cannot be moved.
+// one cipher serves one direction of one connection and is not thread safe
+class Transfer_Cipher {
+  EVP_CIPHER_CTX * ctx;                         // keyed once, only the nonce changes
+  bool encrypt;                                 // seals if true, opens otherwise
+  uint64_t bytes;                               // bytes sealed or opened since takeBytes
+  unsigned char iv[TRANSFER_NONCE_SIZE];        // iv of the current File_Meta
+  unsigned char hash[32];                       // hash of the file of the current File_Meta
+  std::vector<char> slots;                      // TRANSFER_PIPELINE_DEPTH record buffers
+  unsigned char tags[TRANSFER_PIPELINE_DEPTH]   //
+                    [TRANSFER_TAG_SIZE];        // tag of the record in each slot
+
+  /**
+ * @brief seals or opens one record in place
+ * returns 0 if successful, -1 if opening fails authentication
+*/
+  int apply(uint64_t record,
+            const unsigned char * aad,
+            size_t aadLength,
+            char * data,
+            size_t length,
+            unsigned char * tag);
+
+ public:
+  /**
+ * @brief keys a cipher for one direction of a connection
+ * throws if the cipher cannot be set up
+ * @param key TRANSFER_KEY_SIZE bytes shared by both peers
+ * @param encrypt true for the sender of files, false for the receiver
+*/
+  Transfer_Cipher(const unsigned char * key, bool encrypt);
+  ~Transfer_Cipher();
+
+  Transfer_Cipher(const Transfer_Cipher &) = delete;
+  Transfer_Cipher & operator=(const Transfer_Cipher &) = delete;
+
+  /**
+ * @brief picks a fresh iv for meta and sets its tag, records sent after it use that iv
+ * returns 0 if successful, -1 otherwise
+ * @param meta the meta to send, iv and tag are overwritten
+*/
+  int seal(File_Meta & meta);
+
+  /**
+ * @brief checks the tag of a received meta, records received after it use its iv
+ * returns true if the meta is authentic
+ * @param meta the meta received
+*/
+  bool open(const File_Meta & meta);
+
+  /**
+ * @brief seals one record in place
+ * returns 0 if successful, -1 otherwise
+ * @param record the index of the record in the range
+ * @param offset the offset of the record in the file
+ * @param data the record, replaced by its ciphertext
+ * @param length the length of the record
+ * @param tag will be set to the TRANSFER_TAG_SIZE byte tag
+*/
+  int sealRecord(uint64_t record,
+                 uint64_t offset,
+                 char * data,
+                 size_t length,
+                 unsigned char * tag);
+
+  /**
+ * @brief opens one record in place
+ * returns 0 if the record is authentic, -1 otherwise
+ * @param record the index of the record in the range
+ * @param offset the offset of the record in the file
+ * @param data the ciphertext, replaced by the record
+ * @param length the length of the record
+ * @param tag the tag received with the record
+*/
+  int openRecord(uint64_t record,
+                 uint64_t offset,
+                 char * data,
+                 size_t length,
+                 const unsigned char * tag);
+
+  /**
+ * @brief returns the bytes sealed or opened since the last call
+*/
+  uint64_t takeBytes();
+
+  /**
+ * @brief sends part of a file as sealed records
+ * reading, sealing and sending run on their own threads so the three overlap.
+ * returns 0 if successful, -1 otherwise
+ * @param socketUtilHandler the handler to send with
+ * @param fd the socket to send to
+ * @param fileFd the file to read from
+ * @param offset the offset in the file to start at
+ * @param length the number of bytes to send
+*/
+  int sendRange(Socket_Util_Handler & socketUtilHandler,
+                int fd,
+                int fileFd,
+                uint64_t offset,
+                uint64_t length);
+
+  /**
+ * @brief receives part of a file sent by sendRange
+ * records are opened on another thread while the next ones arrive.
+ * returns 0 if every record is authentic, -1 otherwise
+ * @param socketUtilHandler the handler to receive with
+ * @param fd the socket to receive from
+ * @param buffer will be set to the bytes, must hold length bytes
+ * @param offset the offset in the file of the first byte
+ * @param length the number of bytes to receive
+*/
+  int recvRange(Socket_Util_Handler & socketUtilHandler,
+                int fd,
+                char * buffer,
+                uint64_t offset,
+                uint64_t length);
+};
+
+#endif
@@ -0,0 +1,365 @@
+#include "WireCodec.hpp"
+
+// cursor over a caller buffer, sets failed instead of writing past the end
+struct Wire_Writer_t {
+  unsigned char * data;  //
+  size_t capacity;       //
+  size_t length;         // bytes written so far
+  bool failed;           // something did not fit
+};
+typedef struct Wire_Writer_t Wire_Writer;
+
+// cursor over a received message, sets failed instead of reading past the end
+struct Wire_Reader_t {
+  const unsigned char * data;  //
+  size_t length;               //
+  size_t offset;               // bytes read so far
+  bool failed;                 // the message ended early or is malformed
+};
+typedef struct Wire_Reader_t Wire_Reader;
+
+static Wire_Writer makeWriter(char * buffer, size_t capacity) {
+  Wire_Writer writer;
+  writer.data = (unsigned char *)buffer;
+  writer.capacity = capacity;
+  writer.length = 0;
+  writer.failed = false;
+  return writer;
+}
+
+static Wire_Reader makeReader(const char * data, size_t length) {
+  Wire_Reader reader;
+  reader.data = (const unsigned char *)data;
+  reader.length = length;
+  reader.offset = 0;
+  reader.failed = false;
+  return reader;
+}
+
+static void putBytes(Wire_Writer & writer, const void * bytes, size_t length) {
+  if (writer.failed || writer.capacity - writer.length < length) {
+    writer.failed = true;
+    return;
+  }
+  memcpy(writer.data + writer.length, bytes, length);
+  writer.length += length;
+}
+
+static void putByte(Wire_Writer & writer, unsigned char byte) {
+  putBytes(writer, &byte, 1);
+}
+
+static void putVarint(Wire_Writer & writer, uint64_t value) {
+  unsigned char bytes[10];
+  size_t length = 0;
+  while (value >= 0x80) {
+    bytes[length++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  bytes[length++] = (unsigned char)value;
+  putBytes(writer, bytes, length);
+}
+
+static void putString(Wire_Writer & writer, const char * string, size_t capacity) {
+  size_t length = strnlen(string, capacity);
+  putVarint(writer, length);
+  putBytes(writer, string, length);
+}
+
+static void getBytes(Wire_Reader & reader, void * bytes, size_t length) {
+  if (reader.failed || reader.length - reader.offset < length) {
+    reader.failed = true;
+    return;
+  }
+  memcpy(bytes, reader.data + reader.offset, length);
+  reader.offset += length;
+}
+
+static unsigned char getByte(Wire_Reader & reader) {
+  unsigned char byte = 0;
+  getBytes(reader, &byte, 1);
+  return byte;
+}
+
+static uint64_t getVarint(Wire_Reader & reader) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned char byte = getByte(reader);
+    if (reader.failed) {
+      return 0;
+    }
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  reader.failed = true;
+  return 0;
+}
+
+/**
+ * @brief reads a string into a fixed field, the field is always nul terminated
+*/
+static void getString(Wire_Reader & reader, char * string, size_t capacity) {
+  uint64_t length = getVarint(reader);
+  if (length >= capacity) {
+    reader.failed = true;
+  }
+  if (reader.failed) {
+    string[0] = '\0';
+    return;
+  }
+  getBytes(reader, string, length);
+  string[reader.failed ? 0 : length] = '\0';
+}
+
+static void putPeer(Wire_Writer & writer, const Peer_Identifier & peer) {
+  char hostName[sizeof(peer.hostName)];
+  memcpy(hostName, peer.hostName, sizeof(hostName));
+  hostName[sizeof(hostName) - 1] = '\0';
+  unsigned char address[16];
+  if (inet_pton(AF_INET, hostName, address) == 1) {
+    putByte(writer, WIRE_ADDRESS_IPV4);
+    putBytes(writer, address, 4);
+  }
+  else if (inet_pton(AF_INET6, hostName, address) == 1) {
+    putByte(writer, WIRE_ADDRESS_IPV6);
+    putBytes(writer, address, 16);
+  }
+  else {
+    putByte(writer, WIRE_ADDRESS_NAME);
+    putString(writer, hostName, sizeof(hostName));
+  }
+  unsigned char port[2] = {(unsigned char)(peer.port >> 8), (unsigned char)peer.port};
+  putBytes(writer, port, sizeof(port));
+  putString(writer, peer.id, sizeof(peer.id));
+}
+
+static void getPeer(Wire_Reader & reader, Peer_Identifier & peer) {
+  memset(&peer, 0, sizeof(peer));
+  unsigned char address[16];
+  switch (getByte(reader)) {
+    case WIRE_ADDRESS_IPV4:
+      getBytes(reader, address, 4);
+      if (!reader.failed) {
+        inet_ntop(AF_INET, address, peer.hostName, sizeof(peer.hostName));
+      }
+      break;
+    case WIRE_ADDRESS_IPV6:
+      getBytes(reader, address, 16);
+      if (!reader.failed) {
+        inet_ntop(AF_INET6, address, peer.hostName, sizeof(peer.hostName));
+      }
+      break;
+    case WIRE_ADDRESS_NAME:
+      getString(reader, peer.hostName, sizeof(peer.hostName));
+      break;
+    default:
+      reader.failed = true;
+      return;
+  }
+  unsigned char port[2];
+  getBytes(reader, port, sizeof(port));
+  peer.port = (unsigned short)((port[0] << 8) | port[1]);
+  // ids are used as c strings, one filling all 16 bytes would have no terminator
+  getString(reader, peer.id, sizeof(peer.id));
+}
+
+static void putQueryIdentifier(Wire_Writer & writer, const Query_Identifier & id) {
+  putPeer(writer, id.source);
+  putBytes(writer, id.hash, sizeof(id.hash));
+  putVarint(writer, id.timestamp);
+}
+
+static void getQueryIdentifier(Wire_Reader & reader, Query_Identifier & id) {
+  getPeer(reader, id.source);
+  getBytes(reader, id.hash, sizeof(id.hash));
+  id.timestamp = (unsigned int)getVarint(reader);
+}
+
+/**
+ * @brief returns the length written, -1 if the message did not fit
+*/
+static int finish(const Wire_Writer & writer) {
+  return writer.failed ? -1 : (int)writer.length;
+}
+
+/**
+ * @brief checks the version byte of a message
+ * returns true if the message can be decoded. later versions only append
+ * fields, so they are read as this version and their extra bytes are ignored
+*/
+static bool startMessage(Wire_Reader & reader) {
+  return getByte(reader) >= WIRE_VERSION && !reader.failed;
+}
+
+/**
+ * @brief encodes a message into buffer
+ * returns the length of the encoding, -1 if it does not fit in capacity
+ * @param message the message to encode
+ * @param buffer the buffer to encode into
+ * @param capacity the size of buffer
+*/
+int Wire_Codec::encode(const Ping & message, char * buffer, size_t capacity) {
+  Wire_Writer writer = makeWriter(buffer, capacity);
+  putByte(writer, WIRE_VERSION);
+  putPeer(writer, message.selfInfo);
+  putVarint(writer, message.timestamp);
+  return finish(writer);
+}
+
+int Wire_Codec::encode(const Pong & message, char * buffer, size_t capacity) {
+  Wire_Writer writer = makeWriter(buffer, capacity);
+  int count = message.num_peers;
+  if (count < 0) {
+    count = 0;
+  }
+  if (count > (int)(sizeof(message.peers) / sizeof(message.peers[0]))) {
+    count = sizeof(message.peers) / sizeof(message.peers[0]);
+  }
+  putByte(writer, WIRE_VERSION);
+  putByte(writer, message.allowed ? 1 : 0);
+  putVarint(writer, message.timestamp);
+  putVarint(writer, count);
+  for (int i = 0; i < count; i++) {
+    putPeer(writer, message.peers[i]);
+  }
+  return finish(writer);
+}
+
+int Wire_Codec::encode(const Query & message, char * buffer, size_t capacity) {
+  Wire_Writer writer = makeWriter(buffer, capacity);
+  putByte(writer, WIRE_VERSION);
+  putQueryIdentifier(writer, message.id);
+  putPeer(writer, message.prev);
+  putVarint(writer, message.ttl > 0 ? message.ttl : 0);
+  return finish(writer);
+}
+
+int Wire_Codec::encode(const Query_Hit & message, char * buffer, size_t capacity) {
+  Wire_Writer writer = makeWriter(buffer, capacity);
+  putByte(writer, WIRE_VERSION);
+  putQueryIdentifier(writer, message.id);
+  putPeer(writer, message.prev);
+  putPeer(writer, message.destination);
+  return finish(writer);
+}
+
+int Wire_Codec::encode(const Name_Search & message, char * buffer, size_t capacity) {
+  Wire_Writer writer = makeWriter(buffer, capacity);
+  putByte(writer, WIRE_VERSION);
+  putPeer(writer, message.source);
+  putString(writer, message.name, sizeof(message.name));
+  putVarint(writer, message.timestamp);
+  putPeer(writer, message.prev);
+  putVarint(writer, message.ttl > 0 ? message.ttl : 0);
+  return finish(writer);
+}
+
+int Wire_Codec::encode(const Name_Search_Hit & message, char * buffer, size_t capacity) {
+  Wire_Writer writer = makeWriter(buffer, capacity);
+  putByte(writer, WIRE_VERSION);
+  putString(writer, message.matchId.name, sizeof(message.matchId.name));
+  putBytes(writer, message.matchId.hash, sizeof(message.matchId.hash));
+  putPeer(writer, message.source);
+  putPeer(writer, message.destination);
+  putVarint(writer, message.timestamp);
+  return finish(writer);
+}
+
+/**
+ * @brief decodes a message encoded by encode
+ * returns 0 if successful, -1 if data is not a valid encoding
+ * @param data the encoded message
+ * @param length the length of data
+ * @param message will be set to the decoded message
+*/
+int Wire_Codec::decode(const char * data, size_t length, Ping & message) {
+  Wire_Reader reader = makeReader(data, length);
+  memset(&message, 0, sizeof(message));
+  if (!startMessage(reader)) {
+    return -1;
+  }
+  getPeer(reader, message.selfInfo);
+  message.timestamp = (unsigned int)getVarint(reader);
+  return reader.failed ? -1 : 0;
+}
+
+int Wire_Codec::decode(const char * data, size_t length, Pong & message) {
+  Wire_Reader reader = makeReader(data, length);
+  memset(&message, 0, sizeof(message));
+  if (!startMessage(reader)) {
+    return -1;
+  }
+  message.allowed = getByte(reader) != 0;
+  message.timestamp = (unsigned int)getVarint(reader);
+  uint64_t count = getVarint(reader);
+  if (count > sizeof(message.peers) / sizeof(message.peers[0])) {
+    return -1;
+  }
+  message.num_peers = (int)count;
+  for (uint64_t i = 0; i < count && !reader.failed; i++) {
+    getPeer(reader, message.peers[i]);
+  }
+  return reader.failed ? -1 : 0;
+}
+
+int Wire_Codec::decode(const char * data, size_t length, Query & message) {
+  Wire_Reader reader = makeReader(data, length);
+  memset(&message, 0, sizeof(message));
+  if (!startMessage(reader)) {
+    return -1;
+  }
+  getQueryIdentifier(reader, message.id);
+  getPeer(reader, message.prev);
+  uint64_t ttl = getVarint(reader);
+  if (ttl > INT32_MAX) {
+    return -1;
+  }
+  message.ttl = (int)ttl;
+  return reader.failed ? -1 : 0;
+}
+
+int Wire_Codec::decode(const char * data, size_t length, Query_Hit & message) {
+  Wire_Reader reader = makeReader(data, length);
+  memset(&message, 0, sizeof(message));
+  if (!startMessage(reader)) {
+    return -1;
+  }
+  getQueryIdentifier(reader, message.id);
+  getPeer(reader, message.prev);
+  getPeer(reader, message.destination);
+  return reader.failed ? -1 : 0;
+}
+
+int Wire_Codec::decode(const char * data, size_t length, Name_Search & message) {
+  Wire_Reader reader = makeReader(data, length);
+  memset(&message, 0, sizeof(message));
+  if (!startMessage(reader)) {
+    return -1;
+  }
+  getPeer(reader, message.source);
+  getString(reader, message.name, sizeof(message.name));
+  message.timestamp = (unsigned int)getVarint(reader);
+  getPeer(reader, message.prev);
+  uint64_t ttl = getVarint(reader);
+  if (ttl > INT32_MAX) {
+    return -1;
+  }
+  message.ttl = (int)ttl;
+  return reader.failed ? -1 : 0;
+}
+
+int Wire_Codec::decode(const char * data, size_t length, Name_Search_Hit & message) {
+  Wire_Reader reader = makeReader(data, length);
+  memset(&message, 0, sizeof(message));
+  if (!startMessage(reader)) {
+    return -1;
+  }
+  getString(reader, message.matchId.name, sizeof(message.matchId.name));
+  getBytes(reader, message.matchId.hash, sizeof(message.matchId.hash));
+  getPeer(reader, message.source);
+  getPeer(reader, message.destination);
+  message.timestamp = (unsigned int)getVarint(reader);
+  return reader.failed ? -1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef WIRE_CODEC_HPP
+#define WIRE_CODEC_HPP
+
+#include <arpa/inet.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Protocol.hpp"
+
+#define WIRE_VERSION 1                // first byte of every encoded message
+#define WIRE_MAX_MESSAGE_LENGTH 4096  // longest encoding of any message below
+
+#define WIRE_ADDRESS_NAME 0  // host name follows as a length prefixed string
+#define WIRE_ADDRESS_IPV4 4  // 4 byte address follows
+#define WIRE_ADDRESS_IPV6 6  // 16 byte address follows
+
+// compact encoding of the messages flooded between peers.
+// a message starts with WIRE_VERSION, integers are base 128 varints (low group
+// first), ports are 2 bytes in network order, strings are a varint length and
+// the bytes, host names that are ip addresses are sent as 4 or 16 bytes.
+// decoders accept WIRE_VERSION or later and ignore bytes after the last known
+// field so later versions may append fields. peer ids are at most 15 bytes.
+// nothing here allocates, messages are encoded into caller buffers
+class Wire_Codec {
+ public:
+  /**
+ * @brief encodes a message into buffer
+ * returns the length of the encoding, -1 if it does not fit in capacity
+ * @param message the message to encode
+ * @param buffer the buffer to encode into
+ * @param capacity the size of buffer
+*/
+  static int encode(const Ping & message, char * buffer, size_t capacity);
+  static int encode(const Pong & message, char * buffer, size_t capacity);
+  static int encode(const Query & message, char * buffer, size_t capacity);
+  static int encode(const Query_Hit & message, char * buffer, size_t capacity);
+  static int encode(const Name_Search & message, char * buffer, size_t capacity);
+  static int encode(const Name_Search_Hit & message, char * buffer, size_t capacity);
+
+  /**
+ * @brief decodes a message encoded by encode
+ * returns 0 if successful, -1 if data is not a valid encoding
+ * @param data the encoded message
+ * @param length the length of data
+ * @param message will be set to the decoded message
+*/
+  static int decode(const char * data, size_t length, Ping & message);
+  static int decode(const char * data, size_t length, Pong & message);
+  static int decode(const char * data, size_t length, Query & message);
+  static int decode(const char * data, size_t length, Query_Hit & message);
+  static int decode(const char * data, size_t length, Name_Search & message);
+  static int decode(const char * data, size_t length, Name_Search_Hit & message);
+};
+
+#endif